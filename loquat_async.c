@@ -0,0 +1,475 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// One submitted request, linked into the active list while in flight.
+// Finished requests go on a free list so their easy handles (and
+// connections) and response buffers are reused.
+typedef struct AsyncRequest {
+    CURL *curl;
+    ResponseData resp;
+    loquat_async_cb callback;
+    void *userdata;
+    struct AsyncRequest *prev;
+    struct AsyncRequest *next;
+} AsyncRequest;
+
+// Socket libcurl asked us to watch, kept for the built-in loop
+typedef struct {
+    curl_socket_t fd;
+    int events;
+} AsyncWatch;
+
+struct LoquatAsync {
+    CURLM *multi;
+    int pending;                  // Requests submitted but not yet completed
+    long timeout_ms;              // Last timeout requested by libcurl (-1: none)
+    struct timespec timer_set;    // When timeout_ms was requested
+    loquat_async_socket_cb socket_callback;
+    void *socket_userdata;
+    loquat_async_timer_cb timer_callback;
+    void *timer_userdata;
+    AsyncWatch *watches;
+    int watch_count;
+    int watch_capacity;
+    AsyncRequest *active;
+    AsyncRequest *free_list;
+    struct pollfd *poll_fds;      // Built-in loop's poll() set, reused across calls
+    int poll_capacity;
+    char *unix_socket;            // Socket every request goes over, or NULL for TCP
+};
+
+static long elapsed_ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L + (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+// Track the sockets libcurl wants watched and forward changes to the application
+static int async_socket_callback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp) {
+    LoquatAsync *async = userp;
+    (void)easy;
+    (void)socketp;
+
+    int events = 0;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) events |= LOQUAT_POLL_IN;
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) events |= LOQUAT_POLL_OUT;
+
+    int i;
+    for (i = 0; i < async->watch_count; i++) {
+        if (async->watches[i].fd == fd) break;
+    }
+
+    if (what == CURL_POLL_REMOVE) {
+        if (i < async->watch_count) {
+            async->watches[i] = async->watches[--async->watch_count];
+        }
+        events = LOQUAT_POLL_REMOVE;
+    } else {
+        if (i == async->watch_count) {
+            if (async->watch_count == async->watch_capacity) {
+                int capacity = async->watch_capacity ? async->watch_capacity * 2 : 16;
+                AsyncWatch *grown = realloc(async->watches, capacity * sizeof(AsyncWatch));
+                if (!grown) {
+                    fprintf(stderr, "Memory allocation failed\n");
+                    return -1;
+                }
+                async->watches = grown;
+                async->watch_capacity = capacity;
+            }
+            async->watch_count++;
+        }
+        async->watches[i].fd = fd;
+        async->watches[i].events = events;
+    }
+
+    if (async->socket_callback) {
+        async->socket_callback((int)fd, events, async->socket_userdata);
+    }
+    return 0;
+}
+
+// Remember when libcurl next needs a timeout action and tell the application
+static int async_timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    LoquatAsync *async = userp;
+    (void)multi;
+
+    async->timeout_ms = timeout_ms;
+    clock_gettime(CLOCK_MONOTONIC, &async->timer_set);
+
+    if (async->timer_callback) {
+        async->timer_callback(timeout_ms, async->timer_userdata);
+    }
+    return 0;
+}
+
+// Remove a request from the active list
+static void async_unlink(LoquatAsync *async, AsyncRequest *req) {
+    if (req->prev) req->prev->next = req->next;
+    else async->active = req->next;
+    if (req->next) req->next->prev = req->prev;
+    req->prev = req->next = NULL;
+}
+
+// Return a request to the free list
+static void async_release(LoquatAsync *async, AsyncRequest *req) {
+    req->next = async->free_list;
+    async->free_list = req;
+}
+
+// Create an async request context
+LoquatAsync* loquat_async_init(void) {
+    LoquatAsync *async = calloc(1, sizeof(LoquatAsync));
+    if (!async) {
+        fprintf(stderr, "Failed to allocate memory for async context\n");
+        return NULL;
+    }
+
+    if (!loquat_global_init()) {
+        free(async);
+        return NULL;
+    }
+
+    async->multi = curl_multi_init();
+    if (!async->multi) {
+        fprintf(stderr, "Failed to initialize CURL multi handle\n");
+        loquat_global_cleanup();
+        free(async);
+        return NULL;
+    }
+
+    async->timeout_ms = -1;
+    curl_multi_setopt(async->multi, CURLMOPT_SOCKETFUNCTION, async_socket_callback);
+    curl_multi_setopt(async->multi, CURLMOPT_SOCKETDATA, async);
+    curl_multi_setopt(async->multi, CURLMOPT_TIMERFUNCTION, async_timer_callback);
+    curl_multi_setopt(async->multi, CURLMOPT_TIMERDATA, async);
+
+    return async;
+}
+
+// Destroy an async context; requests still in flight are dropped without callbacks
+void loquat_async_cleanup(LoquatAsync *async) {
+    if (!async) return;
+
+    while (async->active) {
+        AsyncRequest *req = async->active;
+        async_unlink(async, req);
+        curl_multi_remove_handle(async->multi, req->curl);
+        async_release(async, req);
+    }
+
+    while (async->free_list) {
+        AsyncRequest *req = async->free_list;
+        async->free_list = req->next;
+        curl_easy_cleanup(req->curl);
+        free(req->resp.data);
+        free(req);
+    }
+
+    curl_multi_cleanup(async->multi);
+    free(async->watches);
+    free(async->poll_fds);
+    free(async->unix_socket);
+    free(async);
+    loquat_global_cleanup();
+}
+
+// Set the callback told which sockets to watch for which events
+void loquat_async_set_socket_callback(LoquatAsync *async, loquat_async_socket_cb callback, void *userdata) {
+    if (async) {
+        async->socket_callback = callback;
+        async->socket_userdata = userdata;
+    }
+}
+
+// Set the callback told when loquat_async_socket_action(async, -1, 0) is next due
+void loquat_async_set_timer_callback(LoquatAsync *async, loquat_async_timer_cb callback, void *userdata) {
+    if (async) {
+        async->timer_callback = callback;
+        async->timer_userdata = userdata;
+    }
+}
+
+// Send requests submitted from now on over a UNIX domain socket
+int loquat_async_set_unix_socket(LoquatAsync *async, const char *path) {
+    if (!async) {
+        return 0;
+    }
+    char *copy = NULL;
+    if (path) {
+        size_t len = strlen(path);
+        copy = malloc(len + 1);
+        if (!copy) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 0;
+        }
+        memcpy(copy, path, len + 1);
+    }
+    free(async->unix_socket);
+    async->unix_socket = copy;
+    return 1;
+}
+
+// Take a request off the free list or allocate a new one
+static AsyncRequest* async_request_acquire(LoquatAsync *async) {
+    AsyncRequest *req = async->free_list;
+    if (req) {
+        async->free_list = req->next;
+        req->next = NULL;
+        curl_easy_reset(req->curl);
+        return req;
+    }
+
+    req = calloc(1, sizeof(AsyncRequest));
+    if (!req) {
+        fprintf(stderr, "Failed to allocate memory for request\n");
+        return NULL;
+    }
+    req->curl = curl_easy_init();
+    if (!req->curl) {
+        fprintf(stderr, "Failed to initialize CURL\n");
+        free(req);
+        return NULL;
+    }
+    return req;
+}
+
+// Configure and submit one request
+static int async_submit(LoquatAsync *async, const char *base_url, const char *command,
+                        const char *post_data, loquat_async_cb callback, void *userdata) {
+    if (!async || !base_url || !command || !callback) {
+        return 0;
+    }
+
+    AsyncRequest *req = async_request_acquire(async);
+    if (!req) {
+        return 0;
+    }
+
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), base_url, "/", command);
+    if (!url) {
+        async_release(async, req);
+        return 0;
+    }
+
+    req->callback = callback;
+    req->userdata = userdata;
+    req->resp.size = 0;
+    req->resp.curl = req->curl;
+    if (req->resp.data) {
+        req->resp.data[0] = '\0';
+    }
+
+    curl_easy_setopt(req->curl, CURLOPT_SHARE, loquat_share_handle(1));
+    if (async->unix_socket) {
+        curl_easy_setopt(req->curl, CURLOPT_UNIX_SOCKET_PATH, async->unix_socket);
+    }
+    curl_easy_setopt(req->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
+    curl_easy_setopt(req->curl, CURLOPT_PRIVATE, req);
+
+    if (post_data) {
+        // The caller's buffer may be gone before the request is sent
+        curl_easy_setopt(req->curl, CURLOPT_POSTFIELDSIZE, (long)strlen(post_data));
+        curl_easy_setopt(req->curl, CURLOPT_COPYPOSTFIELDS, post_data);
+    }
+
+    curl_easy_setopt(req->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+    curl_easy_setopt(req->curl, CURLOPT_WRITEDATA, &req->resp);
+
+    long timeout = (strcmp(command, "connect") == 0) ? CONNECT_TIMEOUT : DEFAULT_TIMEOUT;
+    curl_easy_setopt(req->curl, CURLOPT_TIMEOUT, timeout);
+    curl_easy_setopt(req->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(req->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+
+    if (curl_multi_add_handle(async->multi, req->curl) != CURLM_OK) {
+        fprintf(stderr, "Failed to add request\n");
+        async_release(async, req);
+        return 0;
+    }
+
+    req->next = async->active;
+    if (async->active) async->active->prev = req;
+    async->active = req;
+    async->pending++;
+    return 1;
+}
+
+// Submit a GET request
+int loquat_async_get(LoquatAsync *async, const char *base_url, const char *command,
+                     loquat_async_cb callback, void *userdata) {
+    return async_submit(async, base_url, command, NULL, callback, userdata);
+}
+
+// Submit a POST request
+int loquat_async_post(LoquatAsync *async, const char *base_url, const char *command,
+                      const char *post_data, loquat_async_cb callback, void *userdata) {
+    return async_submit(async, base_url, command, post_data ? post_data : "", callback, userdata);
+}
+
+// Deliver every finished request to its callback and recycle its handle
+static void async_check_completed(LoquatAsync *async) {
+    CURLMsg *msg;
+    int queued;
+
+    while ((msg = curl_multi_info_read(async->multi, &queued))) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        CURL *easy = msg->easy_handle;
+        CURLcode res = msg->data.result;
+        AsyncRequest *req = NULL;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&req);
+
+        LoquatAsyncResult result = {0};
+        result.ok = (res == CURLE_OK);
+        result.error = result.ok ? NULL : curl_easy_strerror(res);
+        result.response = req->resp.data ? req->resp.data : "";
+        result.response_size = req->resp.size;
+
+        long code = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+        result.http_code = (int)code;
+
+        loquat_timing_read(easy, &result.timing);
+        result.total_time = result.timing.total;
+
+        curl_multi_remove_handle(async->multi, easy);
+        async_unlink(async, req);
+        async->pending--;
+
+        // The callback may submit new requests, so run it before recycling
+        req->callback(&result, req->userdata);
+
+        async_release(async, req);
+    }
+}
+
+// Tell the library a watched socket is ready (fd < 0 for a timeout)
+int loquat_async_socket_action(LoquatAsync *async, int fd, int events) {
+    if (!async) {
+        return 0;
+    }
+
+    int mask = 0;
+    if (events & LOQUAT_POLL_IN) mask |= CURL_CSELECT_IN;
+    if (events & LOQUAT_POLL_OUT) mask |= CURL_CSELECT_OUT;
+    if (events & LOQUAT_POLL_ERR) mask |= CURL_CSELECT_ERR;
+
+    // The timer is one-shot; libcurl re-arms it if it still needs one
+    if (fd < 0) {
+        async->timeout_ms = -1;
+    }
+
+    int running = 0;
+    CURLMcode mc = curl_multi_socket_action(async->multi,
+                                            fd < 0 ? CURL_SOCKET_TIMEOUT : (curl_socket_t)fd,
+                                            fd < 0 ? 0 : mask, &running);
+    if (mc != CURLM_OK) {
+        fprintf(stderr, "curl_multi_socket_action() failed: %s\n", curl_multi_strerror(mc));
+        return 0;
+    }
+
+    async_check_completed(async);
+    return 1;
+}
+
+// Milliseconds until a timeout action is due (-1 if none is scheduled)
+long loquat_async_timeout(LoquatAsync *async) {
+    if (!async || async->timeout_ms < 0) {
+        return -1;
+    }
+    long remaining = async->timeout_ms - elapsed_ms_since(&async->timer_set);
+    return remaining > 0 ? remaining : 0;
+}
+
+// Number of submitted requests that have not completed yet
+int loquat_async_pending(LoquatAsync *async) {
+    return async ? async->pending : 0;
+}
+
+// One pass of the built-in loop: wait up to max_wait_ms (or until libcurl
+// needs a timeout action, if sooner) and handle whatever became ready
+int loquat_async_run_once(LoquatAsync *async, long max_wait_ms) {
+    if (!async) {
+        return 0;
+    }
+
+    long timeout = loquat_async_timeout(async);
+    if (timeout == 0) {
+        return loquat_async_socket_action(async, -1, 0);
+    }
+    if (timeout < 0) {
+        timeout = 1000;
+    }
+    int capped = 0;
+    if (max_wait_ms >= 0 && max_wait_ms < timeout) {
+        timeout = max_wait_ms;
+        capped = 1;
+    }
+
+    // Snapshot the watch list; socket actions below may change it
+    int count = async->watch_count;
+    if (count > async->poll_capacity) {
+        struct pollfd *grown = realloc(async->poll_fds, count * sizeof(struct pollfd));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 0;
+        }
+        async->poll_fds = grown;
+        async->poll_capacity = count;
+    }
+    struct pollfd *fds = async->poll_fds;
+    for (int i = 0; i < count; i++) {
+        fds[i].fd = async->watches[i].fd;
+        fds[i].events = 0;
+        fds[i].revents = 0;
+        if (async->watches[i].events & LOQUAT_POLL_IN) fds[i].events |= POLLIN;
+        if (async->watches[i].events & LOQUAT_POLL_OUT) fds[i].events |= POLLOUT;
+    }
+
+    int ready = poll(fds, (nfds_t)count, (int)timeout);
+    if (ready < 0) {
+        perror("poll");
+        return 0;
+    }
+    if (ready == 0) {
+        // The caller's shorter wait ran out; nothing is due for libcurl yet
+        return capped ? 1 : loquat_async_socket_action(async, -1, 0);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (!fds[i].revents) continue;
+        int events = 0;
+        if (fds[i].revents & POLLIN) events |= LOQUAT_POLL_IN;
+        if (fds[i].revents & POLLOUT) events |= LOQUAT_POLL_OUT;
+        if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) events |= LOQUAT_POLL_ERR;
+        if (!loquat_async_socket_action(async, fds[i].fd, events)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Built-in poll() loop that runs until every submitted request has completed
+int loquat_async_run(LoquatAsync *async) {
+    if (!async) {
+        return 0;
+    }
+
+    while (async->pending > 0) {
+        if (!loquat_async_run_once(async, -1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
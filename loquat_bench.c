@@ -0,0 +1,998 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <curl/curl.h>
+#include <cjson/cJSON.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Micro-benchmarks for the client hot paths. Requests go to an in-process
+// HTTP/1.1 stand-in on the loopback interface so results do not depend on
+// a real device. Run with `make bench`.
+
+#define BENCH_MIN_TIME_NS 200000000LL   // Run each benchmark for at least 200ms
+#define BENCH_MAX_SAMPLES 100000
+#define BENCH_CHUNK_SIZE 16384          // libcurl's default write chunk size
+
+static const int ap_counts[] = { 10, 100, 1000, 10000 };
+#define AP_COUNT_SIZES (int)(sizeof(ap_counts) / sizeof(ap_counts[0]))
+
+// ---------------------------------------------------------------------------
+// Allocation counting (glibc: interpose the allocator for the whole process)
+// ---------------------------------------------------------------------------
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long alloc_count = 0;
+
+void *malloc(size_t size) {
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+#define ALLOCS_AVAILABLE 1
+static unsigned long allocs_now(void) {
+    return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+}
+#else
+#define ALLOCS_AVAILABLE 0
+static unsigned long allocs_now(void) {
+    return 0;
+}
+#endif
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// ---------------------------------------------------------------------------
+// Synthetic payloads
+// ---------------------------------------------------------------------------
+
+static char* make_scan_payload(int ap_count, size_t *len) {
+    size_t cap = (size_t)ap_count * 80 + 16;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+
+    size_t n = 0;
+    buf[n++] = '[';
+    for (int i = 0; i < ap_count; i++) {
+        n += (size_t)snprintf(buf + n, cap - n, "%s{\"ssid\":\"AccessPoint-%05d\",\"bars\":%d,\"security\":\"%s\"}",
+                              i ? "," : "", i, i % 5, (i % 3) ? "WPA2" : "Open");
+    }
+    buf[n++] = ']';
+    buf[n] = '\0';
+    *len = n;
+    return buf;
+}
+
+static const char *net_info_payload =
+    "{\"status\":\"connected\",\"ip_address\":\"192.168.1.42\",\"ssid\":\"AccessPoint-00001\"}";
+
+static const char *status_payload = "{\"status\":\"ok\"}";
+
+// ---------------------------------------------------------------------------
+// In-process loopback HTTP stand-in
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int listen_fd;
+    int port;
+    char *scan_payloads[AP_COUNT_SIZES];
+    size_t scan_lengths[AP_COUNT_SIZES];
+    char *download;                       // Served at /download, honouring Range
+    size_t download_len;
+} BenchServer;
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0) return 0;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Serve keep-alive requests on one connection until the client closes it
+static void* bench_connection(void *arg) {
+    BenchServer *server = ((void **)arg)[0];
+    int fd = (int)(long)((void **)arg)[1];
+    free(arg);
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    char buf[65536];
+    size_t have = 0;
+    for (;;) {
+        char *end = NULL;
+        while (!(end = memmem(buf, have, "\r\n\r\n", 4))) {
+            if (have == sizeof(buf)) goto done;
+            ssize_t n = read(fd, buf + have, sizeof(buf) - have);
+            if (n <= 0) goto done;
+            have += (size_t)n;
+        }
+        size_t header_len = (size_t)(end - buf) + 4;
+
+        // Skip any request body, discarding what does not fit the buffer
+        size_t body_len = 0;
+        char *cl = strcasestr(buf, "\r\nContent-Length:");
+        if (cl && cl < end) body_len = strtoul(cl + 17, NULL, 10);
+        while (have < header_len + body_len) {
+            if (have == sizeof(buf)) {
+                body_len -= have - header_len;
+                have = header_len;
+            }
+            ssize_t n = read(fd, buf + have, sizeof(buf) - have);
+            if (n <= 0) goto done;
+            have += (size_t)n;
+        }
+
+        char path[256] = "";
+        sscanf(buf, "%*s /%255s", path);
+
+        const char *body = status_payload;
+        size_t len = strlen(status_payload);
+        size_t range_start = 0;
+        size_t range_end = 0;
+        int ranged = 0;
+        if (strcmp(path, "download") == 0 && server->download) {
+            body = server->download;
+            len = server->download_len;
+            char *range = strcasestr(buf, "\r\nRange: bytes=");
+            if (range && range < end && len > 0) {
+                char *dash;
+                range_start = strtoul(range + 15, &dash, 10);
+                range_end = *dash == '-' && dash[1] != '\r' ? strtoul(dash + 1, NULL, 10) : len - 1;
+                if (range_end >= len) range_end = len - 1;
+                if (range_start <= range_end) {
+                    ranged = 1;
+                    body += range_start;
+                    len = range_end - range_start + 1;
+                }
+            }
+        } else if (strncmp(path, "get_scan_result", 15) == 0) {
+            int count = path[15] == '?' ? atoi(path + 16) : ap_counts[0];
+            for (int i = 0; i < AP_COUNT_SIZES; i++) {
+                if (ap_counts[i] == count) {
+                    body = server->scan_payloads[i];
+                    len = server->scan_lengths[i];
+                }
+            }
+        } else if (strcmp(path, "get_net_info") == 0) {
+            body = net_info_payload;
+            len = strlen(net_info_payload);
+        }
+
+        char header[256];
+        int hl = ranged ?
+            snprintf(header, sizeof(header),
+                     "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %zu-%zu/%zu\r\n"
+                     "Content-Length: %zu\r\n\r\n", range_start, range_end, server->download_len, len) :
+            snprintf(header, sizeof(header),
+                     "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n\r\n", len);
+        if (!write_all(fd, header, (size_t)hl) || !write_all(fd, body, len)) goto done;
+
+        memmove(buf, buf + header_len + body_len, have - header_len - body_len);
+        have -= header_len + body_len;
+    }
+
+done:
+    close(fd);
+    return NULL;
+}
+
+static void* bench_accept_loop(void *arg) {
+    BenchServer *server = arg;
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) return NULL;
+
+        void **conn = malloc(2 * sizeof(void *));
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn[0] = server;
+        conn[1] = (void *)(long)fd;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, bench_connection, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+static int bench_server_start(BenchServer *server) {
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) return 0;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t addr_len = sizeof(addr);
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server->listen_fd, 64) < 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        close(server->listen_fd);
+        return 0;
+    }
+    server->port = ntohs(addr.sin_port);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, bench_accept_loop, server) != 0) {
+        close(server->listen_fd);
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
+
+// Serve the same responses on a UNIX domain socket at path
+static int bench_unix_server_start(BenchServer *server, const char *path) {
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) return 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server->listen_fd, 64) < 0) {
+        close(server->listen_fd);
+        return 0;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, bench_accept_loop, server) != 0) {
+        close(server->listen_fd);
+        unlink(path);
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Harness
+// ---------------------------------------------------------------------------
+
+typedef void (*bench_fn)(void *arg);
+
+static int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static long long samples[BENCH_MAX_SAMPLES];
+
+// Run fn repeatedly for at least BENCH_MIN_TIME_NS and print one result row
+static void bench_run(const char *name, bench_fn fn, void *arg, int latency) {
+    fn(arg);    // Warm up caches, connections and buffers
+
+    long iterations = 0;
+    unsigned long allocs_start = allocs_now();
+    long long start = now_ns();
+    long long elapsed = 0;
+
+    while (elapsed < BENCH_MIN_TIME_NS || iterations < 10) {
+        long long t0 = now_ns();
+        fn(arg);
+        long long t1 = now_ns();
+        if (iterations < BENCH_MAX_SAMPLES) {
+            samples[iterations] = t1 - t0;
+        }
+        iterations++;
+        elapsed = t1 - start;
+    }
+
+    unsigned long allocs = allocs_now() - allocs_start;
+    double ns_per_op = (double)elapsed / (double)iterations;
+
+    printf("%-40s %10ld %14.0f", name, iterations, ns_per_op);
+    if (ALLOCS_AVAILABLE) {
+        printf(" %12.1f", (double)allocs / (double)iterations);
+    } else {
+        printf(" %12s", "n/a");
+    }
+
+    if (latency) {
+        long count = iterations < BENCH_MAX_SAMPLES ? iterations : BENCH_MAX_SAMPLES;
+        qsort(samples, (size_t)count, sizeof(long long), compare_ll);
+        printf(" %10.1f %10.1f", samples[count / 2] / 1000.0, samples[(count * 99) / 100] / 1000.0);
+    }
+    printf("\n");
+}
+
+// Silence the print_* functions while they are being measured
+static int stderr_saved = -1;
+
+static void quiet_stderr(void) {
+    fflush(stderr);
+    stderr_saved = dup(STDERR_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+        dup2(devnull, STDERR_FILENO);
+        close(devnull);
+    }
+}
+
+static void restore_stderr(void) {
+    fflush(stderr);
+    if (stderr_saved >= 0) {
+        dup2(stderr_saved, STDERR_FILENO);
+        close(stderr_saved);
+        stderr_saved = -1;
+    }
+}
+
+// Delete a directory of plain files (the benchmark's cache directory)
+static void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d))) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char *payload;
+    size_t len;
+    LoquatClient *client;
+    const char *command;
+    ResponseData buffer;
+    LoquatRequest *request;
+} BenchArg;
+
+// Deliver the payload the way libcurl does: in 16KB chunks to a fresh buffer
+static void bench_write_callback(void *arg) {
+    BenchArg *b = arg;
+    ResponseData resp = {0};
+    for (size_t off = 0; off < b->len; off += BENCH_CHUNK_SIZE) {
+        size_t n = b->len - off < BENCH_CHUNK_SIZE ? b->len - off : BENCH_CHUNK_SIZE;
+        loquat_write_callback((void *)(b->payload + off), 1, n, &resp);
+    }
+    free(resp.data);
+}
+
+static void bench_print_scan_result(void *arg) {
+    BenchArg *b = arg;
+    print_scan_result(b->payload);
+}
+
+static void bench_scan_parser_noop(const LoquatAccessPoint *ap, void *userdata) {
+    (void)ap;
+    (void)userdata;
+}
+
+static void bench_scan_parser(void *arg) {
+    BenchArg *b = arg;
+    LoquatScanParser parser;
+    loquat_scan_parser_init(&parser, bench_scan_parser_noop, NULL);
+    loquat_scan_parser_feed(&parser, b->payload, b->len);
+    loquat_scan_parser_finish(&parser);
+}
+
+// The fields print_scan_result reads, through cJSON
+static void bench_cjson_scan(void *arg) {
+    BenchArg *b = arg;
+    cJSON *json = cJSON_Parse(b->payload);
+    const cJSON *ap;
+    int bars = 0;
+    cJSON_ArrayForEach(ap, json) {
+        cJSON_GetObjectItem(ap, "ssid");
+        cJSON *bars_json = cJSON_GetObjectItem(ap, "bars");
+        cJSON_GetObjectItem(ap, "security");
+        bars += bars_json ? bars_json->valueint : 0;
+    }
+    cJSON_Delete(json);
+}
+
+static void bench_extract_noop(const LoquatScanView *ap, void *userdata) {
+    (void)ap;
+    (void)userdata;
+}
+
+// The same fields, in place
+static void bench_extract_scan(void *arg) {
+    BenchArg *b = arg;
+    loquat_extract_scan(b->payload, b->len, bench_extract_noop, NULL);
+}
+
+static void bench_print_net_info(void *arg) {
+    BenchArg *b = arg;
+    print_net_info_response(b->payload);
+}
+
+static void bench_connect_payload(void *arg) {
+    (void)arg;
+    char *data = get_post_connect_wifi_data("AccessPoint-00001", "correct horse battery staple", "WPA2");
+    free(data);
+}
+
+// A site's scans: every device reports per_device access points out of a
+// shared pool, with two BSSIDs per SSID
+typedef struct {
+    LoquatAccessPoint *aps;   // devices * per_device observations, device by device
+    int devices;
+    int per_device;
+} SurveyBench;
+
+static int make_survey_bench(SurveyBench *b, int devices, int per_device, int pool) {
+    b->devices = devices;
+    b->per_device = per_device;
+    b->aps = calloc((size_t)devices * (size_t)per_device, sizeof(LoquatAccessPoint));
+    if (!b->aps) {
+        return 0;
+    }
+    for (int d = 0; d < devices; d++) {
+        for (int i = 0; i < per_device; i++) {
+            LoquatAccessPoint *ap = &b->aps[(size_t)d * (size_t)per_device + (size_t)i];
+            int k = (d * 37 + i) % pool;
+            snprintf(ap->ssid, sizeof(ap->ssid), "Site-%04d", k / 2);
+            snprintf(ap->bssid, sizeof(ap->bssid), "02:00:00:00:%02x:%02x", (k >> 8) & 0xFF, k & 0xFF);
+            snprintf(ap->security, sizeof(ap->security), "WPA2");
+            ap->bars = (d + i) % 5;
+        }
+    }
+    return 1;
+}
+
+static void bench_survey_noop(const LoquatSurveyAp *ap, void *userdata) {
+    (void)ap;
+    (void)userdata;
+}
+
+static void bench_survey(void *arg) {
+    SurveyBench *b = arg;
+    LoquatSurvey *survey = loquat_survey_init();
+    for (int d = 0; d < b->devices; d++) {
+        for (int i = 0; i < b->per_device; i++) {
+            loquat_survey_add(survey, d, &b->aps[(size_t)d * (size_t)b->per_device + (size_t)i]);
+        }
+    }
+    loquat_survey_report(survey, bench_survey_noop, NULL);
+    loquat_survey_cleanup(survey);
+}
+
+static void bench_client_get(void *arg) {
+    BenchArg *b = arg;
+    char *response = NULL;
+    int http_code;
+    if (loquat_client_get(b->client, b->command, &response, &http_code)) {
+        loquat_client_free_response(response);
+    }
+}
+
+static void bench_client_get_into(void *arg) {
+    BenchArg *b = arg;
+    int http_code;
+    loquat_client_get_into(b->client, b->command, &b->buffer, &http_code);
+}
+
+static void bench_request_execute(void *arg) {
+    BenchArg *b = arg;
+    int http_code;
+    loquat_request_execute(b->request, &b->buffer, &http_code);
+}
+
+typedef struct {
+    LoquatClient *client;
+    LoquatImage *image;
+    ResponseData buffer;
+} UploadBench;
+
+static void bench_upload(void *arg) {
+    UploadBench *b = arg;
+    LoquatUploadResult result;
+    loquat_client_upload(b->client, "upload", b->image, &b->buffer, &result);
+}
+
+typedef struct {
+    LoquatClient *client;
+    const char *output;
+    int connections;
+} DownloadBench;
+
+static void bench_download(void *arg) {
+    DownloadBench *b = arg;
+    LoquatDownloadResult result;
+    loquat_client_download(b->client, "download", b->output, b->connections, &result);
+}
+
+static void bench_image_open(void *arg) {
+    // Shares the mapping the benchmark keeps open
+    loquat_image_close(loquat_image_open(arg));
+}
+
+// A burst of requests through a worker pool, waited for as a whole
+#define POOL_BURST 64
+
+typedef struct {
+    LoquatPool *pool;
+    const char *base_url;
+    unsigned long ok;
+} PoolBench;
+
+static void bench_pool_done(const LoquatAsyncResult *result, void *userdata) {
+    PoolBench *b = userdata;
+    if (result->ok && result->http_code == 200) {
+        __atomic_add_fetch(&b->ok, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void bench_pool_get(void *arg) {
+    PoolBench *b = arg;
+    for (int i = 0; i < POOL_BURST; i++) {
+        loquat_pool_get(b->pool, b->base_url, "get_status", bench_pool_done, b);
+    }
+    loquat_pool_wait(b->pool);
+}
+
+// The same GET from several threads at once, each with its own client
+#define FLIGHT_THREADS 8
+
+typedef struct {
+    LoquatClient *client;
+    const char *command;
+} FlightCaller;
+
+static void* bench_flight_get(void *arg) {
+    FlightCaller *caller = arg;
+    char *response = NULL;
+    int http_code;
+    if (loquat_client_get(caller->client, caller->command, &response, &http_code)) {
+        loquat_client_free_response(response);
+    }
+    return NULL;
+}
+
+static void bench_flight_burst(void *arg) {
+    FlightCaller *callers = arg;
+    pthread_t threads[FLIGHT_THREADS];
+    int started[FLIGHT_THREADS];
+    for (int i = 0; i < FLIGHT_THREADS; i++) {
+        started[i] = pthread_create(&threads[i], NULL, bench_flight_get, &callers[i]) == 0;
+    }
+    for (int i = 0; i < FLIGHT_THREADS; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Scan parser checks, run before timing so a rejected or misread body is
+// not benchmarked as if it were parsed. The streaming parser and the
+// extractor must agree on every body
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char *body;
+    int ok;                       // Expected to be accepted
+    int count;                    // Access points in an accepted body
+    const char *ssid;             // SSID of the last one
+    int bars;
+} ScanCheck;
+
+static const ScanCheck scan_checks[] = {
+    { "[{\"ssid\":\"a\",\"bars\":3}]", 1, 1, "a", 3 },
+    { "[{\"ssid\":\"a\"]]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\"}}", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\" \"bars\":3}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\" \"a\"}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\",}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\"},]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\"}] x", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\",\"bars\":tru}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\",\"bars\":01}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"a\",\"bars\":1.}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"\\ud83d\"}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"\\ud83dx\"}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"\\ude00\"}]", 0, 0, NULL, 0 },
+    { "[{\"ssid\":\"\\ud83d\\ude00\"}]", 1, 1, "\xF0\x9F\x98\x80", 0 },
+    { "[{\"SSID\":\"a\",\"Bars\":3}]", 1, 1, "a", 3 },
+    { "[{\"ssid\":\"a\",\"ssid\":\"b\",\"bars\":1,\"BARS\":2}]", 1, 1, "a", 1 },
+    { "[{\"ssid\":5,\"ssid\":\"b\"}]", 1, 1, "Unknown", 0 },
+    { "[1,\"x\",null,[{\"ssid\":\"n\"}],{\"ssid\":\"a\",\"bars\":-2.5e1}]", 1, 1, "a", -25 },
+    { "[{\"x\":{\"ssid\":\"n\"},\"ssid\":\"a\",\"bars\":1e10}]", 1, 1, "a", 2147483647 },
+    { " [ ] ", 1, 0, NULL, 0 },
+};
+
+typedef struct {
+    int count;
+    char ssid[LOQUAT_SSID_MAX + 1];
+    int bars;
+} ScanCheckResult;
+
+static void scan_check_ap(const LoquatAccessPoint *ap, void *userdata) {
+    ScanCheckResult *result = userdata;
+    result->count++;
+    snprintf(result->ssid, sizeof(result->ssid), "%s", ap->ssid);
+    result->bars = ap->bars;
+}
+
+// Feed body in chunks of step bytes; 1 if the outcome is as expected
+static int scan_check_parser(const ScanCheck *check, size_t step) {
+    ScanCheckResult result;
+    memset(&result, 0, sizeof(result));
+    LoquatScanParser parser;
+    loquat_scan_parser_init(&parser, scan_check_ap, &result);
+    size_t len = strlen(check->body);
+    for (size_t off = 0; off < len; off += step) {
+        loquat_scan_parser_feed(&parser, check->body + off, len - off < step ? len - off : step);
+    }
+    int ok = loquat_scan_parser_finish(&parser);
+    if (ok != check->ok) {
+        return 0;
+    }
+    return !ok || (result.count == check->count &&
+                   (!check->ssid || (strcmp(result.ssid, check->ssid) == 0 && result.bars == check->bars)));
+}
+
+static void scan_check_view(const LoquatScanView *ap, void *userdata) {
+    ScanCheckResult *result = userdata;
+    result->count++;
+    if (ap->has_ssid) {
+        loquat_string_view_copy(&ap->ssid, result->ssid, sizeof(result->ssid));
+    } else {
+        strcpy(result->ssid, "Unknown");
+    }
+    result->bars = ap->bars;
+}
+
+// The extractor must accept and read the same bodies as the streaming parser
+static int scan_check_extract(const ScanCheck *check) {
+    ScanCheckResult result;
+    memset(&result, 0, sizeof(result));
+    long count = loquat_extract_scan(check->body, strlen(check->body), scan_check_view, &result);
+    if ((count >= 0) != check->ok) {
+        return 0;
+    }
+    return count < 0 || (count == check->count &&
+                         (!check->ssid || (strcmp(result.ssid, check->ssid) == 0 && result.bars == check->bars)));
+}
+
+static int check_scan_parsers(void) {
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(scan_checks) / sizeof(scan_checks[0]); i++) {
+        const ScanCheck *check = &scan_checks[i];
+        if (!scan_check_parser(check, strlen(check->body)) || !scan_check_parser(check, 1) ||
+            !scan_check_extract(check)) {
+            fprintf(stderr, "scan parser check failed: %s\n", check->body);
+            failures++;
+        }
+    }
+    return failures == 0;
+}
+
+// Once the buffer has grown to the largest body, repeated requests into it
+// must not allocate response memory again
+#define STEADY_STATE_REQUESTS 100
+
+static int check_steady_state(LoquatClient *client, ResponseData *buffer) {
+    int http_code;
+    char largest[64];
+    snprintf(largest, sizeof(largest), "get_scan_result?%d", ap_counts[AP_COUNT_SIZES - 1]);
+    if (!loquat_client_get_into(client, largest, buffer, &http_code) || http_code != 200) {
+        fprintf(stderr, "steady state check failed: warm-up request\n");
+        return 0;
+    }
+
+    LoquatRequest *status = loquat_request_prepare(client, "get_status", NULL, NULL, 0);
+    LoquatRequest *scan = loquat_request_prepare(client, largest, NULL, NULL, 0);
+    int ok = status && scan;
+    unsigned long before = loquat_response_alloc_count();
+    for (int i = 0; ok && i < STEADY_STATE_REQUESTS; i++) {
+        ok = loquat_client_get_into(client, "get_status", buffer, &http_code) &&
+             loquat_client_get_into(client, largest, buffer, &http_code) &&
+             loquat_request_execute(status, buffer, &http_code) &&
+             loquat_request_execute(scan, buffer, &http_code);
+    }
+    unsigned long grown = loquat_response_alloc_count() - before;
+    loquat_request_free(status);
+    loquat_request_free(scan);
+
+    if (!ok || grown != 0) {
+        fprintf(stderr, "steady state check failed: %lu response buffer allocations\n", grown);
+        return 0;
+    }
+    return 1;
+}
+
+static void print_header(const char *title, int latency) {
+    printf("\n%s\n", title);
+    printf("%-40s %10s %14s %12s", "benchmark", "iters", "ns/op", "allocs/op");
+    if (latency) {
+        printf(" %10s %10s", "p50 (us)", "p99 (us)");
+    }
+    printf("\n");
+}
+
+int main(void) {
+    BenchServer server;
+    memset(&server, 0, sizeof(server));
+    if (!check_scan_parsers()) {
+        return 1;
+    }
+    for (int i = 0; i < AP_COUNT_SIZES; i++) {
+        server.scan_payloads[i] = make_scan_payload(ap_counts[i], &server.scan_lengths[i]);
+        if (!server.scan_payloads[i]) {
+            fprintf(stderr, "Failed to build payloads\n");
+            return 1;
+        }
+    }
+    if (!bench_server_start(&server)) {
+        fprintf(stderr, "Failed to start loopback server\n");
+        return 1;
+    }
+
+    char name[128];
+    BenchArg arg;
+    memset(&arg, 0, sizeof(arg));
+
+    print_header("Response buffering and parsing", 0);
+    for (int i = 0; i < AP_COUNT_SIZES; i++) {
+        arg.payload = server.scan_payloads[i];
+        arg.len = server.scan_lengths[i];
+
+        snprintf(name, sizeof(name), "write_callback/%d_aps", ap_counts[i]);
+        bench_run(name, bench_write_callback, &arg, 0);
+
+        snprintf(name, sizeof(name), "cjson_parse_scan/%d_aps", ap_counts[i]);
+        bench_run(name, bench_cjson_scan, &arg, 0);
+
+        snprintf(name, sizeof(name), "extract_scan/%d_aps", ap_counts[i]);
+        bench_run(name, bench_extract_scan, &arg, 0);
+
+        snprintf(name, sizeof(name), "print_scan_result/%d_aps", ap_counts[i]);
+        quiet_stderr();
+        bench_run(name, bench_print_scan_result, &arg, 0);
+        set_result_parser("cjson");
+        snprintf(name, sizeof(name), "print_scan_result_cjson/%d_aps", ap_counts[i]);
+        bench_run(name, bench_print_scan_result, &arg, 0);
+        set_result_parser("extract");
+        restore_stderr();
+
+        snprintf(name, sizeof(name), "scan_parser_feed/%d_aps", ap_counts[i]);
+        bench_run(name, bench_scan_parser, &arg, 0);
+    }
+
+    arg.payload = net_info_payload;
+    arg.len = strlen(net_info_payload);
+    quiet_stderr();
+    bench_run("print_net_info_response", bench_print_net_info, &arg, 0);
+    set_result_parser("cjson");
+    bench_run("print_net_info_response_cjson", bench_print_net_info, &arg, 0);
+    set_result_parser("extract");
+    restore_stderr();
+
+    bench_run("get_post_connect_wifi_data", bench_connect_payload, NULL, 0);
+
+    // Merging a site's scans, observations added and reported per run
+    static const int survey_sizes[][3] = { { 100, 100, 400 }, { 1000, 50, 2000 } };
+    for (int i = 0; i < 2; i++) {
+        SurveyBench survey;
+        if (!make_survey_bench(&survey, survey_sizes[i][0], survey_sizes[i][1], survey_sizes[i][2])) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "survey_merge/%dx%d_aps", survey_sizes[i][0], survey_sizes[i][1]);
+        bench_run(name, bench_survey, &survey, 0);
+        free(survey.aps);
+    }
+
+    // Requests over a kept-alive loopback connection
+    char base_url[64];
+    snprintf(base_url, sizeof(base_url), "http://127.0.0.1:%d", server.port);
+    arg.client = loquat_client_init(base_url);
+    if (!arg.client) {
+        fprintf(stderr, "Failed to initialize client\n");
+        return 1;
+    }
+    loquat_response_data_init(&arg.buffer, NULL, 0);
+    if (!check_steady_state(arg.client, &arg.buffer)) {
+        return 1;
+    }
+
+    print_header("Requests (loopback)", 1);
+    arg.command = "get_status";
+    bench_run("loquat_client_get/get_status", bench_client_get, &arg, 1);
+    bench_run("loquat_client_get_into/get_status", bench_client_get_into, &arg, 1);
+    arg.request = loquat_request_prepare(arg.client, arg.command, NULL, NULL, 0);
+    bench_run("loquat_request_execute/get_status", bench_request_execute, &arg, 1);
+    loquat_request_free(arg.request);
+
+    char command[64];
+    for (int i = 0; i < AP_COUNT_SIZES; i++) {
+        snprintf(command, sizeof(command), "get_scan_result?%d", ap_counts[i]);
+        arg.command = command;
+        snprintf(name, sizeof(name), "loquat_client_get/scan_%d_aps", ap_counts[i]);
+        bench_run(name, bench_client_get, &arg, 1);
+        snprintf(name, sizeof(name), "loquat_client_get_into/scan_%d_aps", ap_counts[i]);
+        bench_run(name, bench_client_get_into, &arg, 1);
+        arg.request = loquat_request_prepare(arg.client, command, NULL, NULL, 0);
+        snprintf(name, sizeof(name), "loquat_request_execute/scan_%d_aps", ap_counts[i]);
+        bench_run(name, bench_request_execute, &arg, 1);
+        loquat_request_free(arg.request);
+    }
+
+    // Bursts spread over worker threads, each with its own connection
+    static const int pool_workers[] = { 1, 2, 4, 8 };
+    for (int i = 0; i < 4; i++) {
+        PoolBench pool = { loquat_pool_init(pool_workers[i]), base_url, 0 };
+        if (!pool.pool) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "pool_get_x%d/%d_workers", POOL_BURST, pool_workers[i]);
+        bench_run(name, bench_pool_get, &pool, 1);
+        loquat_pool_cleanup(pool.pool);
+    }
+
+    // Identical scans requested together, with and without single-flight
+    FlightCaller callers[FLIGHT_THREADS];
+    int flight_clients = 0;
+    for (; flight_clients < FLIGHT_THREADS; flight_clients++) {
+        callers[flight_clients].client = loquat_client_init(base_url);
+        callers[flight_clients].command = "get_scan_result?10000";
+        if (!callers[flight_clients].client) break;
+    }
+    if (flight_clients == FLIGHT_THREADS) {
+        for (int shared = 0; shared < 2; shared++) {
+            for (int i = 0; i < FLIGHT_THREADS; i++) {
+                loquat_client_set_single_flight(callers[i].client, shared);
+            }
+            snprintf(name, sizeof(name), "loquat_client_get_x%d/scan_10000%s", FLIGHT_THREADS,
+                     shared ? "_shared" : "");
+            bench_run(name, bench_flight_burst, callers, 1);
+        }
+        LoquatFlightStats stats;
+        loquat_flight_stats(&stats);
+        printf("%-40s %lu issued, %lu coalesced\n", "  single-flight requests", stats.issued, stats.coalesced);
+    }
+    for (int i = 0; i < flight_clients; i++) {
+        loquat_client_cleanup(callers[i].client);
+    }
+
+    // Same requests answered from the on-disk response cache
+    char cache_dir[] = "/tmp/loquat_bench_XXXXXX";
+    LoquatCache *cache = mkdtemp(cache_dir) ? loquat_cache_open(cache_dir, 3600.0) : NULL;
+    if (cache) {
+        loquat_client_set_cache(arg.client, cache);
+        for (int i = 0; i < AP_COUNT_SIZES; i++) {
+            snprintf(command, sizeof(command), "get_scan_result?%d", ap_counts[i]);
+            arg.command = command;
+            snprintf(name, sizeof(name), "cached_get/scan_%d_aps", ap_counts[i]);
+            bench_run(name, bench_client_get, &arg, 1);
+            snprintf(name, sizeof(name), "cached_get_into/scan_%d_aps", ap_counts[i]);
+            bench_run(name, bench_client_get_into, &arg, 1);
+        }
+        loquat_client_set_cache(arg.client, NULL);
+        loquat_cache_close(cache);
+        remove_dir(cache_dir);
+    }
+
+    // The request rows again over a UNIX domain socket, for comparison
+    // with TCP loopback
+    BenchServer unix_server = server;
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/tmp/loquat_bench_%ld.sock", (long)getpid());
+    if (bench_unix_server_start(&unix_server, socket_path) &&
+        loquat_client_set_unix_socket(arg.client, socket_path)) {
+        print_header("Requests (UNIX socket)", 1);
+        arg.command = "get_status";
+        bench_run("loquat_client_get/get_status", bench_client_get, &arg, 1);
+        bench_run("loquat_client_get_into/get_status", bench_client_get_into, &arg, 1);
+        arg.request = loquat_request_prepare(arg.client, arg.command, NULL, NULL, 0);
+        bench_run("loquat_request_execute/get_status", bench_request_execute, &arg, 1);
+        loquat_request_free(arg.request);
+
+        for (int i = 0; i < AP_COUNT_SIZES; i++) {
+            snprintf(command, sizeof(command), "get_scan_result?%d", ap_counts[i]);
+            arg.command = command;
+            snprintf(name, sizeof(name), "loquat_client_get_into/scan_%d_aps", ap_counts[i]);
+            bench_run(name, bench_client_get_into, &arg, 1);
+            arg.request = loquat_request_prepare(arg.client, command, NULL, NULL, 0);
+            snprintf(name, sizeof(name), "loquat_request_execute/scan_%d_aps", ap_counts[i]);
+            bench_run(name, bench_request_execute, &arg, 1);
+            loquat_request_free(arg.request);
+        }
+        loquat_client_set_unix_socket(arg.client, NULL);
+        close(unix_server.listen_fd);
+        unlink(socket_path);
+    }
+
+    // Images streamed from a shared mapping
+    static const int upload_sizes_mb[] = { 1, 16 };
+    print_header("Uploads (loopback)", 1);
+    for (int i = 0; i < 2; i++) {
+        char image_path[] = "/tmp/loquat_bench_image_XXXXXX";
+        int fd = mkstemp(image_path);
+        if (fd < 0) {
+            continue;
+        }
+        size_t size = (size_t)upload_sizes_mb[i] << 20;
+        int written = ftruncate(fd, (off_t)size) == 0;
+        close(fd);
+
+        UploadBench upload = { arg.client, written ? loquat_image_open(image_path) : NULL, { 0 } };
+        if (upload.image) {
+            snprintf(name, sizeof(name), "loquat_client_upload/%d_mb", upload_sizes_mb[i]);
+            bench_run(name, bench_upload, &upload, 1);
+            snprintf(name, sizeof(name), "loquat_image_open_shared/%d_mb", upload_sizes_mb[i]);
+            bench_run(name, bench_image_open, image_path, 0);
+            loquat_image_close(upload.image);
+        }
+        loquat_response_data_free(&upload.buffer);
+        unlink(image_path);
+    }
+
+    // Range segments written in place, by connection count
+    static const int download_connections[] = { 1, 4 };
+    print_header("Downloads (loopback, 16 MB)", 1);
+    server.download_len = (size_t)16 << 20;
+    server.download = calloc(1, server.download_len);
+    if (server.download) {
+        char output[] = "/tmp/loquat_bench_download_XXXXXX";
+        int fd = mkstemp(output);
+        if (fd >= 0) {
+            close(fd);
+            for (int i = 0; i < 2; i++) {
+                DownloadBench download = { arg.client, output, download_connections[i] };
+                snprintf(name, sizeof(name), "loquat_client_download/%d_conn", download_connections[i]);
+                bench_run(name, bench_download, &download, 1);
+            }
+            unlink(output);
+        }
+    }
+
+    loquat_response_data_free(&arg.buffer);
+    loquat_client_cleanup(arg.client);
+    for (int i = 0; i < AP_COUNT_SIZES; i++) {
+        free(server.scan_payloads[i]);
+    }
+    free(server.download);
+    return 0;
+}
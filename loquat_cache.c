@@ -0,0 +1,302 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Response cache shared by every process using the same cache directory.
+// Each entry is one file named after the hash of base URL + command (and
+// the UNIX socket the request went over, if any), holding a header, the
+// key and the body. Lookups map the file and hand
+// out the body in place; stores write a uniquely named temporary file and
+// rename it over the entry, so readers never see a partial write.
+
+#define CACHE_MAGIC "LQCACHE2"
+#define CACHE_MAX_PATH 1024
+
+typedef struct {
+    char magic[8];
+    double stored_at;          // Wall-clock seconds (CLOCK_REALTIME)
+    uint32_t key_len;
+    uint32_t reserved;
+    uint64_t body_len;
+} CacheEntryHeader;
+
+struct LoquatCache {
+    char dir[CACHE_MAX_PATH];
+    double max_age;            // Negative: use the per-command TTLs
+};
+
+// How long a response stays fresh when no max_age override is given
+static const struct {
+    const char *command;
+    double ttl;
+} cache_ttls[] = {
+    { "get_scan_result", 10.0 },   // Every request makes the device rescan
+    { NULL, 0.0 }
+};
+
+static double cache_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Default seconds a command stays fresh (0: not cached)
+static double cache_default_ttl(const char *command) {
+    for (int i = 0; cache_ttls[i].command; i++) {
+        if (strcmp(cache_ttls[i].command, command) == 0) {
+            return cache_ttls[i].ttl;
+        }
+    }
+    return 0.0;
+}
+
+// Oldest cached response a lookup for command accepts
+static double cache_ttl(const LoquatCache *cache, const char *command) {
+    return cache->max_age >= 0 ? cache->max_age : cache_default_ttl(command);
+}
+
+// Build the cache key and the path of its entry file. Over a UNIX socket
+// the host in base_url is only a Host header, so the socket path is part
+// of the key. The key is built in key_buf, or malloc'd when it does not
+// fit; free it with loquat_url_release(). NULL on failure
+static char* cache_entry_path(const LoquatCache *cache, const char *base_url, const char *unix_socket,
+                              const char *command, char *key_buf, size_t key_size, char *path, size_t path_size) {
+    const char *socket = unix_socket ? unix_socket : "";
+    int len = snprintf(key_buf, key_size, "%s/%s\n%s", base_url, command, socket);
+    if (len < 0) {
+        return NULL;
+    }
+    char *key = key_buf;
+    if ((size_t)len >= key_size) {
+        key = malloc((size_t)len + 1);
+        if (!key) {
+            return NULL;
+        }
+        snprintf(key, (size_t)len + 1, "%s/%s\n%s", base_url, command, socket);
+    }
+    len = snprintf(path, path_size, "%s/%016lx", cache->dir, loquat_hash_string(key));
+    if (len < 0 || (size_t)len >= path_size) {
+        loquat_url_release(key, key_buf);
+        return NULL;
+    }
+    return key;
+}
+
+// Create dir and any missing parents
+static int cache_mkdirs(const char *dir) {
+    char path[CACHE_MAX_PATH];
+    size_t len = strlen(dir);
+    if (len == 0 || len >= sizeof(path)) {
+        return 0;
+    }
+    memcpy(path, dir, len + 1);
+
+    for (char *p = path + 1; ; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+                return 0;
+            }
+            *p = c;
+            if (c == '\0') break;
+        }
+    }
+    return 1;
+}
+
+// Open a response cache
+LoquatCache* loquat_cache_open(const char *dir, double max_age) {
+    LoquatCache *cache = calloc(1, sizeof(LoquatCache));
+    if (!cache) {
+        fprintf(stderr, "Failed to allocate memory for cache\n");
+        return NULL;
+    }
+
+    int len;
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (dir) {
+        len = snprintf(cache->dir, sizeof(cache->dir), "%s", dir);
+    } else if (xdg && *xdg) {
+        len = snprintf(cache->dir, sizeof(cache->dir), "%s/loquatcli", xdg);
+    } else if (home && *home) {
+        len = snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/loquatcli", home);
+    } else {
+        len = snprintf(cache->dir, sizeof(cache->dir), "/tmp/loquatcli-%lu", (unsigned long)getuid());
+    }
+    if (len < 0 || (size_t)len >= sizeof(cache->dir)) {
+        fprintf(stderr, "Cache directory path too long\n");
+        free(cache);
+        return NULL;
+    }
+
+    cache->max_age = max_age;
+    return cache;
+}
+
+// Close a response cache
+void loquat_cache_close(LoquatCache *cache) {
+    free(cache);
+}
+
+// Map the fresh entry for base_url/command, if there is one
+int loquat_cache_lookup(LoquatCache *cache, const char *base_url, const char *unix_socket,
+                        const char *command, LoquatCacheHit *hit) {
+    memset(hit, 0, sizeof(*hit));
+
+    double ttl = cache_ttl(cache, command);
+    if (ttl <= 0) {
+        return 0;
+    }
+
+    char key_buf[MAX_URL_LENGTH];
+    char path[CACHE_MAX_PATH];
+    char *key = cache_entry_path(cache, base_url, unix_socket, command, key_buf, sizeof(key_buf),
+                                 path, sizeof(path));
+    if (!key) {
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        loquat_url_release(key, key_buf);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheEntryHeader)) {
+        close(fd);
+        loquat_url_release(key, key_buf);
+        return 0;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        loquat_url_release(key, key_buf);
+        return 0;
+    }
+
+    const CacheEntryHeader *header = map;
+    const char *entry_key = (const char *)(header + 1);
+    size_t key_len = strlen(key);
+    double age = cache_now() - header->stored_at;
+
+    // Reject foreign files, hash collisions and stale entries
+    if (memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->key_len != key_len ||
+        sizeof(CacheEntryHeader) + key_len + header->body_len != (size_t)st.st_size ||
+        memcmp(entry_key, key, key_len) != 0 ||
+        age > ttl || age < -1.0) {
+        munmap(map, (size_t)st.st_size);
+        loquat_url_release(key, key_buf);
+        return 0;
+    }
+    loquat_url_release(key, key_buf);
+
+    hit->map = map;
+    hit->map_size = (size_t)st.st_size;
+    hit->body = entry_key + key_len;
+    hit->body_len = (size_t)header->body_len;
+    hit->age = age < 0 ? 0 : age;
+    return 1;
+}
+
+// Unmap an entry returned by loquat_cache_lookup()
+void loquat_cache_release(LoquatCacheHit *hit) {
+    if (hit->map) {
+        munmap(hit->map, hit->map_size);
+        memset(hit, 0, sizeof(*hit));
+    }
+}
+
+static int cache_write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Store a fresh 200 response for base_url/command
+void loquat_cache_store(LoquatCache *cache, const char *base_url, const char *unix_socket,
+                        const char *command, const char *body, size_t body_len) {
+    // A max_age of 0 still refreshes entries for commands cached by default
+    if (cache->max_age <= 0 && cache_default_ttl(command) <= 0) {
+        return;
+    }
+
+    char key_buf[MAX_URL_LENGTH];
+    char path[CACHE_MAX_PATH];
+    char tmp[CACHE_MAX_PATH + 32];
+    char *key = cache_entry_path(cache, base_url, unix_socket, command, key_buf, sizeof(key_buf),
+                                 path, sizeof(path));
+    if (!key) {
+        return;
+    }
+    // A unique name, so threads of one process storing the same key never
+    // write into each other's temporary file
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    if (!cache_mkdirs(cache->dir)) {
+        fprintf(stderr, "Cannot create cache directory: %s\n", cache->dir);
+        loquat_url_release(key, key_buf);
+        return;
+    }
+
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot write cache entry: %s\n", tmp);
+        loquat_url_release(key, key_buf);
+        return;
+    }
+
+    CacheEntryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.stored_at = cache_now();
+    header.key_len = (uint32_t)strlen(key);
+    header.body_len = body_len;
+
+    int ok = cache_write_all(fd, &header, sizeof(header)) &&
+             cache_write_all(fd, key, header.key_len) &&
+             cache_write_all(fd, body, body_len);
+    if (close(fd) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "Cannot write cache entry: %s\n", path);
+        unlink(tmp);
+    }
+    loquat_url_release(key, key_buf);
+}
+
+// Attach a response cache to a client
+void loquat_client_set_cache(LoquatClient *client, LoquatCache *cache) {
+    if (client) {
+        client->cache = cache;
+    }
+}
+
+// Age of the last response if it came from the cache
+double loquat_client_cache_age(LoquatClient *client) {
+    return client ? client->cache_age : -1.0;
+}
@@ -0,0 +1,269 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+#include <cjson/cJSON.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Wi-Fi join that finishes as soon as the outcome is known. The connect
+// POST and status probes run side by side on one multi handle: some
+// devices answer the POST only after associating, others answer at once
+// (or drop the connection while the radio switches networks), so neither
+// the POST alone nor a fixed wait tracks the real join time.
+
+#define CONNECT_PROBE_INITIAL 0.25     // First probe this long after submitting
+#define CONNECT_PROBE_MAX 2.0          // Backoff limit between probes
+#define CONNECT_PROBE_TIMEOUT 2.0      // Give up on a single probe after this long
+
+// States a device reports when a join attempt has definitively failed
+static const char *connect_failure_states[] = {
+    "failed", "error", "auth_failed", "wrong_password", "no_ap_found", "ap_not_found", NULL
+};
+
+static double connect_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Progress of one join attempt
+typedef struct {
+    LoquatConnectResult *result;
+    char ssid[LOQUAT_SSID_MAX + 1];   // Network being joined ("" if unknown)
+    int post_done;                    // The connect POST has completed
+    int saw_other_state;              // A probe reported anything but connected
+} ConnectAttempt;
+
+static void copy_string(char *dst, size_t size, const char *src) {
+    snprintf(dst, size, "%s", src ? src : "");
+}
+
+// Decide from a status body ({"status": ..., "ip_address": ..., "ssid": ...})
+// whether the join has succeeded or failed; leaves state 0 if undecided
+static void connect_evaluate(ConnectAttempt *attempt, const char *body, size_t len) {
+    cJSON *json = cJSON_ParseWithLength(body, len);
+    if (!json) {
+        return;
+    }
+
+    const cJSON *status = cJSON_GetObjectItemCaseSensitive(json, "status");
+    const cJSON *ip = cJSON_GetObjectItemCaseSensitive(json, "ip_address");
+    const cJSON *ssid = cJSON_GetObjectItemCaseSensitive(json, "ssid");
+    if (!cJSON_IsString(status)) {
+        cJSON_Delete(json);
+        return;
+    }
+
+    LoquatConnectResult *result = attempt->result;
+    copy_string(result->status, sizeof(result->status), status->valuestring);
+
+    if (strcmp(status->valuestring, "connected") == 0) {
+        int has_ip = cJSON_IsString(ip) && ip->valuestring[0] != '\0';
+        int ip_known = has_ip || !ip;
+
+        // A device still on its previous network also says "connected";
+        // trust it once it names our SSID, or once the attempt is underway
+        int ours;
+        if (cJSON_IsString(ssid) && attempt->ssid[0]) {
+            ours = (strcmp(ssid->valuestring, attempt->ssid) == 0);
+        } else {
+            ours = attempt->post_done || attempt->saw_other_state;
+        }
+
+        if (ours && ip_known) {
+            result->state = LOQUAT_CONNECT_JOINED;
+            copy_string(result->ip_address, sizeof(result->ip_address), has_ip ? ip->valuestring : "");
+        }
+    } else {
+        attempt->saw_other_state = 1;
+        for (int i = 0; connect_failure_states[i]; i++) {
+            if (strcmp(status->valuestring, connect_failure_states[i]) == 0) {
+                result->state = LOQUAT_CONNECT_FAILED;
+                break;
+            }
+        }
+    }
+
+    cJSON_Delete(json);
+}
+
+// Common options for the POST and probe transfers
+static void connect_setup(LoquatClient *client, CURL *curl, const char *url, ResponseData *resp,
+                          double timeout) {
+    resp->size = 0;
+    resp->curl = curl;
+
+    curl_easy_reset(curl);
+    loquat_client_setup_transfer(client, curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)(timeout * 1000.0) + 1);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+}
+
+// Join a Wi-Fi network, returning as soon as the outcome is known
+int loquat_client_connect_wifi(LoquatClient *client, const char *post_data, double deadline,
+                               LoquatConnectResult *result) {
+    if (!client || !client->curl || !post_data || !result) {
+        return 0;
+    }
+    if (deadline <= 0) {
+        deadline = CONNECT_TIMEOUT;
+    }
+
+    memset(result, 0, sizeof(*result));
+    ConnectAttempt attempt;
+    memset(&attempt, 0, sizeof(attempt));
+    attempt.result = result;
+
+    cJSON *request = cJSON_Parse(post_data);
+    const cJSON *ssid = request ? cJSON_GetObjectItemCaseSensitive(request, "ssid") : NULL;
+    if (cJSON_IsString(ssid)) {
+        copy_string(attempt.ssid, sizeof(attempt.ssid), ssid->valuestring);
+    }
+    cJSON_Delete(request);
+
+    CURLM *multi = curl_multi_init();
+    CURL *probe = curl_easy_init();
+    if (!multi || !probe) {
+        fprintf(stderr, "Failed to initialize connect request\n");
+        if (multi) curl_multi_cleanup(multi);
+        if (probe) curl_easy_cleanup(probe);
+        return 0;
+    }
+
+    double start = connect_now();
+    double end = start + deadline;
+
+    // Submit the credentials
+    char url_buf[MAX_URL_LENGTH];
+    char *post_url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", "connect");
+    if (!post_url) {
+        curl_multi_cleanup(multi);
+        curl_easy_cleanup(probe);
+        return 0;
+    }
+    ResponseData post_resp = {0};
+    connect_setup(client, client->curl, post_url, &post_resp, deadline);
+    loquat_url_release(post_url, url_buf);
+    curl_easy_setopt(client->curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(client->curl, CURLOPT_POSTFIELDS, post_data);
+    curl_easy_setopt(client->curl, CURLOPT_POSTFIELDSIZE, (long)strlen(post_data));
+    curl_multi_add_handle(multi, client->curl);
+    int post_active = 1;
+
+    // Probe get_net_info (or get_status on devices without it) with backoff
+    const char *probe_command = "get_net_info";
+    ResponseData probe_resp = {0};
+    int probe_active = 0;
+    double next_probe = start + CONNECT_PROBE_INITIAL;
+    double backoff = CONNECT_PROBE_INITIAL;
+
+    while (result->state == 0) {
+        double now = connect_now();
+        if (now >= end) {
+            result->state = LOQUAT_CONNECT_TIMEOUT;
+            break;
+        }
+
+        if (!probe_active && now >= next_probe) {
+            double timeout = end - now < CONNECT_PROBE_TIMEOUT ? end - now : CONNECT_PROBE_TIMEOUT;
+            char *probe_url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", probe_command);
+            if (!probe_url) {
+                break;
+            }
+            connect_setup(client, probe, probe_url, &probe_resp, timeout);
+            loquat_url_release(probe_url, url_buf);
+            curl_multi_add_handle(multi, probe);
+            probe_active = 1;
+        }
+
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        if (mc != CURLM_OK) {
+            fprintf(stderr, "curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
+            break;
+        }
+
+        CURLMsg *msg;
+        int queued;
+        while (result->state == 0 && (msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL *easy = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            long code = 0;
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+            curl_multi_remove_handle(multi, easy);
+            now = connect_now();
+
+            if (easy == client->curl) {
+                post_active = 0;
+                attempt.post_done = 1;
+                result->http_code = (int)code;
+                if (res == CURLE_OK && code >= 400) {
+                    // The device rejected the request outright
+                    result->state = LOQUAT_CONNECT_FAILED;
+                    snprintf(result->status, sizeof(result->status), "HTTP %ld", code);
+                    break;
+                }
+                // Devices that answer after joining may say so in the body;
+                // otherwise (or if the radio switch dropped us) ask right away
+                if (res == CURLE_OK && post_resp.data) {
+                    connect_evaluate(&attempt, post_resp.data, post_resp.size);
+                }
+                if (!probe_active) {
+                    next_probe = now;
+                }
+            } else {
+                probe_active = 0;
+                result->probes++;
+                if (res == CURLE_OK && code == 404 && strcmp(probe_command, "get_net_info") == 0) {
+                    probe_command = "get_status";
+                    next_probe = now;
+                    continue;
+                }
+                if (res == CURLE_OK && code == 200 && probe_resp.data) {
+                    connect_evaluate(&attempt, probe_resp.data, probe_resp.size);
+                }
+                next_probe = now + backoff;
+                backoff = backoff * 2 < CONNECT_PROBE_MAX ? backoff * 2 : CONNECT_PROBE_MAX;
+            }
+        }
+        if (result->state != 0) {
+            break;
+        }
+
+        // Sleep until there is network activity, the next probe or the deadline
+        now = connect_now();
+        double wait = end - now;
+        if (!probe_active && next_probe - now < wait) {
+            wait = next_probe - now;
+        }
+        int wait_ms = wait > 0 ? (int)(wait * 1000.0) + 1 : 0;
+        mc = curl_multi_poll(multi, NULL, 0, wait_ms, NULL);
+        if (mc != CURLM_OK) {
+            fprintf(stderr, "curl_multi_poll() failed: %s\n", curl_multi_strerror(mc));
+            break;
+        }
+    }
+
+    result->elapsed = connect_now() - start;
+
+    // Abandon whatever is still in flight
+    if (post_active) curl_multi_remove_handle(multi, client->curl);
+    if (probe_active) curl_multi_remove_handle(multi, probe);
+    curl_easy_cleanup(probe);
+    curl_multi_cleanup(multi);
+    free(post_resp.data);
+    free(probe_resp.data);
+
+    return result->state != 0;
+}
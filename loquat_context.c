@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Library-wide state shared by every LoquatClient. Created by the first
+// loquat_global_init() and destroyed by the matching last cleanup.
+typedef struct {
+    int refs;
+    CURLSH *share;                                   // DNS, TLS sessions and connections
+    CURLSH *private_share;                           // DNS and TLS sessions only
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+    pthread_mutex_t private_locks[CURL_LOCK_DATA_LAST];
+} LoquatContext;
+
+static pthread_mutex_t context_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LoquatContext context;
+
+// libcurl calls these around every access to the shared caches; userptr
+// is the lock array of the share handle
+static void share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    pthread_mutex_lock(&((pthread_mutex_t *)userptr)[data]);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    pthread_mutex_unlock(&((pthread_mutex_t *)userptr)[data]);
+}
+
+// Share handle with its locks; connections too if share_connections
+static CURLSH* share_create(pthread_mutex_t *locks, int share_connections) {
+    CURLSH *share = curl_share_init();
+    if (!share) {
+        return NULL;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&locks[i], NULL);
+    }
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(share, CURLSHOPT_USERDATA, locks);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    if (share_connections) {
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    return share;
+}
+
+static void share_destroy(CURLSH *share, pthread_mutex_t *locks) {
+    curl_share_cleanup(share);
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&locks[i]);
+    }
+}
+
+// Initialize the library context (reference-counted, thread-safe)
+int loquat_global_init(void) {
+    pthread_mutex_lock(&context_mutex);
+
+    if (context.refs > 0) {
+        context.refs++;
+        pthread_mutex_unlock(&context_mutex);
+        return 1;
+    }
+
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+        fprintf(stderr, "Failed to initialize libcurl\n");
+        pthread_mutex_unlock(&context_mutex);
+        return 0;
+    }
+
+    // Share DNS results, TLS sessions and live connections across all
+    // clients. Clients that opt out of connection sharing (see
+    // loquat_client_set_connection_sharing) still share the first two
+    context.share = share_create(context.locks, 1);
+    context.private_share = context.share ? share_create(context.private_locks, 0) : NULL;
+    if (!context.private_share) {
+        fprintf(stderr, "Failed to initialize CURL share handle\n");
+        if (context.share) {
+            share_destroy(context.share, context.locks);
+            context.share = NULL;
+        }
+        curl_global_cleanup();
+        pthread_mutex_unlock(&context_mutex);
+        return 0;
+    }
+
+    context.refs = 1;
+    pthread_mutex_unlock(&context_mutex);
+    return 1;
+}
+
+// Release one reference to the library context
+void loquat_global_cleanup(void) {
+    pthread_mutex_lock(&context_mutex);
+
+    if (context.refs == 0 || --context.refs > 0) {
+        pthread_mutex_unlock(&context_mutex);
+        return;
+    }
+
+    share_destroy(context.share, context.locks);
+    share_destroy(context.private_share, context.private_locks);
+    context.share = NULL;
+    context.private_share = NULL;
+    curl_global_cleanup();
+
+    pthread_mutex_unlock(&context_mutex);
+}
+
+// Share handle to attach to every easy handle (NULL before loquat_global_init)
+CURLSH* loquat_share_handle(int share_connections) {
+    return share_connections ? context.share : context.private_share;
+}
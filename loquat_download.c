@@ -0,0 +1,673 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Large artifact downloads. A one-byte ranged GET tells us the size (from
+// Content-Range) and whether the device honours Range at all. If it does,
+// the resource is cut into segments fetched over several connections on
+// one multi handle, each written with pwrite() straight to its offset in a
+// preallocated "<output>.part" file. How far every segment has got is kept
+// in "<output>.part.state", so an interrupted download picks up where each
+// segment stopped, as long as the size and validator (ETag or
+// Last-Modified) still match. A segment the device turns away for now
+// (429, 503) is asked for again after the pause it requests. A device that
+// answers the probe with 200 has its reply written out as a single stream
+// instead.
+
+#define DOWNLOAD_MAGIC "LQDLOAD1"
+#define DOWNLOAD_MAX_PATH 1024
+#define DOWNLOAD_DEFAULT_CONNECTIONS 4
+#define DOWNLOAD_MAX_CONNECTIONS 16
+#define DOWNLOAD_SEGMENT_MIN (1024 * 1024)   // Smallest segment worth a request
+#define DOWNLOAD_SEGMENTS_PER_CONNECTION 4   // So fast connections can take more
+#define DOWNLOAD_MAX_SEGMENTS 4096
+#define DOWNLOAD_RECORD_INTERVAL (1024 * 1024) // Save a segment's progress this often
+#define DOWNLOAD_SEGMENT_RETRIES 3
+#define DOWNLOAD_RETRY_DELAY 1.0     // Wait before retrying a refused segment without Retry-After; doubles
+#define DOWNLOAD_VALIDATOR_MAX 256
+
+typedef struct {
+    char magic[8];
+    uint64_t size;
+    uint64_t segment_size;
+    uint32_t segment_count;
+    uint32_t validator_len;
+    // Followed by the validator and one uint64_t of progress per segment
+} DownloadStateHeader;
+
+typedef struct {
+    size_t start;
+    size_t length;
+    size_t done;                 // Bytes written from start
+    size_t recorded;             // Value of done last saved in the state file
+    int retries;
+} DownloadSegment;
+
+typedef struct Download Download;
+
+// One connection's transfer of one segment
+typedef struct {
+    CURL *curl;
+    Download *download;
+    int segment;
+    int checked;                 // The response code has been checked
+    int failed_write;            // Output could not be written
+    double resume_at;            // Waiting to retry its segment until then (0: in flight)
+} DownloadSlot;
+
+struct Download {
+    int fd;                      // <output>.part
+    int state_fd;                // <output>.part.state, -1 for a single stream
+    off_t progress_offset;       // Where per-segment progress starts in the state file
+    DownloadSegment *segments;
+    int segment_count;
+    size_t segment_size;
+    size_t size;
+    char validator[DOWNLOAD_VALIDATOR_MAX];
+    // Probe
+    int has_total;               // Content-Range carried the total size
+    size_t total;
+    char etag[DOWNLOAD_VALIDATOR_MAX];
+    char last_modified[DOWNLOAD_VALIDATOR_MAX];
+    int probe_checked;
+    int single;                  // Writing the probe's 200 reply as the download
+    size_t stream_offset;
+    int failed_write;
+};
+
+static double download_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int write_at(int fd, const char *data, size_t len, size_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, (off_t)offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+        offset += (size_t)n;
+    }
+    return 1;
+}
+
+// Copy a header's value, without surrounding whitespace, into dst
+static void header_value(const char *line, size_t len, size_t name_len, char *dst, size_t size) {
+    const char *p = line + name_len;
+    const char *end = line + len;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (end > p && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ' || end[-1] == '\t')) end--;
+    size_t n = (size_t)(end - p) < size - 1 ? (size_t)(end - p) : size - 1;
+    memcpy(dst, p, n);
+    dst[n] = '\0';
+}
+
+// Collect Content-Range, ETag and Last-Modified from the probe's reply
+static size_t download_probe_header(char *buffer, size_t size, size_t nitems, void *userp) {
+    Download *download = userp;
+    size_t len = size * nitems;
+    char value[DOWNLOAD_VALIDATOR_MAX];
+
+    if (len > 14 && strncasecmp(buffer, "Content-Range:", 14) == 0) {
+        // bytes 0-0/12345, or bytes */12345 with a 416
+        header_value(buffer, len, 14, value, sizeof(value));
+        const char *slash = strchr(value, '/');
+        if (slash && slash[1] >= '0' && slash[1] <= '9') {
+            char *end;
+            errno = 0;
+            unsigned long long total = strtoull(slash + 1, &end, 10);
+            if (errno == 0 && *end == '\0') {
+                download->total = (size_t)total;
+                download->has_total = 1;
+            }
+        }
+    } else if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+        header_value(buffer, len, 5, download->etag, sizeof(download->etag));
+    } else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+        header_value(buffer, len, 14, download->last_modified, sizeof(download->last_modified));
+    }
+    return len;
+}
+
+// Write the probe's body when the device sent the whole resource
+static size_t download_probe_write(char *data, size_t size, size_t nmemb, void *userp) {
+    DownloadSlot *slot = userp;
+    Download *download = slot->download;
+    size_t n = size * nmemb;
+
+    if (!download->probe_checked) {
+        long code = 0;
+        curl_easy_getinfo(slot->curl, CURLINFO_RESPONSE_CODE, &code);
+        download->probe_checked = 1;
+        if (code == 200) {
+            // Range ignored: this reply is the download
+            download->single = 1;
+            curl_off_t length = -1;
+            curl_easy_getinfo(slot->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+            if (ftruncate(download->fd, 0) != 0 ||
+                (length > 0 && posix_fallocate(download->fd, 0, (off_t)length) != 0 &&
+                 ftruncate(download->fd, (off_t)length) != 0)) {
+                download->failed_write = 1;
+                return 0;
+            }
+        }
+    }
+
+    if (download->single) {
+        if (!write_at(download->fd, data, n, download->stream_offset)) {
+            download->failed_write = 1;
+            return 0;
+        }
+        download->stream_offset += n;
+    }
+    return n;
+}
+
+// Save how far segment i has got
+static void download_record(Download *download, int i) {
+    DownloadSegment *segment = &download->segments[i];
+    if (download->state_fd < 0 || segment->recorded == segment->done) {
+        return;
+    }
+    uint64_t done = segment->done;
+    if (write_at(download->state_fd, (const char *)&done, sizeof(done),
+                 (size_t)download->progress_offset + (size_t)i * sizeof(done))) {
+        segment->recorded = segment->done;
+    }
+}
+
+// Write a segment's bytes at their place in the output
+static size_t download_segment_write(char *data, size_t size, size_t nmemb, void *userp) {
+    DownloadSlot *slot = userp;
+    Download *download = slot->download;
+    DownloadSegment *segment = &download->segments[slot->segment];
+    size_t n = size * nmemb;
+
+    if (!slot->checked) {
+        long code = 0;
+        curl_easy_getinfo(slot->curl, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 206) {
+            // Not our range: a full body (the resource changed, with If-Range)
+            // or an error page
+            return 0;
+        }
+        slot->checked = 1;
+    }
+
+    if (n > segment->length - segment->done ||
+        !write_at(download->fd, data, n, segment->start + segment->done)) {
+        slot->failed_write = 1;
+        return 0;
+    }
+    segment->done += n;
+    if (segment->done - segment->recorded >= DOWNLOAD_RECORD_INTERVAL) {
+        download_record(download, slot->segment);
+    }
+    return n;
+}
+
+// Options every transfer of a download shares
+static void download_setup(LoquatClient *client, CURL *curl, const char *url) {
+    curl_easy_reset(curl);
+    loquat_client_setup_transfer(client, curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+    // Only a stalled connection times out; a large dump may take a while
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)DEFAULT_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)DEFAULT_TIMEOUT);
+}
+
+// Reuse the progress in a state file left by an earlier attempt at the same resource
+static int download_load_state(Download *download, const char *state_path) {
+    int fd = open(state_path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    DownloadStateHeader header;
+    char validator[DOWNLOAD_VALIDATOR_MAX];
+    int ok = read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+             memcmp(header.magic, DOWNLOAD_MAGIC, sizeof(header.magic)) == 0 &&
+             header.size == download->size &&
+             header.segment_size == download->segment_size &&
+             header.segment_count == (uint32_t)download->segment_count &&
+             header.validator_len < sizeof(validator) &&
+             read(fd, validator, header.validator_len) == (ssize_t)header.validator_len;
+    if (ok) {
+        validator[header.validator_len] = '\0';
+        ok = strcmp(validator, download->validator) == 0;
+    }
+    for (int i = 0; ok && i < download->segment_count; i++) {
+        uint64_t done;
+        DownloadSegment *segment = &download->segments[i];
+        if (read(fd, &done, sizeof(done)) != (ssize_t)sizeof(done) || done > segment->length) {
+            ok = 0;
+            break;
+        }
+        segment->done = (size_t)done;
+        segment->recorded = (size_t)done;
+    }
+    close(fd);
+
+    if (!ok) {
+        for (int i = 0; i < download->segment_count; i++) {
+            download->segments[i].done = 0;
+            download->segments[i].recorded = 0;
+        }
+    }
+    return ok;
+}
+
+// Start a fresh state file describing the segments
+static int download_save_state(Download *download, const char *state_path) {
+    download->state_fd = open(state_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (download->state_fd < 0) {
+        fprintf(stderr, "Cannot write %s: %s\n", state_path, strerror(errno));
+        return 0;
+    }
+
+    DownloadStateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DOWNLOAD_MAGIC, sizeof(header.magic));
+    header.size = download->size;
+    header.segment_size = download->segment_size;
+    header.segment_count = (uint32_t)download->segment_count;
+    header.validator_len = (uint32_t)strlen(download->validator);
+    download->progress_offset = (off_t)(sizeof(header) + header.validator_len);
+
+    size_t progress_size = (size_t)download->segment_count * sizeof(uint64_t);
+    uint64_t *progress = malloc(progress_size ? progress_size : 1);
+    if (!progress) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 0;
+    }
+    for (int i = 0; i < download->segment_count; i++) {
+        progress[i] = download->segments[i].done;
+    }
+    int ok = write_at(download->state_fd, (const char *)&header, sizeof(header), 0) &&
+             write_at(download->state_fd, download->validator, header.validator_len, sizeof(header)) &&
+             write_at(download->state_fd, (const char *)progress, progress_size,
+                      (size_t)download->progress_offset);
+    free(progress);
+    if (!ok) {
+        fprintf(stderr, "Cannot write %s: %s\n", state_path, strerror(errno));
+    }
+    return ok;
+}
+
+// Point a slot at a segment and add its transfer to the multi handle
+static int download_start_segment(CURLM *multi, DownloadSlot *slot, int index, LoquatClient *client,
+                                  const char *url, struct curl_slist *headers) {
+    Download *download = slot->download;
+    DownloadSegment *segment = &download->segments[index];
+    char range[64];
+    snprintf(range, sizeof(range), "%zu-%zu", segment->start + segment->done,
+             segment->start + segment->length - 1);
+
+    slot->segment = index;
+    slot->checked = 0;
+    slot->failed_write = 0;
+    slot->resume_at = 0.0;
+    download_setup(client, slot->curl, url);
+    curl_easy_setopt(slot->curl, CURLOPT_RANGE, range);
+    if (headers) {
+        curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, headers);
+    }
+    curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, download_segment_write);
+    curl_easy_setopt(slot->curl, CURLOPT_WRITEDATA, slot);
+    curl_easy_setopt(slot->curl, CURLOPT_PRIVATE, slot);
+    return curl_multi_add_handle(multi, slot->curl) == CURLM_OK;
+}
+
+// Find the next segment with bytes left to fetch
+static int download_next_segment(Download *download, int *next) {
+    while (*next < download->segment_count) {
+        int index = (*next)++;
+        if (download->segments[index].done < download->segments[index].length) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// Fetch every unfinished segment over up to connections transfers at once
+static int download_segments(Download *download, LoquatClient *client, const char *url, int connections) {
+    CURLM *multi = curl_multi_init();
+    DownloadSlot *slots = calloc((size_t)connections, sizeof(DownloadSlot));
+    struct curl_slist *headers = NULL;
+    if (!multi || !slots) {
+        fprintf(stderr, "Failed to initialize download\n");
+        if (multi) curl_multi_cleanup(multi);
+        free(slots);
+        return 0;
+    }
+
+    // A resource that changes mid-download comes back whole and is refused
+    if (download->validator[0]) {
+        char header[DOWNLOAD_VALIDATOR_MAX + 16];
+        snprintf(header, sizeof(header), "If-Range: %s", download->validator);
+        headers = curl_slist_append(NULL, header);
+    }
+
+    int ok = 1;
+    int next = 0;
+    int active = 0;
+    int waiting = 0;
+    for (int i = 0; i < connections; i++) {
+        slots[i].download = download;
+        slots[i].curl = curl_easy_init();
+        if (!slots[i].curl) {
+            fprintf(stderr, "Failed to initialize CURL\n");
+            ok = 0;
+            goto cleanup;
+        }
+    }
+    for (int i = 0; i < connections; i++) {
+        int index = download_next_segment(download, &next);
+        if (index < 0) break;
+        if (!download_start_segment(multi, &slots[i], index, client, url, headers)) {
+            ok = 0;
+            goto cleanup;
+        }
+        active++;
+    }
+
+    while (active > 0 || waiting > 0) {
+        // Retry segments whose wait is over
+        double now = download_now();
+        for (int i = 0; waiting > 0 && i < connections; i++) {
+            DownloadSlot *slot = &slots[i];
+            if (slot->resume_at <= 0.0 || slot->resume_at > now) {
+                continue;
+            }
+            waiting--;
+            if (!download_start_segment(multi, slot, slot->segment, client, url, headers)) {
+                ok = 0;
+                break;
+            }
+            active++;
+        }
+        if (!ok) {
+            break;
+        }
+
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        if (mc != CURLM_OK) {
+            fprintf(stderr, "curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
+            ok = 0;
+            break;
+        }
+
+        CURLMsg *msg;
+        int queued;
+        while (ok && (msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURLcode res = msg->data.result;
+            DownloadSlot *slot = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&slot);
+            curl_multi_remove_handle(multi, msg->easy_handle);
+            active--;
+
+            long code = 0;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &code);
+
+            DownloadSegment *segment = &download->segments[slot->segment];
+            download_record(download, slot->segment);
+
+            int index = -1;
+            if (res == CURLE_OK && segment->done == segment->length) {
+                index = download_next_segment(download, &next);
+            } else if (slot->failed_write) {
+                fprintf(stderr, "Error: Cannot write download: %s\n", strerror(errno));
+                ok = 0;
+            } else if (code == 200 || (code != 206 && code != 0 &&
+                                       segment->retries >= DOWNLOAD_SEGMENT_RETRIES)) {
+                fprintf(stderr, "Error: Device answered a range request with HTTP %ld\n", code);
+                ok = 0;
+            } else if (code != 206 && code != 0) {
+                // Busy or failing for now (429, 503, ...): wait as asked, or
+                // back off, then ask for the same range again
+                double delay = loquat_retry_after(msg->easy_handle);
+                if (delay < 0.0) {
+                    delay = DOWNLOAD_RETRY_DELAY * (double)(1 << segment->retries);
+                }
+                segment->retries++;
+                slot->resume_at = download_now() + delay;
+                waiting++;
+            } else if (segment->retries < DOWNLOAD_SEGMENT_RETRIES) {
+                // Carry on from the last byte written
+                segment->retries++;
+                index = slot->segment;
+            } else {
+                fprintf(stderr, "curl_easy_perform() failed: %s\n",
+                        res != CURLE_OK ? curl_easy_strerror(res) : "Short segment");
+                ok = 0;
+            }
+
+            if (index >= 0) {
+                if (!download_start_segment(multi, slot, index, client, url, headers)) {
+                    ok = 0;
+                    break;
+                }
+                active++;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+
+        if (active > 0 || waiting > 0) {
+            // Wake for the first segment due to be retried
+            int wait_ms = 1000;
+            now = download_now();
+            for (int i = 0; waiting > 0 && i < connections; i++) {
+                if (slots[i].resume_at > 0.0) {
+                    double wait = slots[i].resume_at - now;
+                    int ms = wait > 0 ? (int)(wait * 1000.0) + 1 : 0;
+                    if (ms < wait_ms) wait_ms = ms;
+                }
+            }
+            mc = curl_multi_poll(multi, NULL, 0, wait_ms, NULL);
+            if (mc != CURLM_OK) {
+                fprintf(stderr, "curl_multi_poll() failed: %s\n", curl_multi_strerror(mc));
+                ok = 0;
+                break;
+            }
+        }
+    }
+
+cleanup:
+    for (int i = 0; i < connections; i++) {
+        if (slots[i].curl) {
+            curl_multi_remove_handle(multi, slots[i].curl);
+            curl_easy_cleanup(slots[i].curl);
+        }
+    }
+    // Whatever arrived before a failure is kept for the next attempt
+    for (int i = 0; i < download->segment_count; i++) {
+        download_record(download, i);
+    }
+    free(slots);
+    curl_slist_free_all(headers);
+    curl_multi_cleanup(multi);
+    return ok;
+}
+
+// Cut size bytes into segments
+static int download_plan(Download *download, size_t size, int connections) {
+    size_t segment_size = size / ((size_t)connections * DOWNLOAD_SEGMENTS_PER_CONNECTION);
+    if (segment_size < DOWNLOAD_SEGMENT_MIN) {
+        segment_size = DOWNLOAD_SEGMENT_MIN;
+    }
+    if (size / segment_size >= DOWNLOAD_MAX_SEGMENTS) {
+        segment_size = size / DOWNLOAD_MAX_SEGMENTS + 1;
+    }
+    int count = (int)((size + segment_size - 1) / segment_size);
+
+    download->segments = calloc(count > 0 ? (size_t)count : 1, sizeof(DownloadSegment));
+    if (!download->segments) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        download->segments[i].start = (size_t)i * segment_size;
+        download->segments[i].length = size - download->segments[i].start < segment_size ?
+                                       size - download->segments[i].start : segment_size;
+    }
+    download->size = size;
+    download->segment_size = segment_size;
+    download->segment_count = count;
+    return 1;
+}
+
+// Download resource from the client's device into output
+int loquat_client_download(LoquatClient *client, const char *resource, const char *output,
+                           int connections, LoquatDownloadResult *result) {
+    if (!client || !client->curl || !resource || !output || !result) {
+        return 0;
+    }
+    if (connections <= 0) {
+        connections = DOWNLOAD_DEFAULT_CONNECTIONS;
+    }
+    if (connections > DOWNLOAD_MAX_CONNECTIONS) {
+        connections = DOWNLOAD_MAX_CONNECTIONS;
+    }
+
+    memset(result, 0, sizeof(*result));
+    double start = download_now();
+
+    char part_path[DOWNLOAD_MAX_PATH];
+    char state_path[DOWNLOAD_MAX_PATH];
+    int len = snprintf(state_path, sizeof(state_path), "%s.part.state", output);
+    if (len < 0 || (size_t)len >= sizeof(state_path)) {
+        fprintf(stderr, "Output path too long\n");
+        return 0;
+    }
+    snprintf(part_path, sizeof(part_path), "%s.part", output);
+
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", resource);
+    if (!url) {
+        return 0;
+    }
+
+    Download download;
+    memset(&download, 0, sizeof(download));
+    download.state_fd = -1;
+    download.fd = open(part_path, O_RDWR | O_CREAT, 0644);
+    if (download.fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", part_path, strerror(errno));
+        loquat_url_release(url, url_buf);
+        return 0;
+    }
+
+    // Probe with the first byte: size, validator and Range support
+    DownloadSlot probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.curl = client->curl;
+    probe.download = &download;
+    download_setup(client, client->curl, url);
+    curl_easy_setopt(client->curl, CURLOPT_RANGE, "0-0");
+    curl_easy_setopt(client->curl, CURLOPT_HEADERFUNCTION, download_probe_header);
+    curl_easy_setopt(client->curl, CURLOPT_HEADERDATA, &download);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, download_probe_write);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &probe);
+    CURLcode res = curl_easy_perform(client->curl);
+
+    long code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &code);
+    result->http_code = (int)code;
+
+    int ok = 0;
+    if (download.failed_write) {
+        fprintf(stderr, "Error: Cannot write %s: %s\n", part_path, strerror(errno));
+    } else if (res != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+    } else if (download.single || code == 200) {
+        // The device ignored Range and sent everything
+        result->size = download.stream_offset;
+        ok = ftruncate(download.fd, (off_t)download.stream_offset) == 0;
+    } else if ((code == 206 || code == 416) && download.has_total) {
+        // An empty resource cannot satisfy a range and comes back as 416
+        result->http_code = 206;
+        result->ranged = 1;
+        snprintf(download.validator, sizeof(download.validator), "%s",
+                 download.etag[0] && strncmp(download.etag, "W/", 2) != 0 ? download.etag :
+                 download.last_modified);
+
+        // Progress only counts if the partial file it describes is still there
+        struct stat st;
+        ok = download_plan(&download, download.total, connections);
+        if (ok && fstat(download.fd, &st) == 0 && (size_t)st.st_size == download.size &&
+            download_load_state(&download, state_path)) {
+            for (int i = 0; i < download.segment_count; i++) {
+                result->resumed += download.segments[i].done;
+            }
+        } else if (ok) {
+            // Nothing to resume: reserve the whole file up front
+            ok = ftruncate(download.fd, 0) == 0 &&
+                 (posix_fallocate(download.fd, 0, (off_t)download.size) == 0 ||
+                  ftruncate(download.fd, (off_t)download.size) == 0);
+            if (!ok) {
+                fprintf(stderr, "Error: Cannot allocate %s: %s\n", part_path, strerror(errno));
+            }
+        }
+        ok = ok && download_save_state(&download, state_path) &&
+             download_segments(&download, client, url, connections);
+        result->size = download.size;
+        result->segments = download.segment_count;
+    } else if (code == 206) {
+        fprintf(stderr, "Error: Device did not report the size of %s\n", resource);
+    } else {
+        // Not found, refused, ...: the caller reports the HTTP code
+        close(download.fd);
+        unlink(part_path);
+        download.fd = -1;
+        ok = 1;
+    }
+
+    if (download.state_fd >= 0) {
+        close(download.state_fd);
+    }
+    if (download.fd >= 0) {
+        if (close(download.fd) != 0) {
+            ok = 0;
+        }
+        if (ok) {
+            if (rename(part_path, output) != 0) {
+                fprintf(stderr, "Cannot rename %s to %s: %s\n", part_path, output, strerror(errno));
+                ok = 0;
+            } else {
+                unlink(state_path);
+            }
+        } else if (!result->ranged) {
+            // A single stream cannot be resumed, so nothing is worth keeping
+            unlink(part_path);
+        }
+    }
+    free(download.segments);
+    loquat_url_release(url, url_buf);
+    result->elapsed = download_now() - start;
+    return ok;
+}
@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Schema-specific extraction for get_scan_result and get_net_info bodies.
+// The body is walked in place: the wanted fields come back as views into
+// the buffer and bars as an int, nothing is allocated, and every other
+// value is validated and skipped. String bodies, which make up most of a
+// scan result, are skipped 16 bytes at a time with SSE2 where available.
+// Field lookup follows cJSON_GetObjectItem() (first match, ignoring case),
+// so callers can fall back to cJSON on malformed input and print the same.
+
+#define EXTRACT_MAX_DEPTH 512
+#define EXTRACT_KEY_MAX 16
+
+typedef struct {
+    const char *p;
+    const char *end;
+} Cursor;
+
+// Find the first '"', '\\' or control character at or after p
+static const char* find_string_special(const char *p, const char *end) {
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                 _mm_cmpeq_epi8(chunk, backslash)),
+                                    _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return p + __builtin_ctz((unsigned)mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) {
+        p++;
+    }
+    return p;
+}
+
+static void skip_ws(Cursor *c) {
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r')) {
+        c->p++;
+    }
+}
+
+static int is_hex(char ch) {
+    return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F');
+}
+
+// Read the four hex digits of a \u escape at p; 0 if they are not all hex
+static int read_hex4(const char *p, unsigned long *value) {
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char ch = p[i];
+        if (!is_hex(ch)) return 0;
+        *value = (*value << 4) | (unsigned long)(ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10);
+    }
+    return 1;
+}
+
+// Read a string starting at the opening quote into a view of its contents
+static int read_string(Cursor *c, LoquatStringView *view) {
+    const char *start = ++c->p;
+    int escaped = 0;
+    for (;;) {
+        const char *p = find_string_special(c->p, c->end);
+        if (p >= c->end || (unsigned char)*p < 0x20) {
+            return 0;
+        }
+        if (*p == '"') {
+            view->ptr = start;
+            view->len = (size_t)(p - start);
+            view->escaped = escaped;
+            c->p = p + 1;
+            return 1;
+        }
+
+        // Backslash: check the escape and carry on after it
+        escaped = 1;
+        if (p + 1 >= c->end) {
+            return 0;
+        }
+        char e = p[1];
+        if (e == 'u') {
+            unsigned long cp, low;
+            if (c->end - p < 6 || !read_hex4(p + 2, &cp)) {
+                return 0;
+            }
+            c->p = p + 6;
+            // Surrogates must come in pairs, as cJSON requires
+            if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                return 0;
+            }
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                if (c->end - c->p < 6 || c->p[0] != '\\' || c->p[1] != 'u' || !read_hex4(c->p + 2, &low) ||
+                    low < 0xDC00 || low > 0xDFFF) {
+                    return 0;
+                }
+                c->p += 6;
+            }
+        } else if (strchr("\"\\/bfnrt", e) && e != '\0') {
+            c->p = p + 2;
+        } else {
+            return 0;
+        }
+    }
+}
+
+// Read a number; sets *value to its integer part (saturated like cJSON)
+static int read_number(Cursor *c, int *value) {
+    const char *p = c->p;
+    const char *start = p;
+    if (p < c->end && *p == '-') p++;
+    if (p >= c->end || !isdigit((unsigned char)*p)) return 0;
+    if (*p == '0') {
+        p++;
+    } else {
+        while (p < c->end && isdigit((unsigned char)*p)) p++;
+    }
+    int simple = 1;
+    if (p < c->end && *p == '.') {
+        simple = 0;
+        p++;
+        if (p >= c->end || !isdigit((unsigned char)*p)) return 0;
+        while (p < c->end && isdigit((unsigned char)*p)) p++;
+    }
+    if (p < c->end && (*p == 'e' || *p == 'E')) {
+        simple = 0;
+        p++;
+        if (p < c->end && (*p == '+' || *p == '-')) p++;
+        if (p >= c->end || !isdigit((unsigned char)*p)) return 0;
+        while (p < c->end && isdigit((unsigned char)*p)) p++;
+    }
+
+    if (value) {
+        size_t len = (size_t)(p - start);
+        if (simple && len < 10) {
+            // Plain small integers, the usual case for bars
+            int v = 0;
+            for (const char *q = start + (*start == '-'); q < p; q++) {
+                v = v * 10 + (*q - '0');
+            }
+            *value = *start == '-' ? -v : v;
+        } else {
+            char number[64];
+            if (len >= sizeof(number)) len = sizeof(number) - 1;
+            memcpy(number, start, len);
+            number[len] = '\0';
+            double d = strtod(number, NULL);
+            *value = d >= 2147483647.0 ? 2147483647 : d <= -2147483648.0 ? (-2147483647 - 1) : (int)d;
+        }
+    }
+    c->p = p;
+    return 1;
+}
+
+static int skip_value(Cursor *c, int depth);
+
+// Skip an object or array starting at its opening bracket
+static int skip_container(Cursor *c, int depth) {
+    if (depth > EXTRACT_MAX_DEPTH) {
+        return 0;
+    }
+    char close = *c->p == '{' ? '}' : ']';
+    int object = (close == '}');
+    c->p++;
+    skip_ws(c);
+    if (c->p < c->end && *c->p == close) {
+        c->p++;
+        return 1;
+    }
+    for (;;) {
+        if (object) {
+            LoquatStringView key;
+            if (c->p >= c->end || *c->p != '"' || !read_string(c, &key)) return 0;
+            skip_ws(c);
+            if (c->p >= c->end || *c->p != ':') return 0;
+            c->p++;
+            skip_ws(c);
+        }
+        if (!skip_value(c, depth + 1)) return 0;
+        skip_ws(c);
+        if (c->p >= c->end) return 0;
+        if (*c->p == ',') {
+            c->p++;
+            skip_ws(c);
+        } else if (*c->p == close) {
+            c->p++;
+            return 1;
+        } else {
+            return 0;
+        }
+    }
+}
+
+static int skip_literal(Cursor *c, const char *literal) {
+    size_t len = strlen(literal);
+    if ((size_t)(c->end - c->p) < len || memcmp(c->p, literal, len) != 0) {
+        return 0;
+    }
+    c->p += len;
+    return 1;
+}
+
+// Skip any JSON value, checking that it is well-formed
+static int skip_value(Cursor *c, int depth) {
+    if (c->p >= c->end) {
+        return 0;
+    }
+    LoquatStringView ignored;
+    switch (*c->p) {
+        case '"': return read_string(c, &ignored);
+        case '{':
+        case '[': return skip_container(c, depth);
+        case 't': return skip_literal(c, "true");
+        case 'f': return skip_literal(c, "false");
+        case 'n': return skip_literal(c, "null");
+        default:  return read_number(c, NULL);
+    }
+}
+
+// Compare an object key with a lowercase field name the way cJSON_GetObjectItem does
+static int key_matches(const LoquatStringView *key, const char *name) {
+    if (!key->escaped) {
+        size_t len = strlen(name);
+        if (key->len != len) return 0;
+        for (size_t i = 0; i < len; i++) {
+            if (tolower((unsigned char)key->ptr[i]) != name[i]) return 0;
+        }
+        return 1;
+    }
+    char decoded[EXTRACT_KEY_MAX];
+    size_t n = loquat_string_view_copy(key, decoded, sizeof(decoded));
+    if (n + 1 >= sizeof(decoded) || strlen(decoded) != n) {
+        return 0;   // Too long (or holds a NUL) to be one of our fields
+    }
+    for (size_t i = 0; i <= n; i++) {
+        if (tolower((unsigned char)decoded[i]) != name[i]) return 0;
+    }
+    return 1;
+}
+
+// Fields of one object that we look for; the first matching key wins
+typedef struct {
+    const char *name;
+    LoquatStringView *string;   // Set for string fields
+    int *number;                // Set for number fields
+    int *found;                 // Set when the first matching key had the right type
+    int seen;
+} ExtractField;
+
+// Walk an object starting at '{', filling the wanted fields
+static int read_object(Cursor *c, ExtractField *fields, int field_count, int depth) {
+    c->p++;
+    skip_ws(c);
+    if (c->p < c->end && *c->p == '}') {
+        c->p++;
+        return 1;
+    }
+    for (;;) {
+        LoquatStringView key;
+        if (c->p >= c->end || *c->p != '"' || !read_string(c, &key)) return 0;
+        skip_ws(c);
+        if (c->p >= c->end || *c->p != ':') return 0;
+        c->p++;
+        skip_ws(c);
+        if (c->p >= c->end) return 0;
+
+        ExtractField *field = NULL;
+        for (int i = 0; i < field_count; i++) {
+            if (!fields[i].seen && key_matches(&key, fields[i].name)) {
+                field = &fields[i];
+                field->seen = 1;
+                break;
+            }
+        }
+
+        if (field && field->string && *c->p == '"') {
+            if (!read_string(c, field->string)) return 0;
+            *field->found = 1;
+        } else if (field && field->number && (*c->p == '-' || isdigit((unsigned char)*c->p))) {
+            if (!read_number(c, field->number)) return 0;
+            *field->found = 1;
+        } else if (!skip_value(c, depth + 1)) {
+            return 0;
+        }
+
+        skip_ws(c);
+        if (c->p >= c->end) return 0;
+        if (*c->p == ',') {
+            c->p++;
+            skip_ws(c);
+        } else if (*c->p == '}') {
+            c->p++;
+            return 1;
+        } else {
+            return 0;
+        }
+    }
+}
+
+// Only whitespace (or a terminating NUL) may follow the top-level value
+static int at_document_end(Cursor *c) {
+    skip_ws(c);
+    return c->p == c->end || *c->p == '\0';
+}
+
+// Extract every access point of a get_scan_result body
+long loquat_extract_scan(const char *body, size_t len, loquat_scan_view_cb callback, void *userdata) {
+    if (!body) {
+        return -1;
+    }
+    Cursor c = { body, body + len };
+    skip_ws(&c);
+    if (c.p >= c.end || *c.p != '[') {
+        return -1;
+    }
+    c.p++;
+    skip_ws(&c);
+
+    long count = 0;
+    if (c.p < c.end && *c.p == ']') {
+        c.p++;
+        return at_document_end(&c) ? 0 : -1;
+    }
+    for (;;) {
+        if (c.p >= c.end) return -1;
+        if (*c.p == '{') {
+            LoquatScanView ap;
+            memset(&ap, 0, sizeof(ap));
+            ExtractField fields[] = {
+                { "ssid", &ap.ssid, NULL, &ap.has_ssid, 0 },
+                { "bars", NULL, &ap.bars, &ap.has_bars, 0 },
+                { "security", &ap.security, NULL, &ap.has_security, 0 },
+                { "bssid", &ap.bssid, NULL, &ap.has_bssid, 0 },
+            };
+            if (!read_object(&c, fields, 4, 1)) return -1;
+            if (callback) callback(&ap, userdata);
+            count++;
+        } else if (!skip_value(&c, 1)) {
+            // Non-object elements are skipped, as in print_scan_result
+            return -1;
+        }
+
+        skip_ws(&c);
+        if (c.p >= c.end) return -1;
+        if (*c.p == ',') {
+            c.p++;
+            skip_ws(&c);
+        } else if (*c.p == ']') {
+            c.p++;
+            return at_document_end(&c) ? count : -1;
+        } else {
+            return -1;
+        }
+    }
+}
+
+// Extract status, ip_address and ssid from a get_net_info body
+int loquat_extract_net_info(const char *body, size_t len, LoquatNetInfoView *info) {
+    if (!body || !info) {
+        return 0;
+    }
+    memset(info, 0, sizeof(*info));
+    Cursor c = { body, body + len };
+    skip_ws(&c);
+    if (c.p >= c.end || *c.p != '{') {
+        return 0;
+    }
+
+    int has_status = 0, has_ip = 0, has_ssid = 0;
+    ExtractField fields[] = {
+        { "status", &info->status, NULL, &has_status, 0 },
+        { "ip_address", &info->ip_address, NULL, &has_ip, 0 },
+        { "ssid", &info->ssid, NULL, &has_ssid, 0 },
+    };
+    if (!read_object(&c, fields, 3, 0) || !at_document_end(&c)) {
+        memset(info, 0, sizeof(*info));
+        return 0;
+    }
+    return 1;
+}
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return ch - 'A' + 10;
+}
+
+// Append a code point as UTF-8 if it fits
+static size_t put_codepoint(char *dst, size_t at, size_t size, unsigned long cp) {
+    char utf8[4];
+    size_t n;
+    if (cp < 0x80) {
+        utf8[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        utf8[0] = (char)(0xC0 | (cp >> 6));
+        utf8[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        utf8[0] = (char)(0xE0 | (cp >> 12));
+        utf8[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        utf8[0] = (char)(0xF0 | (cp >> 18));
+        utf8[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        utf8[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf8[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    if (at + n >= size) {
+        return 0;
+    }
+    memcpy(dst + at, utf8, n);
+    return n;
+}
+
+// Copy a string view into dst, decoding escapes
+size_t loquat_string_view_copy(const LoquatStringView *view, char *dst, size_t size) {
+    if (!dst || size == 0) {
+        return 0;
+    }
+    size_t out = 0;
+    if (!view || !view->ptr) {
+        dst[0] = '\0';
+        return 0;
+    }
+    if (!view->escaped) {
+        out = view->len < size - 1 ? view->len : size - 1;
+        memcpy(dst, view->ptr, out);
+        dst[out] = '\0';
+        return out;
+    }
+
+    const char *p = view->ptr;
+    const char *end = view->ptr + view->len;
+    while (p < end) {
+        size_t n = 1;
+        char ch = *p;
+        if (ch != '\\') {
+            if (out + 1 >= size) break;
+            dst[out++] = ch;
+            p++;
+            continue;
+        }
+        ch = p[1];
+        p += 2;
+        switch (ch) {
+            case 'b': ch = '\b'; break;
+            case 'f': ch = '\f'; break;
+            case 'n': ch = '\n'; break;
+            case 'r': ch = '\r'; break;
+            case 't': ch = '\t'; break;
+            case 'u': {
+                unsigned long cp = (unsigned long)((hex_value(p[0]) << 12) | (hex_value(p[1]) << 8) |
+                                                   (hex_value(p[2]) << 4) | hex_value(p[3]));
+                p += 4;
+                // Join a surrogate pair
+                if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+                    is_hex(p[2]) && is_hex(p[3]) && is_hex(p[4]) && is_hex(p[5])) {
+                    unsigned long low = (unsigned long)((hex_value(p[2]) << 12) | (hex_value(p[3]) << 8) |
+                                                        (hex_value(p[4]) << 4) | hex_value(p[5]));
+                    if (low >= 0xDC00 && low <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        p += 6;
+                    }
+                }
+                n = put_codepoint(dst, out, size, cp);
+                if (n == 0) {
+                    dst[out] = '\0';
+                    return out;
+                }
+                out += n;
+                continue;
+            }
+            default: break;   // '"', '\\' and '/' stand for themselves
+        }
+        if (out + 1 >= size) break;
+        dst[out++] = ch;
+    }
+    dst[out] = '\0';
+    return out;
+}
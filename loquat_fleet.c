@@ -0,0 +1,498 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+#define DEFAULT_FLEET_CONCURRENCY 32
+#define FLEET_MAX_RETRIES 3
+#define FLEET_RETRY_DELAY 1.0        // Wait before retrying a refused request without Retry-After; doubles
+
+// One in-flight transfer. Slots (and their easy handles and response
+// buffers) are reused for the next target as soon as a device completes.
+// An upload keeps its slot across the probes and POSTs it takes to resume.
+typedef struct {
+    CURL *curl;
+    ResponseData resp;
+    int index;
+    LoquatUpload upload;         // Uploads only
+    double started;              // When the device's first transfer started
+    double resume_at;            // Waiting to resume until then (0: in flight)
+    unsigned long seq;           // Number the concurrency limit gave the request
+} FleetSlot;
+
+// A distinct base URL in the targets list and the targets queued for it
+typedef struct {
+    int first;                   // First target naming the device
+    int head;                    // Queued targets, linked through queue_next (-1: none)
+    int tail;
+    LoquatTokenBucket bucket;
+} FleetDevice;
+
+// Which target goes next: each device's queue, paced by its bucket, in
+// the order the devices first appear, under the run's concurrency limit
+typedef struct {
+    FleetDevice *devices;
+    int device_count;
+    int first_queued;            // No device before this one has queued targets
+    int *device_of;              // Device of each target
+    int *queue_next;
+    int *retries;                // Times each target was sent again
+    int pending;                 // Targets queued
+    int adaptive;
+    int max_retries;
+    LoquatAimd aimd;
+} FleetSchedule;
+
+static double fleet_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Report a device that could not be started or failed in transit
+static void fleet_report_error(const char **targets, int index, const char *error,
+                               loquat_fleet_result_cb callback, void *userdata) {
+    LoquatFleetResult result = {0};
+    result.target = targets[index];
+    result.index = index;
+    result.error = error;
+    result.response = "";
+    callback(&result, userdata);
+}
+
+// Queue a target on its device, at the front when it is being retried
+static void fleet_schedule_push(FleetSchedule *schedule, int index, int front) {
+    int d = schedule->device_of[index];
+    FleetDevice *device = &schedule->devices[d];
+    if (device->head < 0) {
+        schedule->queue_next[index] = -1;
+        device->head = device->tail = index;
+    } else if (front) {
+        schedule->queue_next[index] = device->head;
+        device->head = index;
+    } else {
+        schedule->queue_next[index] = -1;
+        schedule->queue_next[device->tail] = index;
+        device->tail = index;
+    }
+    if (d < schedule->first_queued) {
+        schedule->first_queued = d;
+    }
+    schedule->pending++;
+}
+
+// Configure a slot's easy handle for its device's next transfer and add it
+// to the multi handle
+static int fleet_transfer(CURLM *multi, FleetSlot *slot, const char *target, const char *command,
+                          const char *post_data, LoquatImage *image) {
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), target, "/", command);
+    if (!url) {
+        return 0;
+    }
+
+    slot->resp.curl = slot->curl;
+    slot->resp.size = 0;
+    if (slot->resp.data) {
+        slot->resp.data[0] = '\0';
+    }
+
+    // Reset curl handle for new request
+    curl_easy_reset(slot->curl);
+    curl_easy_setopt(slot->curl, CURLOPT_SHARE, loquat_share_handle(1));
+    curl_easy_setopt(slot->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
+    curl_easy_setopt(slot->curl, CURLOPT_PRIVATE, slot);
+
+    if (image) {
+        // Sets its own timeouts
+        if (!loquat_upload_setup(&slot->upload, slot->curl)) {
+            return 0;
+        }
+    } else {
+        if (post_data) {
+            curl_easy_setopt(slot->curl, CURLOPT_POST, 1L);
+            curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDS, post_data);
+            curl_easy_setopt(slot->curl, CURLOPT_POSTFIELDSIZE, (long)strlen(post_data));
+        }
+
+        // Same timeouts as the single-device request paths
+        long timeout = (strcmp(command, "connect") == 0) ? CONNECT_TIMEOUT : DEFAULT_TIMEOUT;
+        curl_easy_setopt(slot->curl, CURLOPT_TIMEOUT, timeout);
+    }
+
+    curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+    curl_easy_setopt(slot->curl, CURLOPT_WRITEDATA, &slot->resp);
+
+    curl_easy_setopt(slot->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(slot->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+    curl_easy_setopt(slot->curl, CURLOPT_VERBOSE, 0L);
+
+    return curl_multi_add_handle(multi, slot->curl) == CURLM_OK;
+}
+
+// Start the first transfer for one target on a slot
+static int fleet_start(CURLM *multi, FleetSlot *slot, int index, const char *target,
+                       const char *command, const char *post_data, LoquatImage *image) {
+    slot->index = index;
+    slot->started = fleet_now();
+    slot->resume_at = 0.0;
+    if (image) {
+        loquat_upload_begin(&slot->upload, image);
+    }
+    return fleet_transfer(multi, slot, target, command, post_data, image);
+}
+
+// Index the distinct devices in targets and queue every target on its device
+static int fleet_schedule_init(FleetSchedule *schedule, const char **targets, int target_count,
+                               const LoquatFleetOptions *options) {
+    memset(schedule, 0, sizeof(*schedule));
+    size_t buckets = 1;
+    while (buckets < (size_t)target_count * 2) buckets *= 2;
+
+    schedule->devices = calloc((size_t)target_count, sizeof(FleetDevice));
+    schedule->queue_next = malloc((size_t)target_count * sizeof(int));
+    schedule->retries = calloc((size_t)target_count, sizeof(int));
+    schedule->device_of = malloc((size_t)target_count * sizeof(int));
+    int *table = malloc(buckets * sizeof(int));
+    if (!schedule->devices || !schedule->queue_next || !schedule->retries || !schedule->device_of || !table) {
+        free(table);
+        return 0;
+    }
+
+    double now = fleet_now();
+    memset(table, -1, buckets * sizeof(int));
+    for (int i = 0; i < target_count; i++) {
+        unsigned long hash = loquat_hash_string(targets[i]);
+        size_t b = hash & (buckets - 1);
+        while (table[b] >= 0 && strcmp(targets[schedule->devices[table[b]].first], targets[i]) != 0) {
+            b = (b + 1) & (buckets - 1);
+        }
+        if (table[b] < 0) {
+            FleetDevice *device = &schedule->devices[schedule->device_count];
+            device->first = i;
+            device->head = -1;
+            device->tail = -1;
+            loquat_bucket_init(&device->bucket, options->device_rate, options->device_burst, now);
+            table[b] = schedule->device_count++;
+        }
+        schedule->device_of[i] = table[b];
+        fleet_schedule_push(schedule, i, 0);
+    }
+    free(table);
+
+    schedule->adaptive = options->adaptive;
+    schedule->max_retries = options->max_retries;
+    loquat_aimd_init(&schedule->aimd, options->max_concurrency);
+    return 1;
+}
+
+static void fleet_schedule_free(FleetSchedule *schedule) {
+    free(schedule->devices);
+    free(schedule->queue_next);
+    free(schedule->retries);
+    free(schedule->device_of);
+}
+
+// Requests the run may have in flight now
+static int fleet_limit(const FleetSchedule *schedule) {
+    return schedule->adaptive ? loquat_aimd_limit(&schedule->aimd) : schedule->aimd.max;
+}
+
+// Take the first queued target whose device may be sent a request now. If
+// there is none, *wait is lowered to the seconds until one may be
+static int fleet_schedule_pop(FleetSchedule *schedule, double now, double *wait) {
+    for (int d = schedule->first_queued; schedule->pending > 0 && d < schedule->device_count; d++) {
+        FleetDevice *device = &schedule->devices[d];
+        if (device->head < 0) {
+            if (d == schedule->first_queued) schedule->first_queued++;
+            continue;
+        }
+        double w = loquat_bucket_wait(&device->bucket, now);
+        if (w > 0.0) {
+            if (*wait < 0.0 || w < *wait) *wait = w;
+            continue;
+        }
+
+        int index = device->head;
+        device->head = schedule->queue_next[index];
+        if (device->head < 0) device->tail = -1;
+        schedule->pending--;
+        loquat_bucket_take(&device->bucket);
+        return index;
+    }
+    return -1;
+}
+
+// Report a finished target and free its slot, or queue it again if the
+// device refused it and retries are left
+static void fleet_finish(FleetSchedule *schedule, FleetSlot *slot, CURL *easy, CURLcode res,
+                         const char **targets, LoquatImage *image,
+                         loquat_fleet_result_cb callback, void *userdata) {
+    long code = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+
+    LoquatTiming timing;
+    loquat_timing_read(easy, &timing);
+
+    // Uploads are long and their latency says little about load
+    double latency = (!image && res == CURLE_OK) ? timing.start_transfer - timing.pre_transfer : 0.0;
+    loquat_aimd_sample(&schedule->aimd, slot->seq, loquat_overloaded(res, (int)code), latency);
+
+    int index = slot->index;
+    if (!image && res == CURLE_OK && (code == 429 || code == 503) &&
+        schedule->retries[index] < schedule->max_retries) {
+        // The device asked for a pause; its other targets wait too
+        double delay = loquat_retry_after(easy);
+        if (delay < 0.0) {
+            delay = FLEET_RETRY_DELAY * (double)(1 << schedule->retries[index]);
+        }
+        FleetDevice *device = &schedule->devices[schedule->device_of[index]];
+        loquat_bucket_pause(&device->bucket, fleet_now() + delay);
+        schedule->retries[index]++;
+        fleet_schedule_push(schedule, index, 1);
+        return;
+    }
+
+    LoquatFleetResult result = {0};
+    result.target = targets[index];
+    result.index = index;
+    result.ok = (res == CURLE_OK);
+    result.error = result.ok ? NULL : curl_easy_strerror(res);
+    result.response = slot->resp.data ? slot->resp.data : "";
+    result.response_size = slot->resp.size;
+    result.http_code = (int)code;
+    result.timing = timing;
+    result.total_time = timing.total;
+    result.retries = schedule->retries[index];
+    result.concurrency = fleet_limit(schedule);
+    if (image) {
+        result.total_time = fleet_now() - slot->started;
+        result.resumes = slot->upload.resumes;
+    }
+
+    callback(&result, userdata);
+    if (image) {
+        loquat_upload_end(&slot->upload);
+    }
+}
+
+// Run a command, or an upload when image is set, on every target
+static int fleet_run(const char **targets, int target_count, const char *command,
+                     const char *post_data, LoquatImage *image, const LoquatFleetOptions *options,
+                     loquat_fleet_result_cb callback, void *userdata) {
+    if (!targets || target_count < 0 || !command || !callback) {
+        return 0;
+    }
+    if (target_count == 0) {
+        return 1;
+    }
+
+    LoquatFleetOptions defaults;
+    if (!options) {
+        loquat_fleet_options_init(&defaults, 0);
+        options = &defaults;
+    }
+    int max_concurrency = options->max_concurrency > 0 ? options->max_concurrency : DEFAULT_FLEET_CONCURRENCY;
+    if (max_concurrency > target_count) {
+        max_concurrency = target_count;
+    }
+    LoquatFleetOptions run_options = *options;
+    run_options.max_concurrency = max_concurrency;
+
+    if (!loquat_global_init()) {
+        return 0;
+    }
+
+    FleetSchedule schedule;
+    CURLM *multi = curl_multi_init();
+    FleetSlot *slots = calloc((size_t)max_concurrency, sizeof(FleetSlot));
+    FleetSlot **free_slots = malloc((size_t)max_concurrency * sizeof(FleetSlot *));
+    int scheduled = fleet_schedule_init(&schedule, targets, target_count, &run_options);
+    if (!multi || !slots || !free_slots || !scheduled) {
+        fprintf(stderr, "Failed to initialize fleet run\n");
+        if (multi) curl_multi_cleanup(multi);
+        free(slots);
+        free(free_slots);
+        fleet_schedule_free(&schedule);
+        loquat_global_cleanup();
+        return 0;
+    }
+
+    // Keep one idle connection per slot so handles reused for later
+    // targets do not evict each other's connections
+    curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)max_concurrency);
+
+    int ret = 1;
+    int active = 0;              // Slots in use, waiting uploads included
+    int waiting = 0;             // Uploads between a failure and their next transfer
+    int free_count = 0;
+    for (int i = 0; i < max_concurrency; i++) {
+        slots[i].curl = curl_easy_init();
+        if (!slots[i].curl) {
+            fprintf(stderr, "Failed to initialize CURL\n");
+            ret = 0;
+            goto cleanup;
+        }
+        free_slots[free_count++] = &slots[max_concurrency - 1 - i];
+    }
+
+    while (active > 0 || schedule.pending > 0) {
+        // Resume uploads whose wait is over
+        double now = fleet_now();
+        for (int i = 0; waiting > 0 && i < max_concurrency; i++) {
+            FleetSlot *slot = &slots[i];
+            if (slot->resume_at <= 0.0 || slot->resume_at > now) {
+                continue;
+            }
+            slot->resume_at = 0.0;
+            waiting--;
+            if (!fleet_transfer(multi, slot, targets[slot->index], command, post_data, image)) {
+                fleet_report_error(targets, slot->index, "Failed to start request", callback, userdata);
+                loquat_upload_end(&slot->upload);
+                active--;
+                free_slots[free_count++] = slot;
+            }
+        }
+
+        // Start whatever the concurrency limit and the devices' buckets allow
+        double next_ready = -1.0;
+        while (active < fleet_limit(&schedule) && free_count > 0) {
+            int index = fleet_schedule_pop(&schedule, now, &next_ready);
+            if (index < 0) {
+                break;
+            }
+            FleetSlot *slot = free_slots[--free_count];
+            if (!fleet_start(multi, slot, index, targets[index], command, post_data, image)) {
+                fleet_report_error(targets, index, "Failed to start request", callback, userdata);
+                free_slots[free_count++] = slot;
+                continue;
+            }
+            slot->seq = loquat_aimd_start(&schedule.aimd);
+            active++;
+        }
+
+        int running = 0;
+        CURLMcode mc = curl_multi_perform(multi, &running);
+        if (mc != CURLM_OK) {
+            fprintf(stderr, "curl_multi_perform() failed: %s\n", curl_multi_strerror(mc));
+            ret = 0;
+            break;
+        }
+
+        // Report every finished target and free its slot for the next one
+        CURLMsg *msg;
+        int queued;
+        int finished = 0;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+
+            CURL *easy = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            FleetSlot *slot = NULL;
+            curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&slot);
+
+            // A dropped upload keeps its slot until it has resumed
+            if (image && loquat_upload_advance(&slot->upload, easy, res)) {
+                curl_multi_remove_handle(multi, easy);
+                slot->resume_at = fleet_now() + slot->upload.delay;
+                waiting++;
+                continue;
+            }
+
+            fleet_finish(&schedule, slot, easy, res, targets, image, callback, userdata);
+            curl_multi_remove_handle(multi, easy);
+            active--;
+            free_slots[free_count++] = slot;
+            finished++;
+        }
+        if (finished > 0) {
+            // Freed slots are refilled before waiting
+            continue;
+        }
+
+        if (active > 0 || schedule.pending > 0) {
+            // Wake for the first upload due to resume or device due a request
+            int wait_ms = 1000;
+            now = fleet_now();
+            for (int i = 0; waiting > 0 && i < max_concurrency; i++) {
+                if (slots[i].resume_at > 0.0) {
+                    double wait = slots[i].resume_at - now;
+                    int ms = wait > 0 ? (int)(wait * 1000.0) + 1 : 0;
+                    if (ms < wait_ms) wait_ms = ms;
+                }
+            }
+            if (next_ready >= 0.0 && (int)(next_ready * 1000.0) + 1 < wait_ms) {
+                wait_ms = (int)(next_ready * 1000.0) + 1;
+            }
+            mc = curl_multi_poll(multi, NULL, 0, wait_ms, NULL);
+            if (mc != CURLM_OK) {
+                fprintf(stderr, "curl_multi_poll() failed: %s\n", curl_multi_strerror(mc));
+                ret = 0;
+                break;
+            }
+        }
+    }
+
+cleanup:
+    for (int i = 0; i < max_concurrency; i++) {
+        if (slots[i].curl) {
+            curl_multi_remove_handle(multi, slots[i].curl);
+            curl_easy_cleanup(slots[i].curl);
+        }
+        loquat_upload_end(&slots[i].upload);
+        free(slots[i].resp.data);
+    }
+    free(slots);
+    free(free_slots);
+    fleet_schedule_free(&schedule);
+    curl_multi_cleanup(multi);
+    loquat_global_cleanup();
+
+    return ret;
+}
+
+// Default pacing for a fleet run
+void loquat_fleet_options_init(LoquatFleetOptions *options, int max_concurrency) {
+    if (!options) return;
+    options->max_concurrency = max_concurrency;
+    options->adaptive = 1;
+    options->device_rate = 0.0;
+    options->device_burst = 1.0;
+    options->max_retries = FLEET_MAX_RETRIES;
+}
+
+// Issue a command or upload to many devices with the given pacing
+int loquat_fleet_run_paced(const char **targets, int target_count, const char *command,
+                           const char *post_data, LoquatImage *image, const LoquatFleetOptions *options,
+                           loquat_fleet_result_cb callback, void *userdata) {
+    return fleet_run(targets, target_count, command, post_data, image, options, callback, userdata);
+}
+
+// Issue the same command to many devices concurrently
+int loquat_fleet_run(const char **targets, int target_count, const char *command,
+                     const char *post_data, int max_concurrency,
+                     loquat_fleet_result_cb callback, void *userdata) {
+    LoquatFleetOptions options;
+    loquat_fleet_options_init(&options, max_concurrency);
+    return fleet_run(targets, target_count, command, post_data, NULL, &options, callback, userdata);
+}
+
+// Upload one image to many devices concurrently
+int loquat_fleet_upload(const char **targets, int target_count, const char *command,
+                        LoquatImage *image, int max_concurrency,
+                        loquat_fleet_result_cb callback, void *userdata) {
+    if (!image) {
+        return 0;
+    }
+    LoquatFleetOptions options;
+    loquat_fleet_options_init(&options, max_concurrency);
+    return fleet_run(targets, target_count, command, NULL, image, &options, callback, userdata);
+}
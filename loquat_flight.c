@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Single-flight GETs. While a GET is on the wire, an identical one (same
+// URL, socket and headers) from another thread does not make its own
+// request: it waits for the first to land and takes the same result. A
+// body handed to several callers is registered with a reference count,
+// and loquat_client_free_response() frees it only once every caller has
+// released it.
+
+struct LoquatFlight {
+    char *key;
+    unsigned long hash;
+    int waiters;                 // Callers waiting for this flight to land
+    int landed;
+    int ok;
+    int http_code;
+    char *response;
+    pthread_cond_t cond;
+    LoquatFlight *next;
+};
+
+// A body returned to more than one caller
+typedef struct SharedResponse {
+    char *data;
+    int refs;
+    struct SharedResponse *next;
+} SharedResponse;
+
+static LoquatFlight *flights = NULL;             // In the air
+static SharedResponse *shared_responses = NULL;
+static int shared_response_count = 0;            // Read without the lock to skip it
+static pthread_mutex_t flights_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned long flights_issued = 0;
+static unsigned long flights_coalesced = 0;
+
+// Identify a GET by everything that can change its answer
+char* loquat_flight_key(const char *url, const char *unix_socket, char **headers, int header_count) {
+    size_t len = strlen(url) + 2 + (unix_socket ? strlen(unix_socket) : 0);
+    for (int i = 0; i < header_count; i++) {
+        if (headers[i]) len += strlen(headers[i]) + 1;
+    }
+
+    char *key = malloc(len + 1);
+    if (!key) {
+        return NULL;
+    }
+    char *p = key;
+    p += sprintf(p, "%s\n%s\n", url, unix_socket ? unix_socket : "");
+    for (int i = 0; i < header_count; i++) {
+        if (headers[i]) p += sprintf(p, "%s\n", headers[i]);
+    }
+    return key;
+}
+
+// Wait for an identical flight and take its result, or start one
+int loquat_flight_begin(char *key, LoquatFlight **flight, int *ok, char **response, int *http_code) {
+    *flight = NULL;
+    if (!key) {
+        return 0;
+    }
+    unsigned long hash = loquat_hash_string(key);
+
+    pthread_mutex_lock(&flights_lock);
+    LoquatFlight *f = flights;
+    while (f && !(f->hash == hash && strcmp(f->key, key) == 0)) {
+        f = f->next;
+    }
+
+    if (f) {
+        free(key);
+        f->waiters++;
+        while (!f->landed) {
+            pthread_cond_wait(&f->cond, &flights_lock);
+        }
+        *ok = f->ok;
+        *http_code = f->http_code;
+        *response = f->response;
+        flights_coalesced++;
+
+        // The last caller to wake frees the flight
+        if (--f->waiters == 0) {
+            pthread_cond_destroy(&f->cond);
+            free(f->key);
+            free(f);
+        }
+        pthread_mutex_unlock(&flights_lock);
+        return 1;
+    }
+
+    f = calloc(1, sizeof(LoquatFlight));
+    if (f) {
+        f->key = key;
+        f->hash = hash;
+        pthread_cond_init(&f->cond, NULL);
+        f->next = flights;
+        flights = f;
+        *flight = f;
+    } else {
+        // Go ahead uncoalesced
+        free(key);
+    }
+    flights_issued++;
+    pthread_mutex_unlock(&flights_lock);
+    return 0;
+}
+
+// Hand the leader's result to everyone who waited for it
+void loquat_flight_land(LoquatFlight *flight, int ok, char *response, int http_code) {
+    if (!flight) {
+        return;
+    }
+
+    // Allocated before taking the lock; dropped if nobody waited
+    SharedResponse *shared = ok ? malloc(sizeof(SharedResponse)) : NULL;
+
+    pthread_mutex_lock(&flights_lock);
+    LoquatFlight **link = &flights;
+    while (*link != flight) {
+        link = &(*link)->next;
+    }
+    *link = flight->next;
+
+    if (ok && flight->waiters > 0 && !shared) {
+        // Cannot count references: the waiters see a failed request
+        // rather than a body freed under them
+        fprintf(stderr, "Failed to allocate memory for shared response\n");
+        ok = 0;
+    }
+    if (ok && flight->waiters > 0) {
+        shared->data = response;
+        shared->refs = flight->waiters + 1;
+        shared->next = shared_responses;
+        shared_responses = shared;
+        __atomic_add_fetch(&shared_response_count, 1, __ATOMIC_RELEASE);
+        shared = NULL;
+    }
+    free(shared);
+
+    flight->landed = 1;
+    flight->ok = ok;
+    flight->http_code = http_code;
+    flight->response = ok ? response : NULL;
+    if (flight->waiters > 0) {
+        pthread_cond_broadcast(&flight->cond);
+    } else {
+        pthread_cond_destroy(&flight->cond);
+        free(flight->key);
+        free(flight);
+    }
+    pthread_mutex_unlock(&flights_lock);
+}
+
+// Drop one caller's reference to a shared body
+int loquat_flight_release(char *response) {
+    if (__atomic_load_n(&shared_response_count, __ATOMIC_ACQUIRE) == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&flights_lock);
+    SharedResponse **link = &shared_responses;
+    while (*link && (*link)->data != response) {
+        link = &(*link)->next;
+    }
+    int held = 0;
+    if (*link) {
+        SharedResponse *shared = *link;
+        if (--shared->refs > 0) {
+            held = 1;
+        } else {
+            *link = shared->next;
+            free(shared);
+            __atomic_sub_fetch(&shared_response_count, 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&flights_lock);
+    return held;
+}
+
+// Count GETs that went out and GETs that were answered by another's flight
+void loquat_flight_stats(LoquatFlightStats *stats) {
+    if (!stats) return;
+    pthread_mutex_lock(&flights_lock);
+    stats->issued = flights_issued;
+    stats->coalesced = flights_coalesced;
+    pthread_mutex_unlock(&flights_lock);
+}
@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Snapshot of the access points seen by the previous scan, keyed by SSID.
+// Open addressing with linear probing and backward-shift deletion, so
+// removing vanished access points leaves no tombstones behind.
+
+#define SCAN_INDEX_INITIAL_SLOTS 64
+
+typedef struct {
+    LoquatAccessPoint ap;        // Access point as last reported
+    unsigned long hash;
+    unsigned long generation;    // Scan that last reported this SSID
+    int new_bars;                // Best bars reported by the current scan
+    int used;
+    int added;                   // First reported by the current scan
+} ScanIndexEntry;
+
+struct LoquatScanIndex {
+    ScanIndexEntry *slots;
+    size_t slot_count;           // Always a power of two
+    size_t used;
+    unsigned long generation;
+};
+
+// FNV-1a
+unsigned long loquat_hash_string(const char *s) {
+    unsigned long hash = 2166136261UL;
+    while (*s) {
+        hash ^= (unsigned char)*s++;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// Create an empty scan index
+LoquatScanIndex* loquat_scan_index_init(void) {
+    LoquatScanIndex *index = calloc(1, sizeof(LoquatScanIndex));
+    if (!index) {
+        fprintf(stderr, "Failed to allocate memory for scan index\n");
+        return NULL;
+    }
+
+    index->slots = calloc(SCAN_INDEX_INITIAL_SLOTS, sizeof(ScanIndexEntry));
+    if (!index->slots) {
+        fprintf(stderr, "Failed to allocate memory for scan index\n");
+        free(index);
+        return NULL;
+    }
+    index->slot_count = SCAN_INDEX_INITIAL_SLOTS;
+    return index;
+}
+
+// Free a scan index
+void loquat_scan_index_cleanup(LoquatScanIndex *index) {
+    if (index) {
+        free(index->slots);
+        free(index);
+    }
+}
+
+// Double the table, keeping load factor at or below one half
+static int scan_index_grow(LoquatScanIndex *index) {
+    size_t count = index->slot_count * 2;
+    ScanIndexEntry *slots = calloc(count, sizeof(ScanIndexEntry));
+    if (!slots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < index->slot_count; i++) {
+        if (!index->slots[i].used) continue;
+        size_t pos = index->slots[i].hash & (count - 1);
+        while (slots[pos].used) {
+            pos = (pos + 1) & (count - 1);
+        }
+        slots[pos] = index->slots[i];
+    }
+
+    free(index->slots);
+    index->slots = slots;
+    index->slot_count = count;
+    return 1;
+}
+
+// Start recording a new scan
+void loquat_scan_index_begin(LoquatScanIndex *index) {
+    if (index) {
+        index->generation++;
+    }
+}
+
+// Record one access point from the scan in progress
+int loquat_scan_index_add(LoquatScanIndex *index, const LoquatAccessPoint *ap) {
+    if (!index || !ap) {
+        return 0;
+    }
+
+    if ((index->used + 1) * 2 > index->slot_count && !scan_index_grow(index)) {
+        return 0;
+    }
+
+    unsigned long hash = loquat_hash_string(ap->ssid);
+    size_t mask = index->slot_count - 1;
+    size_t pos = hash & mask;
+
+    while (index->slots[pos].used) {
+        ScanIndexEntry *entry = &index->slots[pos];
+        if (entry->hash == hash && strcmp(entry->ap.ssid, ap->ssid) == 0) {
+            if (entry->generation != index->generation) {
+                entry->generation = index->generation;
+                entry->new_bars = ap->bars;
+            } else if (ap->bars > entry->new_bars) {
+                // Several BSSs share the SSID; track the strongest
+                entry->new_bars = ap->bars;
+            }
+            return 1;
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    ScanIndexEntry *entry = &index->slots[pos];
+    entry->ap = *ap;
+    entry->hash = hash;
+    entry->generation = index->generation;
+    entry->new_bars = ap->bars;
+    entry->used = 1;
+    entry->added = 1;
+    index->used++;
+    return 1;
+}
+
+// Remove the entry at pos, shifting later entries of the probe run back
+static void scan_index_remove(LoquatScanIndex *index, size_t pos) {
+    size_t mask = index->slot_count - 1;
+    size_t hole = pos;
+    size_t next = (pos + 1) & mask;
+
+    while (index->slots[next].used) {
+        size_t home = index->slots[next].hash & mask;
+        // Move the entry into the hole unless its home lies cyclically in (hole, next]
+        if ((next > hole && (home <= hole || home > next)) ||
+            (next < hole && (home <= hole && home > next))) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+
+    memset(&index->slots[hole], 0, sizeof(ScanIndexEntry));
+    index->used--;
+}
+
+// Finish the scan in progress and report what changed since the previous one
+int loquat_scan_index_commit(LoquatScanIndex *index, loquat_scan_diff_cb callback, void *userdata) {
+    if (!index) {
+        return 0;
+    }
+
+    int changes = 0;
+    size_t i = 0;
+    while (i < index->slot_count) {
+        ScanIndexEntry *entry = &index->slots[i];
+        if (!entry->used) {
+            i++;
+            continue;
+        }
+
+        if (entry->generation != index->generation) {
+            changes++;
+            if (callback) callback(LOQUAT_AP_REMOVED, &entry->ap, entry->ap.bars, userdata);
+            // Backward shift may pull an unvisited entry into slot i; look at it again
+            scan_index_remove(index, i);
+            continue;
+        }
+
+        if (entry->added) {
+            entry->added = 0;
+            entry->ap.bars = entry->new_bars;
+            changes++;
+            if (callback) callback(LOQUAT_AP_ADDED, &entry->ap, entry->ap.bars, userdata);
+        } else if (entry->new_bars != entry->ap.bars) {
+            int old_bars = entry->ap.bars;
+            entry->ap.bars = entry->new_bars;
+            changes++;
+            if (callback) callback(LOQUAT_AP_CHANGED, &entry->ap, old_bars, userdata);
+        }
+        i++;
+    }
+
+    return changes;
+}
+
+// Number of access points in the index
+size_t loquat_scan_index_size(LoquatScanIndex *index) {
+    return index ? index->used : 0;
+}
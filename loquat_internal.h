@@ -0,0 +1,151 @@
+#ifndef LOQUAT_INTERNAL_H
+#define LOQUAT_INTERNAL_H
+
+#include <curl/curl.h>
+#include "loquatcli.h"
+
+// Internal declarations shared between the library translation units.
+// Nothing in here is part of the public API.
+
+#define MAX_URL_LENGTH 2048
+#define MAX_RESPONSE_LENGTH 8192
+#define DEFAULT_TIMEOUT 30
+#define CONNECT_TIMEOUT 120
+#define RESPONSE_INITIAL_CAPACITY 4096
+
+// Join base_url, sep and command into buf, or into a malloc'd string when
+// they do not fit; free with loquat_url_release(). libcurl copies
+// CURLOPT_URL, so the URL can be released once it is set. NULL if out of memory
+char* loquat_url_join(char *buf, size_t size, const char *base_url, const char *sep, const char *command);
+void loquat_url_release(char *url, const char *buf);
+
+// Grow a response buffer to at least capacity bytes (fails for fixed buffers)
+int loquat_response_reserve(ResponseData *resp, size_t capacity);
+
+// Callback function to handle the response data
+size_t loquat_write_callback(void *contents, size_t size, size_t nmemb, void *userp);
+
+// Read the phase timings of a finished transfer
+void loquat_timing_read(CURL *curl, LoquatTiming *timing);
+
+// Fresh cache entry, mapped read-only until loquat_cache_release()
+typedef struct {
+    void *map;
+    size_t map_size;
+    const char *body;      // Cached body (not NUL-terminated)
+    size_t body_len;
+    double age;            // Seconds since the entry was stored
+} LoquatCacheHit;
+
+// Map the fresh entry for base_url/command, as fetched over unix_socket
+// (NULL for TCP); 0 if there is none
+int loquat_cache_lookup(LoquatCache *cache, const char *base_url, const char *unix_socket,
+                        const char *command, LoquatCacheHit *hit);
+
+// Unmap an entry returned by loquat_cache_lookup()
+void loquat_cache_release(LoquatCacheHit *hit);
+
+// Store a 200 response body for base_url/command if the command is cached
+void loquat_cache_store(LoquatCache *cache, const char *base_url, const char *unix_socket,
+                        const char *command, const char *body, size_t body_len);
+
+// FNV-1a hash of a NUL-terminated string
+unsigned long loquat_hash_string(const char *s);
+
+// Share handle (DNS, TLS session and, if share_connections, connection
+// cache) owned by the library context; NULL until loquat_global_init()
+CURLSH* loquat_share_handle(int share_connections);
+
+// Identical GETs in progress at the same time (loquat_flight.c). The key
+// is built from the URL, socket path and headers; NULL if out of memory
+typedef struct LoquatFlight LoquatFlight;
+char* loquat_flight_key(const char *url, const char *unix_socket, char **headers, int header_count);
+
+// Takes ownership of key. Returns 1 with the result of an identical
+// request that was already in progress, after waiting for it to land.
+// Otherwise returns 0 and the caller makes the request, then passes its
+// outcome to loquat_flight_land() (flight may be NULL if out of memory)
+int loquat_flight_begin(char *key, LoquatFlight **flight, int *ok, char **response, int *http_code);
+void loquat_flight_land(LoquatFlight *flight, int ok, char *response, int http_code);
+
+// Drop a reference to a response shared between callers; 1 if it is
+// still in use, 0 if the caller should free it
+int loquat_flight_release(char *response);
+
+// Requests per second allowed to one device (loquat_pacing.c). Times are
+// seconds on the caller's monotonic clock
+typedef struct {
+    double rate;                 // Tokens added per second (0: no limit)
+    double burst;                // Most tokens held
+    double tokens;
+    double updated;              // When tokens were last topped up
+    double not_before;           // Paused until then (Retry-After)
+} LoquatTokenBucket;
+
+void loquat_bucket_init(LoquatTokenBucket *bucket, double rate, double burst, double now);
+double loquat_bucket_wait(LoquatTokenBucket *bucket, double now);
+void loquat_bucket_take(LoquatTokenBucket *bucket);
+void loquat_bucket_pause(LoquatTokenBucket *bucket, double until);
+
+// Additive-increase, multiplicative-decrease limit on requests in flight
+typedef struct {
+    double limit;
+    int max;
+    int slow_start;              // Growing by one per success until the first cut
+    unsigned long started;       // Requests numbered so far
+    unsigned long last_cut;      // Requests numbered up to here cannot cut again
+    unsigned long samples;
+    double latency_fast;         // EWMAs of time to first byte
+    double latency_slow;
+    int cuts;
+} LoquatAimd;
+
+void loquat_aimd_init(LoquatAimd *aimd, int max_limit);
+int loquat_aimd_limit(const LoquatAimd *aimd);
+unsigned long loquat_aimd_start(LoquatAimd *aimd);
+void loquat_aimd_sample(LoquatAimd *aimd, unsigned long seq, int overloaded, double latency);
+
+// A timeout, 429 or 5xx
+int loquat_overloaded(CURLcode res, int http_code);
+
+// Retry-After of a finished transfer in seconds (capped; 0 to retry now), or -1 if none
+double loquat_retry_after(CURL *curl);
+
+// Options every transfer of a client starts from: the shared caches and,
+// if the client has one, its UNIX domain socket
+void loquat_client_setup_transfer(LoquatClient *client, CURL *curl);
+
+// Progress of one upload of an image to one device, across the POSTs and
+// offset probes it takes (loquat_upload.c)
+typedef struct {
+    LoquatImage *image;
+    size_t start;                // Offset the current POST sends from
+    size_t offset;               // Next byte the read callback hands out
+    size_t sent;                 // Bytes handed out across attempts
+    int probing;                 // The next transfer asks the device for its offset
+    int have_offset;             // The probe's reply carried Upload-Offset
+    size_t device_offset;
+    int resumes;
+    double delay;                // Seconds to wait before the next transfer
+    struct curl_slist *headers;
+} LoquatUpload;
+
+void loquat_upload_begin(LoquatUpload *upload, LoquatImage *image);
+
+// Configure the next transfer (POST or probe) on a handle that already
+// has its URL and write callback
+int loquat_upload_setup(LoquatUpload *upload, CURL *curl);
+
+// After a transfer: 1 if another should start after upload->delay
+// seconds, 0 if the upload is over
+int loquat_upload_advance(LoquatUpload *upload, CURL *curl, CURLcode res);
+
+void loquat_upload_end(LoquatUpload *upload);
+
+// Command-line helpers defined in loquatcli.c, exposed for the benchmarks
+void print_scan_result(const char *response);
+void print_net_info_response(const char *response);
+int set_result_parser(const char *name);
+char* get_post_connect_wifi_data(const char *ssid, const char *psk, const char *security);
+
+#endif // LOQUAT_INTERNAL_H
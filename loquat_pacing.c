@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Pacing for runs that send many requests: a token bucket per device and
+// an AIMD limit on how many requests a run keeps in flight.
+//
+// The limit starts small and grows by one per success (doubling each
+// round trip) until the first sign of overload, then by one per round
+// trip. Overload is a timeout, a 5xx or 429 reply, or the recent latency
+// climbing well above its long-run average; each halves the limit. Only
+// requests started after the last cut can cut it again, so one burst of
+// failures from requests that were already in flight counts once.
+
+#define AIMD_INITIAL_LIMIT 8
+#define AIMD_DECREASE 0.5
+#define AIMD_LATENCY_FACTOR 2.0      // Recent latency this far above average is overload
+#define AIMD_LATENCY_SAMPLES 20      // Samples before latency is trusted
+#define AIMD_FAST_WEIGHT 0.3         // EWMA weights of recent and long-run latency
+#define AIMD_SLOW_WEIGHT 0.02
+#define RETRY_AFTER_MAX 120.0        // Longest Retry-After honoured, in seconds
+
+void loquat_bucket_init(LoquatTokenBucket *bucket, double rate, double burst, double now) {
+    bucket->rate = rate;
+    bucket->burst = burst >= 1.0 ? burst : 1.0;
+    bucket->tokens = bucket->burst;
+    bucket->updated = now;
+    bucket->not_before = 0.0;
+}
+
+// Seconds until a request may be sent (0 if it may go now)
+double loquat_bucket_wait(LoquatTokenBucket *bucket, double now) {
+    if (now < bucket->not_before) {
+        return bucket->not_before - now;
+    }
+    if (bucket->rate <= 0.0) {
+        return 0.0;
+    }
+    bucket->tokens += (now - bucket->updated) * bucket->rate;
+    if (bucket->tokens > bucket->burst) {
+        bucket->tokens = bucket->burst;
+    }
+    bucket->updated = now;
+    return bucket->tokens >= 1.0 ? 0.0 : (1.0 - bucket->tokens) / bucket->rate;
+}
+
+// Spend a token on a request (after loquat_bucket_wait() returned 0)
+void loquat_bucket_take(LoquatTokenBucket *bucket) {
+    if (bucket->rate > 0.0) {
+        bucket->tokens -= 1.0;
+    }
+}
+
+// Send nothing more to the device before until (e.g. from Retry-After)
+void loquat_bucket_pause(LoquatTokenBucket *bucket, double until) {
+    if (until > bucket->not_before) {
+        bucket->not_before = until;
+    }
+}
+
+void loquat_aimd_init(LoquatAimd *aimd, int max_limit) {
+    memset(aimd, 0, sizeof(*aimd));
+    aimd->max = max_limit >= 1 ? max_limit : 1;
+    aimd->limit = aimd->max < AIMD_INITIAL_LIMIT ? aimd->max : AIMD_INITIAL_LIMIT;
+    aimd->slow_start = 1;
+}
+
+// Requests the run may have in flight now
+int loquat_aimd_limit(const LoquatAimd *aimd) {
+    return (int)aimd->limit;
+}
+
+// Number a request as it is started, for loquat_aimd_sample()
+unsigned long loquat_aimd_start(LoquatAimd *aimd) {
+    return ++aimd->started;
+}
+
+// Feed back the outcome of the request numbered seq
+void loquat_aimd_sample(LoquatAimd *aimd, unsigned long seq, int overloaded, double latency) {
+    if (!overloaded && latency > 0.0) {
+        if (aimd->samples++ == 0) {
+            aimd->latency_fast = latency;
+            aimd->latency_slow = latency;
+        } else {
+            aimd->latency_fast += AIMD_FAST_WEIGHT * (latency - aimd->latency_fast);
+            aimd->latency_slow += AIMD_SLOW_WEIGHT * (latency - aimd->latency_slow);
+        }
+        overloaded = aimd->samples > AIMD_LATENCY_SAMPLES &&
+                     aimd->latency_fast > AIMD_LATENCY_FACTOR * aimd->latency_slow;
+    }
+
+    if (overloaded) {
+        if (seq > aimd->last_cut) {
+            aimd->limit *= AIMD_DECREASE;
+            if (aimd->limit < 1.0) {
+                aimd->limit = 1.0;
+            }
+            aimd->last_cut = aimd->started;
+            aimd->slow_start = 0;
+            aimd->cuts++;
+            // Judge the new limit by its own latency
+            aimd->latency_fast = aimd->latency_slow;
+        }
+        return;
+    }
+
+    aimd->limit += aimd->slow_start ? 1.0 : 1.0 / aimd->limit;
+    if (aimd->limit > aimd->max) {
+        aimd->limit = aimd->max;
+    }
+}
+
+// Whether a finished request says the device or network is overloaded
+int loquat_overloaded(CURLcode res, int http_code) {
+    if (res == CURLE_OPERATION_TIMEDOUT) {
+        return 1;
+    }
+    return res == CURLE_OK && (http_code == 429 || http_code >= 500);
+}
+
+// Seconds the reply asked us to wait before retrying (Retry-After), or -1
+// if it did not say. 0 means retry now: libcurl also reports 0 when the
+// header is missing, so its presence is checked separately
+double loquat_retry_after(CURL *curl) {
+    struct curl_header *header;
+    if (curl_easy_header(curl, "Retry-After", 0, CURLH_HEADER, -1, &header) != CURLHE_OK) {
+        return -1.0;
+    }
+    curl_off_t seconds = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &seconds) != CURLE_OK || seconds < 0) {
+        seconds = 0;
+    }
+    return seconds > RETRY_AFTER_MAX ? RETRY_AFTER_MAX : (double)seconds;
+}
@@ -0,0 +1,483 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Worker pool for multi-threaded applications. Each worker thread owns an
+// easy handle, its connections and a response buffer. Workers share only
+// DNS results and TLS sessions, through a share handle of the pool's own:
+// with the library-wide connection cache every request would take the same
+// lock, and workers would keep evicting each other's connections. Jobs
+// travel through a bounded
+// multi-producer/multi-consumer ring (Vyukov's sequence-numbered cells):
+// submitting and taking a job is one compare-and-swap each. Two semaphores
+// count queued jobs and free cells, so idle workers sleep and submitters
+// block only while the queue is full.
+
+#define POOL_QUEUE_SIZE 1024             // Cells in the ring (power of two)
+#define POOL_CACHE_LINE 64
+
+typedef struct {
+    char *url;
+    char *post_data;                     // NULL for GET
+    long timeout;
+    loquat_async_cb callback;            // Set for callback jobs
+    void *userdata;
+    LoquatFuture *future;                // Set for future jobs
+} PoolJob;
+
+typedef struct {
+    unsigned long seq;
+    PoolJob *job;
+} PoolCell;
+
+typedef struct {
+    LoquatPool *pool;
+    pthread_t thread;
+    CURL *curl;
+    ResponseData resp;                   // Reused by every job on this worker
+    int started;
+} PoolWorker;
+
+struct LoquatPool {
+    PoolCell *cells;
+    size_t mask;
+    // Producers and consumers update different cache lines
+    char pad0[POOL_CACHE_LINE];
+    unsigned long enqueue_pos;
+    char pad1[POOL_CACHE_LINE];
+    unsigned long dequeue_pos;
+    char pad2[POOL_CACHE_LINE];
+    sem_t queued;                        // Jobs ready to take
+    sem_t free_cells;                    // Cells ready to fill
+    unsigned long pending;               // Submitted jobs not yet finished
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle;
+    CURLSH *share;                       // DNS and TLS sessions shared by the workers
+    pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+    PoolWorker *workers;
+    int worker_count;
+};
+
+struct LoquatFuture {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int done;
+    LoquatAsyncResult result;            // response points at owned copy
+    char *response;
+};
+
+// Placeholder job telling a worker to exit
+static PoolJob pool_stop_job;
+
+static void pool_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+    (void)handle;
+    (void)access;
+    pthread_mutex_lock(&((LoquatPool *)userptr)->share_locks[data]);
+}
+
+static void pool_share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+    (void)handle;
+    pthread_mutex_unlock(&((LoquatPool *)userptr)->share_locks[data]);
+}
+
+static void sem_wait_retry(sem_t *sem) {
+    while (sem_wait(sem) != 0 && errno == EINTR) {
+    }
+}
+
+// Put a job in the ring; the caller has reserved a cell from free_cells
+static void pool_enqueue(LoquatPool *pool, PoolJob *job) {
+    unsigned long pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        PoolCell *cell = &pool->cells[pos & pool->mask];
+        unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->job = job;
+                __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+                return;
+            }
+        } else {
+            // The cell's previous job is still being taken
+            if (diff < 0) sched_yield();
+            pos = __atomic_load_n(&pool->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Take the oldest job; the caller has reserved one from queued
+static PoolJob* pool_dequeue(LoquatPool *pool) {
+    unsigned long pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        PoolCell *cell = &pool->cells[pos & pool->mask];
+        unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&pool->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                PoolJob *job = cell->job;
+                __atomic_store_n(&cell->seq, pos + pool->mask + 1, __ATOMIC_RELEASE);
+                return job;
+            }
+        } else {
+            // An earlier submitter has claimed the cell but not filled it yet
+            if (diff < 0) sched_yield();
+            pos = __atomic_load_n(&pool->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void pool_push(LoquatPool *pool, PoolJob *job) {
+    sem_wait_retry(&pool->free_cells);
+    pool_enqueue(pool, job);
+    sem_post(&pool->queued);
+}
+
+// Mark a job finished, waking loquat_pool_wait() when none are left
+static void pool_job_done(LoquatPool *pool) {
+    if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&pool->idle_mutex);
+        pthread_cond_broadcast(&pool->idle);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+}
+
+// Perform one job on the worker's own handle and deliver the result
+static void pool_run(PoolWorker *worker, PoolJob *job) {
+    LoquatPool *pool = worker->pool;
+    CURL *curl = worker->curl;
+    worker->resp.curl = curl;
+    worker->resp.size = 0;
+    if (worker->resp.data) {
+        worker->resp.data[0] = '\0';
+    }
+
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_SHARE, pool->share);
+    curl_easy_setopt(curl, CURLOPT_URL, job->url);
+    if (job->post_data) {
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, job->post_data);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(job->post_data));
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &worker->resp);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, job->timeout);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+    // Worker threads must not be interrupted by SIGALRM-based DNS timeouts
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    LoquatAsyncResult result = {0};
+    result.ok = (res == CURLE_OK);
+    result.error = result.ok ? NULL : curl_easy_strerror(res);
+    result.response = worker->resp.data ? worker->resp.data : "";
+    result.response_size = worker->resp.size;
+
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    result.http_code = (int)code;
+
+    loquat_timing_read(curl, &result.timing);
+    result.total_time = result.timing.total;
+
+    if (job->callback) {
+        job->callback(&result, job->userdata);
+        return;
+    }
+
+    // Futures outlive the worker's buffer, so they get their own copy
+    LoquatFuture *future = job->future;
+    char *copy = malloc(result.response_size + 1);
+    if (copy) {
+        memcpy(copy, result.response, result.response_size);
+        copy[result.response_size] = '\0';
+    } else if (result.ok) {
+        result.ok = 0;
+        result.error = "Out of memory";
+        result.response_size = 0;
+    }
+    pthread_mutex_lock(&future->mutex);
+    future->response = copy;
+    future->result = result;
+    future->result.response = copy ? copy : "";
+    future->done = 1;
+    pthread_cond_broadcast(&future->cond);
+    pthread_mutex_unlock(&future->mutex);
+}
+
+static void* pool_worker(void *arg) {
+    PoolWorker *worker = arg;
+    LoquatPool *pool = worker->pool;
+
+    for (;;) {
+        sem_wait_retry(&pool->queued);
+        PoolJob *job = pool_dequeue(pool);
+        sem_post(&pool->free_cells);
+        if (job == &pool_stop_job) {
+            break;
+        }
+        pool_run(worker, job);
+        free(job);
+        pool_job_done(pool);
+    }
+    return NULL;
+}
+
+// Create a pool of worker threads
+LoquatPool* loquat_pool_init(int workers) {
+    if (workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? (int)cpus : 1;
+    }
+
+    LoquatPool *pool = calloc(1, sizeof(LoquatPool));
+    if (!pool) {
+        fprintf(stderr, "Failed to allocate memory for pool\n");
+        return NULL;
+    }
+    pool->cells = calloc(POOL_QUEUE_SIZE, sizeof(PoolCell));
+    pool->workers = calloc((size_t)workers, sizeof(PoolWorker));
+    if (!pool->cells || !pool->workers) {
+        fprintf(stderr, "Failed to allocate memory for pool\n");
+        free(pool->cells);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pool->mask = POOL_QUEUE_SIZE - 1;
+    for (size_t i = 0; i < POOL_QUEUE_SIZE; i++) {
+        pool->cells[i].seq = i;
+    }
+
+    if (!loquat_global_init()) {
+        free(pool->cells);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    sem_init(&pool->queued, 0, 0);
+    sem_init(&pool->free_cells, 0, POOL_QUEUE_SIZE);
+    pthread_mutex_init(&pool->idle_mutex, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    // Without a share handle the workers just resolve and handshake on their own
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&pool->share_locks[i], NULL);
+    }
+    pool->share = curl_share_init();
+    if (pool->share) {
+        curl_share_setopt(pool->share, CURLSHOPT_LOCKFUNC, pool_share_lock);
+        curl_share_setopt(pool->share, CURLSHOPT_UNLOCKFUNC, pool_share_unlock);
+        curl_share_setopt(pool->share, CURLSHOPT_USERDATA, pool);
+        curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(pool->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    // Handles are created here, before any thread runs
+    for (int i = 0; i < workers; i++) {
+        PoolWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->curl = curl_easy_init();
+        if (!worker->curl) {
+            fprintf(stderr, "Failed to initialize CURL\n");
+            break;
+        }
+        if (pthread_create(&worker->thread, NULL, pool_worker, worker) != 0) {
+            fprintf(stderr, "Failed to start pool worker\n");
+            curl_easy_cleanup(worker->curl);
+            worker->curl = NULL;
+            break;
+        }
+        worker->started = 1;
+        pool->worker_count++;
+    }
+
+    if (pool->worker_count < workers) {
+        loquat_pool_cleanup(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+// Finish all submitted jobs, stop the workers and free the pool
+void loquat_pool_cleanup(LoquatPool *pool) {
+    if (!pool) {
+        return;
+    }
+
+    // One stop job per worker, queued behind everything already submitted
+    for (int i = 0; i < pool->worker_count; i++) {
+        pool_push(pool, &pool_stop_job);
+    }
+    for (int i = 0; i < pool->worker_count; i++) {
+        PoolWorker *worker = &pool->workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+        }
+        curl_easy_cleanup(worker->curl);
+        free(worker->resp.data);
+    }
+
+    if (pool->share) {
+        curl_share_cleanup(pool->share);
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&pool->share_locks[i]);
+    }
+    sem_destroy(&pool->queued);
+    sem_destroy(&pool->free_cells);
+    pthread_mutex_destroy(&pool->idle_mutex);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->cells);
+    free(pool->workers);
+    free(pool);
+    loquat_global_cleanup();
+}
+
+// Copy a request into a job; strings are stored after the struct
+static PoolJob* pool_job_create(const char *base_url, const char *command, const char *post_data) {
+    size_t post_len = post_data ? strlen(post_data) + 1 : 0;
+    size_t url_len = strlen(base_url) + 1 + strlen(command) + 1;
+    PoolJob *job = malloc(sizeof(PoolJob) + url_len + post_len);
+    if (!job) {
+        fprintf(stderr, "Failed to allocate memory for pool job\n");
+        return NULL;
+    }
+    memset(job, 0, sizeof(PoolJob));
+
+    job->url = (char *)(job + 1);
+    snprintf(job->url, url_len, "%s/%s", base_url, command);
+    if (post_data) {
+        job->post_data = job->url + url_len;
+        memcpy(job->post_data, post_data, post_len);
+    }
+    job->timeout = (strcmp(command, "connect") == 0) ? CONNECT_TIMEOUT : DEFAULT_TIMEOUT;
+    return job;
+}
+
+static int pool_submit_job(LoquatPool *pool, PoolJob *job) {
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_ACQ_REL);
+    pool_push(pool, job);
+    return 1;
+}
+
+// Queue a request whose result is delivered to callback on a worker thread
+static int pool_request(LoquatPool *pool, const char *base_url, const char *command,
+                        const char *post_data, loquat_async_cb callback, void *userdata) {
+    if (!pool || !base_url || !command || !callback) {
+        return 0;
+    }
+    PoolJob *job = pool_job_create(base_url, command, post_data);
+    if (!job) {
+        return 0;
+    }
+    job->callback = callback;
+    job->userdata = userdata;
+    return pool_submit_job(pool, job);
+}
+
+// Queue a GET request
+int loquat_pool_get(LoquatPool *pool, const char *base_url, const char *command,
+                    loquat_async_cb callback, void *userdata) {
+    return pool_request(pool, base_url, command, NULL, callback, userdata);
+}
+
+// Queue a POST request
+int loquat_pool_post(LoquatPool *pool, const char *base_url, const char *command, const char *post_data,
+                     loquat_async_cb callback, void *userdata) {
+    return pool_request(pool, base_url, command, post_data ? post_data : "", callback, userdata);
+}
+
+// Queue a request whose result is collected with loquat_future_wait()
+LoquatFuture* loquat_pool_submit(LoquatPool *pool, const char *base_url, const char *command,
+                                 const char *post_data) {
+    if (!pool || !base_url || !command) {
+        return NULL;
+    }
+
+    LoquatFuture *future = calloc(1, sizeof(LoquatFuture));
+    PoolJob *job = future ? pool_job_create(base_url, command, post_data) : NULL;
+    if (!job) {
+        if (!future) fprintf(stderr, "Failed to allocate memory for future\n");
+        free(future);
+        return NULL;
+    }
+    pthread_mutex_init(&future->mutex, NULL);
+    pthread_cond_init(&future->cond, NULL);
+    job->future = future;
+
+    pool_submit_job(pool, job);
+    return future;
+}
+
+// Block until every submitted request has finished
+void loquat_pool_wait(LoquatPool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->idle_mutex);
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0) {
+        pthread_cond_wait(&pool->idle, &pool->idle_mutex);
+    }
+    pthread_mutex_unlock(&pool->idle_mutex);
+}
+
+// Number of worker threads
+int loquat_pool_size(const LoquatPool *pool) {
+    return pool ? pool->worker_count : 0;
+}
+
+// Check whether a future's request has finished
+int loquat_future_done(LoquatFuture *future) {
+    if (!future) {
+        return 0;
+    }
+    pthread_mutex_lock(&future->mutex);
+    int done = future->done;
+    pthread_mutex_unlock(&future->mutex);
+    return done;
+}
+
+// Wait for a future's request to finish
+int loquat_future_wait(LoquatFuture *future, LoquatAsyncResult *result) {
+    if (!future) {
+        return 0;
+    }
+    pthread_mutex_lock(&future->mutex);
+    while (!future->done) {
+        pthread_cond_wait(&future->cond, &future->mutex);
+    }
+    if (result) {
+        *result = future->result;
+    }
+    pthread_mutex_unlock(&future->mutex);
+    return 1;
+}
+
+// Free a future, waiting for its request first if needed
+void loquat_future_free(LoquatFuture *future) {
+    if (!future) {
+        return;
+    }
+    loquat_future_wait(future, NULL);
+    pthread_mutex_destroy(&future->mutex);
+    pthread_cond_destroy(&future->cond);
+    free(future->response);
+    free(future);
+}
@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Prepared requests: the URL, header list, method, body and every curl
+// option are set up once on a handle the request owns. Executing only
+// points the handle at the caller's buffer (when it changed since the last
+// run) and performs the transfer, so a polling loop does no formatting,
+// no curl_easy_reset() and no header list rebuilding per request.
+
+struct LoquatRequest {
+    CURL *curl;
+    struct curl_slist *headers;
+    LoquatCache *cache;          // Consulted and filled by GETs, or NULL
+    ResponseData *target;        // Buffer CURLOPT_WRITEDATA points at
+    int served_from_cache;       // Last execution answered from the cache
+    const char *url;             // Strings are stored after the struct
+    const char *base_url;
+    const char *unix_socket;     // Part of the cache key; NULL for TCP
+    const char *command;
+    const char *post_data;       // NULL for a GET
+};
+
+// Join base_url, sep and command, in buf when it fits
+char* loquat_url_join(char *buf, size_t size, const char *base_url, const char *sep, const char *command) {
+    int len = snprintf(buf, size, "%s%s%s", base_url, sep, command);
+    if (len < 0) {
+        return NULL;
+    }
+    if ((size_t)len < size) {
+        return buf;
+    }
+
+    char *url = malloc((size_t)len + 1);
+    if (!url) {
+        fprintf(stderr, "Failed to allocate memory for URL\n");
+        return NULL;
+    }
+    snprintf(url, (size_t)len + 1, "%s%s%s", base_url, sep, command);
+    return url;
+}
+
+// Free a URL from loquat_url_join() unless it is the caller's buffer
+void loquat_url_release(char *url, const char *buf) {
+    if (url != buf) {
+        free(url);
+    }
+}
+
+// Build a request and configure its handle once
+LoquatRequest* loquat_request_prepare(LoquatClient *client, const char *command, const char *post_data,
+                                      char **headers, int header_count) {
+    if (!client || !command) {
+        return NULL;
+    }
+
+    size_t base_len = strlen(client->base_url);
+    size_t command_len = strlen(command);
+    size_t post_len = post_data ? strlen(post_data) : 0;
+    size_t socket_len = client->unix_socket ? strlen(client->unix_socket) : 0;
+    size_t url_size = base_len + 1 + command_len + 1;
+    LoquatRequest *request = malloc(sizeof(LoquatRequest) + url_size + base_len + 1 +
+                                    command_len + 1 + (post_data ? post_len + 1 : 0) +
+                                    (client->unix_socket ? socket_len + 1 : 0));
+    if (!request) {
+        fprintf(stderr, "Failed to allocate memory for request\n");
+        return NULL;
+    }
+    memset(request, 0, sizeof(LoquatRequest));
+
+    char *p = (char *)(request + 1);
+    memcpy(p, client->base_url, base_len);
+    p[base_len] = '/';
+    memcpy(p + base_len + 1, command, command_len + 1);
+    request->url = p;
+    p += url_size;
+    memcpy(p, client->base_url, base_len + 1);
+    request->base_url = p;
+    p += base_len + 1;
+    memcpy(p, command, command_len + 1);
+    request->command = p;
+    p += command_len + 1;
+    if (post_data) {
+        memcpy(p, post_data, post_len + 1);
+        request->post_data = p;
+        p += post_len + 1;
+    }
+    if (client->unix_socket) {
+        memcpy(p, client->unix_socket, socket_len + 1);
+        request->unix_socket = p;
+    }
+    request->cache = post_data ? NULL : client->cache;
+
+    // The request holds its own reference on the library context
+    if (!loquat_global_init()) {
+        free(request);
+        return NULL;
+    }
+    request->curl = curl_easy_init();
+    if (!request->curl) {
+        fprintf(stderr, "Failed to initialize CURL\n");
+        loquat_request_free(request);
+        return NULL;
+    }
+
+    for (int i = 0; i < header_count; i++) {
+        if (!headers[i]) continue;
+        struct curl_slist *list = curl_slist_append(request->headers, headers[i]);
+        if (!list) {
+            fprintf(stderr, "Failed to allocate memory for request headers\n");
+            loquat_request_free(request);
+            return NULL;
+        }
+        request->headers = list;
+    }
+
+    CURL *curl = request->curl;
+
+    // Shared caches and the client's transport; curl keeps its own copy of
+    // the socket path, so the request outlives the client
+    loquat_client_setup_transfer(client, curl);
+    curl_easy_setopt(curl, CURLOPT_URL, request->url);
+    if (request->headers) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+    }
+    if (post_data) {
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->post_data);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)post_len);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+
+    // Same timeouts as the single-request paths
+    long timeout = (strcmp(command, "connect") == 0) ? CONNECT_TIMEOUT : DEFAULT_TIMEOUT;
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+
+    return request;
+}
+
+// Answer a GET from the response cache
+static int request_cache_fetch(LoquatRequest *request, ResponseData *buffer) {
+    LoquatCacheHit hit;
+    if (!loquat_cache_lookup(request->cache, request->base_url, request->unix_socket, request->command, &hit)) {
+        return 0;
+    }
+
+    int ok = loquat_response_reserve(buffer, hit.body_len + 1);
+    if (ok) {
+        memcpy(buffer->data, hit.body, hit.body_len);
+        buffer->data[hit.body_len] = '\0';
+        buffer->size = hit.body_len;
+    }
+    loquat_cache_release(&hit);
+    return ok;
+}
+
+// Send a prepared request, receiving the body into a reusable buffer
+int loquat_request_execute(LoquatRequest *request, ResponseData *buffer, int *http_code) {
+    if (!request || !buffer || !http_code) {
+        return 0;
+    }
+
+    // Reuse whatever capacity the buffer kept from earlier requests
+    buffer->size = 0;
+    buffer->curl = NULL;
+    if (buffer->data && buffer->capacity > 0) {
+        buffer->data[0] = '\0';
+    }
+
+    request->served_from_cache = 0;
+    if (request->cache && request_cache_fetch(request, buffer)) {
+        request->served_from_cache = 1;
+        *http_code = 200;
+        return 1;
+    }
+
+    if (request->target != buffer) {
+        curl_easy_setopt(request->curl, CURLOPT_WRITEDATA, buffer);
+        request->target = buffer;
+    }
+    buffer->curl = request->curl;
+
+    CURLcode res = curl_easy_perform(request->curl);
+    buffer->curl = NULL;
+
+    if (res != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        return 0;
+    }
+
+    // An empty body still yields a valid string
+    if (!buffer->data && !loquat_response_reserve(buffer, RESPONSE_INITIAL_CAPACITY)) {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        return 0;
+    }
+    if (buffer->size == 0) {
+        buffer->data[0] = '\0';
+    }
+
+    long response_code = 0;
+    curl_easy_getinfo(request->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+
+    if (request->cache && *http_code == 200) {
+        loquat_cache_store(request->cache, request->base_url, request->unix_socket, request->command,
+                           buffer->data, buffer->size);
+    }
+    return 1;
+}
+
+// Get the phase timings of the request's most recent execution
+int loquat_request_get_timing(LoquatRequest *request, LoquatTiming *timing) {
+    if (!request || !timing) {
+        return 0;
+    }
+    if (request->served_from_cache) {
+        memset(timing, 0, sizeof(*timing));
+        return 1;
+    }
+    loquat_timing_read(request->curl, timing);
+    return 1;
+}
+
+// Free a prepared request
+void loquat_request_free(LoquatRequest *request) {
+    if (request) {
+        if (request->curl) {
+            curl_easy_cleanup(request->curl);
+        }
+        curl_slist_free_all(request->headers);
+        free(request);
+        loquat_global_cleanup();
+    }
+}
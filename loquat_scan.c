@@ -0,0 +1,593 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Incremental parser for the get_scan_result body: a JSON array of access
+// point objects. Input is consumed one byte at a time so chunks can split
+// tokens anywhere; only the current object's ssid/bars/security/bssid are kept,
+// so memory use does not depend on the length of the array. The whole body
+// is checked against the JSON grammar as it goes, and fields are looked up
+// like cJSON_GetObjectItem() (first key wins, case ignored), so a body is
+// accepted and printed exactly as the extractor and cJSON paths would.
+
+enum {
+    SCAN_FIELD_NONE = 0,
+    SCAN_FIELD_SSID,
+    SCAN_FIELD_BARS,
+    SCAN_FIELD_SECURITY,
+    SCAN_FIELD_BSSID
+};
+
+enum {
+    SCAN_STRING_SKIP = 0,
+    SCAN_STRING_KEY,
+    SCAN_STRING_VALUE
+};
+
+// What the grammar allows next outside a string
+enum {
+    SCAN_EXPECT_VALUE = 0,
+    SCAN_EXPECT_VALUE_OR_CLOSE,      // After '['
+    SCAN_EXPECT_KEY,                 // After ',' in an object
+    SCAN_EXPECT_KEY_OR_CLOSE,        // After '{'
+    SCAN_EXPECT_COLON,
+    SCAN_EXPECT_COMMA_OR_CLOSE,
+    SCAN_EXPECT_END                  // Top-level array closed; only whitespace may follow
+};
+
+// Progress through a number or literal; the number states follow the
+// JSON number grammar, and those marked (*) may end the number
+enum {
+    SCAN_SCALAR_NONE = 0,
+    SCAN_NUMBER_MINUS,
+    SCAN_NUMBER_ZERO,                // (*)
+    SCAN_NUMBER_INT,                 // (*)
+    SCAN_NUMBER_DOT,
+    SCAN_NUMBER_FRACTION,            // (*)
+    SCAN_NUMBER_E,
+    SCAN_NUMBER_EXPONENT_SIGN,
+    SCAN_NUMBER_EXPONENT,            // (*)
+    SCAN_LITERAL                     // Literal bytes matched so far are in scalar_len
+};
+
+// Depth of the access point objects inside the top-level array
+#define SCAN_AP_DEPTH 2
+
+// Initialize a streaming scan result parser
+void loquat_scan_parser_init(LoquatScanParser *parser, loquat_scan_ap_cb callback, void *userdata) {
+    if (!parser) return;
+    memset(parser, 0, sizeof(*parser));
+    parser->callback = callback;
+    parser->userdata = userdata;
+}
+
+static int scan_top_is_object(const LoquatScanParser *parser) {
+    int i = parser->depth - 1;
+    return (parser->objects[i / 8] >> (i % 8)) & 1;
+}
+
+// Append one decoded byte to the string currently being captured
+static void scan_string_put(LoquatScanParser *parser, char c) {
+    char *dst;
+    size_t cap;
+
+    if (parser->string_role == SCAN_STRING_KEY) {
+        dst = parser->key;
+        cap = sizeof(parser->key);
+    } else if (parser->string_role == SCAN_STRING_VALUE && parser->field == SCAN_FIELD_SSID) {
+        dst = parser->ap.ssid;
+        cap = sizeof(parser->ap.ssid);
+    } else if (parser->string_role == SCAN_STRING_VALUE && parser->field == SCAN_FIELD_SECURITY) {
+        dst = parser->ap.security;
+        cap = sizeof(parser->ap.security);
+    } else if (parser->string_role == SCAN_STRING_VALUE && parser->field == SCAN_FIELD_BSSID) {
+        dst = parser->ap.bssid;
+        cap = sizeof(parser->ap.bssid);
+    } else {
+        return;
+    }
+
+    // Over-long strings are truncated; a truncated key never matches a field
+    if (parser->string_len + 1 < cap) {
+        dst[parser->string_len++] = c;
+        dst[parser->string_len] = '\0';
+    } else {
+        parser->string_truncated = 1;
+    }
+}
+
+// Append a decoded \u escape as UTF-8
+static void scan_string_put_codepoint(LoquatScanParser *parser, unsigned long cp) {
+    if (cp < 0x80) {
+        scan_string_put(parser, (char)cp);
+    } else if (cp < 0x800) {
+        scan_string_put(parser, (char)(0xC0 | (cp >> 6)));
+        scan_string_put(parser, (char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        scan_string_put(parser, (char)(0xE0 | (cp >> 12)));
+        scan_string_put(parser, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        scan_string_put(parser, (char)(0x80 | (cp & 0x3F)));
+    } else {
+        scan_string_put(parser, (char)(0xF0 | (cp >> 18)));
+        scan_string_put(parser, (char)(0x80 | ((cp >> 12) & 0x3F)));
+        scan_string_put(parser, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        scan_string_put(parser, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+static int scan_hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Field named by the key just read, if its first occurrence in the object
+static int scan_key_field(LoquatScanParser *parser) {
+    int field = SCAN_FIELD_NONE;
+    if (!parser->string_truncated) {
+        if (strcasecmp(parser->key, "ssid") == 0) field = SCAN_FIELD_SSID;
+        else if (strcasecmp(parser->key, "bars") == 0) field = SCAN_FIELD_BARS;
+        else if (strcasecmp(parser->key, "security") == 0) field = SCAN_FIELD_SECURITY;
+        else if (strcasecmp(parser->key, "bssid") == 0) field = SCAN_FIELD_BSSID;
+    }
+    if (field == SCAN_FIELD_NONE || (parser->seen & (1 << field))) {
+        return SCAN_FIELD_NONE;
+    }
+    parser->seen |= 1 << field;
+    return field;
+}
+
+// Handle the closing quote of a string
+static void scan_string_end(LoquatScanParser *parser) {
+    if (parser->string_role == SCAN_STRING_KEY) {
+        parser->field = scan_key_field(parser);
+    } else if (parser->string_role == SCAN_STRING_VALUE) {
+        if (parser->field == SCAN_FIELD_SSID) parser->has_ssid = 1;
+        if (parser->field == SCAN_FIELD_SECURITY) parser->has_security = 1;
+    }
+    parser->in_string = 0;
+}
+
+// Consume one byte inside a string literal
+static int scan_feed_string(LoquatScanParser *parser, char c) {
+    if (parser->unicode_digits > 0) {
+        int v = scan_hex_value(c);
+        if (v < 0) return 0;
+        parser->unicode = (parser->unicode << 4) | (unsigned long)v;
+        if (--parser->unicode_digits > 0) return 1;
+
+        // Surrogates must come in pairs, as cJSON requires
+        unsigned long cp = parser->unicode;
+        if (parser->high_surrogate) {
+            if (cp < 0xDC00 || cp > 0xDFFF) return 0;
+            cp = 0x10000 + ((parser->high_surrogate - 0xD800) << 10) + (cp - 0xDC00);
+            parser->high_surrogate = 0;
+        } else if (cp >= 0xD800 && cp <= 0xDBFF) {
+            parser->high_surrogate = cp;
+            return 1;
+        } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            return 0;
+        }
+        scan_string_put_codepoint(parser, cp);
+        return 1;
+    }
+
+    if (parser->escape) {
+        parser->escape = 0;
+        if (parser->high_surrogate && c != 'u') return 0;
+        switch (c) {
+            case '"':  scan_string_put(parser, '"'); break;
+            case '\\': scan_string_put(parser, '\\'); break;
+            case '/':  scan_string_put(parser, '/'); break;
+            case 'b':  scan_string_put(parser, '\b'); break;
+            case 'f':  scan_string_put(parser, '\f'); break;
+            case 'n':  scan_string_put(parser, '\n'); break;
+            case 'r':  scan_string_put(parser, '\r'); break;
+            case 't':  scan_string_put(parser, '\t'); break;
+            case 'u':
+                parser->unicode = 0;
+                parser->unicode_digits = 4;
+                break;
+            default:
+                return 0;
+        }
+        return 1;
+    }
+
+    // A high surrogate must be followed straight away by its low half
+    if (parser->high_surrogate && c != '\\') {
+        return 0;
+    }
+    if (c == '\\') {
+        parser->escape = 1;
+    } else if (c == '"') {
+        scan_string_end(parser);
+    } else {
+        scan_string_put(parser, c);
+    }
+    return 1;
+}
+
+// Finish a bars value collected from number characters
+static void scan_number_end(LoquatScanParser *parser) {
+    if (parser->number_len > 0) {
+        parser->number[parser->number_len] = '\0';
+        char *end = NULL;
+        double value = strtod(parser->number, &end);
+        if (end != parser->number) {
+            // Saturated like cJSON's valueint
+            parser->ap.bars = value >= 2147483647.0 ? 2147483647
+                            : value <= -2147483648.0 ? (-2147483647 - 1) : (int)value;
+            parser->has_bars = 1;
+        }
+        parser->number_len = 0;
+    }
+}
+
+// Start a number or literal on its first byte; 0 if c cannot start one
+static int scan_scalar_begin(LoquatScanParser *parser, char c) {
+    if (c == '-') {
+        parser->scalar = SCAN_NUMBER_MINUS;
+    } else if (c == '0') {
+        parser->scalar = SCAN_NUMBER_ZERO;
+    } else if (c >= '1' && c <= '9') {
+        parser->scalar = SCAN_NUMBER_INT;
+    } else {
+        parser->literal = c == 't' ? "true" : c == 'f' ? "false" : c == 'n' ? "null" : NULL;
+        if (!parser->literal) return 0;
+        parser->scalar = SCAN_LITERAL;
+        parser->scalar_len = 1;
+    }
+    return 1;
+}
+
+// Extend the number or literal being read; 0 if c does not belong to it
+static int scan_scalar_next(LoquatScanParser *parser, char c) {
+    int digit = (c >= '0' && c <= '9');
+    int next = SCAN_SCALAR_NONE;
+
+    switch (parser->scalar) {
+        case SCAN_LITERAL:
+            if (parser->literal[parser->scalar_len] != '\0' && parser->literal[parser->scalar_len] == c) {
+                parser->scalar_len++;
+                return 1;
+            }
+            return 0;
+        case SCAN_NUMBER_MINUS:
+            if (c == '0') next = SCAN_NUMBER_ZERO;
+            else if (digit) next = SCAN_NUMBER_INT;
+            break;
+        case SCAN_NUMBER_INT:
+            if (digit) next = SCAN_NUMBER_INT;
+            /* fall through */
+        case SCAN_NUMBER_ZERO:
+            if (c == '.') next = SCAN_NUMBER_DOT;
+            else if (c == 'e' || c == 'E') next = SCAN_NUMBER_E;
+            break;
+        case SCAN_NUMBER_DOT:
+        case SCAN_NUMBER_FRACTION:
+            if (digit) next = SCAN_NUMBER_FRACTION;
+            else if (parser->scalar == SCAN_NUMBER_FRACTION && (c == 'e' || c == 'E')) next = SCAN_NUMBER_E;
+            break;
+        case SCAN_NUMBER_E:
+            if (c == '+' || c == '-') next = SCAN_NUMBER_EXPONENT_SIGN;
+            else if (digit) next = SCAN_NUMBER_EXPONENT;
+            break;
+        case SCAN_NUMBER_EXPONENT_SIGN:
+        case SCAN_NUMBER_EXPONENT:
+            if (digit) next = SCAN_NUMBER_EXPONENT;
+            break;
+    }
+    if (next == SCAN_SCALAR_NONE) {
+        return 0;
+    }
+    parser->scalar = next;
+    return 1;
+}
+
+// End the number or literal at a delimiter; 0 if it was cut short
+static int scan_scalar_end(LoquatScanParser *parser) {
+    int complete;
+    if (parser->scalar == SCAN_LITERAL) {
+        complete = parser->literal[parser->scalar_len] == '\0';
+    } else {
+        complete = parser->scalar == SCAN_NUMBER_ZERO || parser->scalar == SCAN_NUMBER_INT ||
+                   parser->scalar == SCAN_NUMBER_FRACTION || parser->scalar == SCAN_NUMBER_EXPONENT;
+    }
+    parser->scalar = SCAN_SCALAR_NONE;
+    scan_number_end(parser);
+    return complete;
+}
+
+// Keep the bytes of a bars number for scan_number_end()
+static void scan_number_put(LoquatScanParser *parser, char c) {
+    if (parser->depth == SCAN_AP_DEPTH && parser->in_object && parser->field == SCAN_FIELD_BARS &&
+        parser->scalar != SCAN_LITERAL && parser->number_len + 1 < sizeof(parser->number)) {
+        parser->number[parser->number_len++] = c;
+    }
+}
+
+// Hand a completed access point to the callback
+static void scan_emit(LoquatScanParser *parser) {
+    if (!parser->has_ssid) strcpy(parser->ap.ssid, "Unknown");
+    if (!parser->has_bars) parser->ap.bars = 0;
+    if (!parser->has_security) strcpy(parser->ap.security, "Unknown");
+    parser->count++;
+    if (parser->callback) {
+        parser->callback(&parser->ap, parser->userdata);
+    }
+}
+
+// Consume one byte outside any string literal
+static int scan_feed_structure(LoquatScanParser *parser, char c) {
+    if (parser->scalar) {
+        if (scan_scalar_next(parser, c)) {
+            scan_number_put(parser, c);
+            return 1;
+        }
+        // Anything else ends the number or literal and is read as a token
+        if (!scan_scalar_end(parser)) return 0;
+    }
+
+    int in_ap = (parser->depth == SCAN_AP_DEPTH && parser->in_object);
+    int expect = parser->expect;
+    int value_ok = (expect == SCAN_EXPECT_VALUE || expect == SCAN_EXPECT_VALUE_OR_CLOSE);
+
+    switch (c) {
+        case ' ': case '\t': case '\r': case '\n':
+            return 1;
+
+        case '[':
+        case '{':
+            if (!value_ok) return 0;
+            if (parser->depth == 0 && c != '[') return 0;
+            if (parser->depth == LOQUAT_SCAN_MAX_DEPTH) return 0;
+            if (c == '{') {
+                parser->objects[parser->depth / 8] |= (unsigned char)(1 << (parser->depth % 8));
+            } else {
+                parser->objects[parser->depth / 8] &= (unsigned char)~(1 << (parser->depth % 8));
+            }
+            parser->depth++;
+            parser->expect = (c == '{') ? SCAN_EXPECT_KEY_OR_CLOSE : SCAN_EXPECT_VALUE_OR_CLOSE;
+            if (parser->depth == SCAN_AP_DEPTH) {
+                // Non-object array elements are skipped, as in print_scan_result
+                parser->in_object = (c == '{');
+                parser->field = SCAN_FIELD_NONE;
+                parser->seen = 0;
+                parser->has_ssid = parser->has_bars = parser->has_security = 0;
+                parser->ap.ssid[0] = '\0';
+                parser->ap.security[0] = '\0';
+                parser->ap.bssid[0] = '\0';
+                parser->number_len = 0;
+            }
+            return 1;
+
+        case ']':
+        case '}':
+            if (parser->depth == 0) return 0;
+            // The bracket must close the innermost container, after a value
+            // or straight after it was opened
+            if (scan_top_is_object(parser) != (c == '}')) return 0;
+            if (expect != SCAN_EXPECT_COMMA_OR_CLOSE &&
+                expect != (c == '}' ? SCAN_EXPECT_KEY_OR_CLOSE : SCAN_EXPECT_VALUE_OR_CLOSE)) {
+                return 0;
+            }
+            if (in_ap) {
+                scan_emit(parser);
+                parser->in_object = 0;
+            }
+            parser->depth--;
+            parser->expect = parser->depth == 0 ? SCAN_EXPECT_END : SCAN_EXPECT_COMMA_OR_CLOSE;
+            return 1;
+
+        case '"':
+            if (parser->depth == 0) return 0;
+            parser->in_string = 1;
+            parser->string_len = 0;
+            parser->string_truncated = 0;
+            parser->high_surrogate = 0;
+            if (expect == SCAN_EXPECT_KEY || expect == SCAN_EXPECT_KEY_OR_CLOSE) {
+                parser->string_role = in_ap ? SCAN_STRING_KEY : SCAN_STRING_SKIP;
+                parser->key[0] = '\0';
+                parser->expect = SCAN_EXPECT_COLON;
+            } else if (value_ok) {
+                if (in_ap && (parser->field == SCAN_FIELD_SSID || parser->field == SCAN_FIELD_SECURITY ||
+                              parser->field == SCAN_FIELD_BSSID)) {
+                    parser->string_role = SCAN_STRING_VALUE;
+                    if (parser->field == SCAN_FIELD_SSID) parser->ap.ssid[0] = '\0';
+                    else if (parser->field == SCAN_FIELD_SECURITY) parser->ap.security[0] = '\0';
+                    else parser->ap.bssid[0] = '\0';
+                } else {
+                    parser->string_role = SCAN_STRING_SKIP;
+                }
+                parser->expect = SCAN_EXPECT_COMMA_OR_CLOSE;
+            } else {
+                return 0;
+            }
+            return 1;
+
+        case ':':
+            if (expect != SCAN_EXPECT_COLON) return 0;
+            parser->expect = SCAN_EXPECT_VALUE;
+            return 1;
+
+        case ',':
+            if (expect != SCAN_EXPECT_COMMA_OR_CLOSE) return 0;
+            parser->expect = scan_top_is_object(parser) ? SCAN_EXPECT_KEY : SCAN_EXPECT_VALUE;
+            if (in_ap) parser->field = SCAN_FIELD_NONE;
+            return 1;
+
+        default:
+            // Numbers and literals; only bars is kept
+            if (!value_ok || parser->depth == 0 || !scan_scalar_begin(parser, c)) return 0;
+            parser->expect = SCAN_EXPECT_COMMA_OR_CLOSE;
+            scan_number_put(parser, c);
+            return 1;
+    }
+}
+
+// Feed a chunk of the response body to the parser
+int loquat_scan_parser_feed(LoquatScanParser *parser, const char *data, size_t len) {
+    if (!parser || parser->error) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        if (parser->in_string && !parser->escape && !parser->unicode_digits && !parser->high_surrogate) {
+            // Plain string bytes up to the next quote or backslash need no state
+            size_t run = i;
+            while (run < len && data[run] != '"' && data[run] != '\\') run++;
+            if (parser->string_role != SCAN_STRING_SKIP) {
+                for (size_t j = i; j < run; j++) scan_string_put(parser, data[j]);
+            }
+            i = run;
+            if (i == len) break;
+        }
+        int ok = parser->in_string ? scan_feed_string(parser, data[i])
+                                   : scan_feed_structure(parser, data[i]);
+        if (!ok) {
+            parser->error = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Check that the body ended with a complete, well-formed array
+int loquat_scan_parser_finish(LoquatScanParser *parser) {
+    if (!parser || parser->error || parser->expect != SCAN_EXPECT_END) {
+        return 0;
+    }
+    return 1;
+}
+
+// A streamed scan request: the parser, plus a copy of the body when it
+// is going into the response cache
+typedef struct {
+    LoquatScanParser parser;
+    ResponseData body;
+    int keep_body;
+} ScanTransfer;
+
+// Write callback that feeds successful responses straight into the parser
+static size_t scan_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    ScanTransfer *transfer = userp;
+    LoquatScanParser *parser = &transfer->parser;
+    size_t realsize = size * nmemb;
+
+    long code = 0;
+    curl_easy_getinfo(parser->curl, CURLINFO_RESPONSE_CODE, &code);
+    if (code != 200) {
+        // Error bodies are not scan results; drop them
+        return realsize;
+    }
+
+    // Keep receiving on malformed input so the HTTP code is still reported;
+    // the error flag makes loquat_scan_parser_finish() fail
+    loquat_scan_parser_feed(parser, contents, realsize);
+
+    // Stop copying (but keep parsing) if the cache copy cannot grow
+    if (transfer->keep_body && loquat_write_callback(contents, size, nmemb, &transfer->body) != realsize) {
+        transfer->keep_body = 0;
+    }
+    return realsize;
+}
+
+// Make a get_scan_result request, reporting access points as they arrive
+int loquat_client_get_scan_stream(LoquatClient *client, loquat_scan_ap_cb callback, void *userdata,
+                                  int *http_code) {
+    if (!client || !client->curl || !callback || !http_code) {
+        return 0;
+    }
+
+    const char *command = "get_scan_result";
+
+    // A fresh cached scan is parsed straight from the mapped entry
+    client->cache_age = -1.0;
+    if (client->cache) {
+        LoquatCacheHit hit;
+        if (loquat_cache_lookup(client->cache, client->base_url, client->unix_socket, command, &hit)) {
+            LoquatScanParser parser;
+            loquat_scan_parser_init(&parser, callback, userdata);
+            loquat_scan_parser_feed(&parser, hit.body, hit.body_len);
+            int ok = loquat_scan_parser_finish(&parser);
+            client->cache_age = hit.age;
+            loquat_cache_release(&hit);
+            if (!ok) {
+                fprintf(stderr, "Failed to parse JSON response\n");
+                return 0;
+            }
+            *http_code = 200;
+            return 1;
+        }
+    }
+
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", command);
+    if (!url) {
+        return 0;
+    }
+
+    ScanTransfer transfer;
+    memset(&transfer, 0, sizeof(transfer));
+    loquat_scan_parser_init(&transfer.parser, callback, userdata);
+    transfer.parser.curl = client->curl;
+    transfer.body.curl = client->curl;
+    transfer.keep_body = (client->cache != NULL);
+
+    // Reset curl handle for new request
+    curl_easy_reset(client->curl);
+
+    loquat_client_setup_transfer(client, client->curl);
+
+    // Set the URL
+    curl_easy_setopt(client->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
+
+    // Parse the body as it is received instead of buffering it
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, scan_write_callback);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &transfer);
+
+    // Set timeout
+    curl_easy_setopt(client->curl, CURLOPT_TIMEOUT, (long)DEFAULT_TIMEOUT);
+
+    // Follow redirects
+    curl_easy_setopt(client->curl, CURLOPT_FOLLOWLOCATION, 1L);
+
+    // Set user agent
+    curl_easy_setopt(client->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+
+    // Perform the request
+    CURLcode res = curl_easy_perform(client->curl);
+
+    if (res != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        free(transfer.body.data);
+        return 0;
+    }
+
+    // Get HTTP response code
+    long response_code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+
+    if (*http_code == 200 && !loquat_scan_parser_finish(&transfer.parser)) {
+        fprintf(stderr, "Failed to parse JSON response\n");
+        free(transfer.body.data);
+        return 0;
+    }
+
+    // Only complete, well-formed scans go into the cache
+    if (*http_code == 200 && transfer.keep_body) {
+        loquat_cache_store(client->cache, client->base_url, client->unix_socket, command,
+                           transfer.body.data ? transfer.body.data : "", transfer.body.size);
+    }
+    free(transfer.body.data);
+
+    return 1;
+}
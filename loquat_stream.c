@@ -0,0 +1,128 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Raw output: response bodies go from libcurl's receive buffer straight to
+// a file descriptor, one write(2) per chunk, without being collected in a
+// ResponseData first. Memory use is fixed by the receive buffer size and
+// the consumer sees the first bytes as soon as they arrive.
+
+#define STREAM_BUFFER_SIZE (256 * 1024)   // libcurl receive buffer, i.e. largest write
+
+typedef struct {
+    int fd;
+    int write_errno;     // errno of the failed write, 0 if none
+} StreamOutput;
+
+// Write all of data to fd, retrying short and interrupted writes
+static int stream_write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Forward each received chunk to the output descriptor
+static size_t stream_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    StreamOutput *out = (StreamOutput *)userp;
+    size_t len = size * nmemb;
+    if (!stream_write_all(out->fd, contents, len)) {
+        out->write_errno = errno;
+        return 0;   // Aborts the transfer with CURLE_WRITE_ERROR
+    }
+    return len;
+}
+
+// Send a request and stream its body to fd as it arrives
+int loquat_client_stream(LoquatClient *client, const char *command, const char *post_data,
+                         int fd, int *http_code) {
+    if (!client || !client->curl || !command || fd < 0 || !http_code) {
+        return 0;
+    }
+    client->cache_age = -1.0;
+
+    // A fresh cached GET response is written from the mapped entry
+    LoquatCacheHit hit;
+    if (!post_data && client->cache &&
+        loquat_cache_lookup(client->cache, client->base_url, client->unix_socket, command, &hit)) {
+        int ok = stream_write_all(fd, hit.body, hit.body_len);
+        if (!ok) {
+            fprintf(stderr, "Write failed: %s\n", strerror(errno));
+        } else {
+            client->cache_age = hit.age;
+            *http_code = 200;
+        }
+        loquat_cache_release(&hit);
+        return ok;
+    }
+
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", command);
+    if (!url) {
+        return 0;
+    }
+
+    StreamOutput out = { fd, 0 };
+
+    // Reset curl handle for new request
+    curl_easy_reset(client->curl);
+
+    loquat_client_setup_transfer(client, client->curl);
+
+    // Set the URL
+    curl_easy_setopt(client->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
+
+    if (post_data) {
+        curl_easy_setopt(client->curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(client->curl, CURLOPT_POSTFIELDS, post_data);
+        curl_easy_setopt(client->curl, CURLOPT_POSTFIELDSIZE, (long)strlen(post_data));
+    }
+
+    // Hand every chunk to the output as is, in large pieces
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, stream_write_callback);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &out);
+    curl_easy_setopt(client->curl, CURLOPT_BUFFERSIZE, (long)STREAM_BUFFER_SIZE);
+
+    // Set timeout - longer for connect command
+    long timeout = (strcmp(command, "connect") == 0) ? CONNECT_TIMEOUT : DEFAULT_TIMEOUT;
+    curl_easy_setopt(client->curl, CURLOPT_TIMEOUT, timeout);
+
+    // Follow redirects
+    curl_easy_setopt(client->curl, CURLOPT_FOLLOWLOCATION, 1L);
+
+    // Set user agent
+    curl_easy_setopt(client->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+
+    // Perform the request
+    CURLcode res = curl_easy_perform(client->curl);
+
+    if (res != CURLE_OK) {
+        if (out.write_errno) {
+            fprintf(stderr, "Write failed: %s\n", strerror(out.write_errno));
+        } else {
+            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        }
+        return 0;
+    }
+
+    // Get HTTP response code
+    long response_code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+
+    return 1;
+}
@@ -0,0 +1,321 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Push subscriptions. A GET is held open and its body parsed line by line
+// as chunks arrive: as server-sent events when the device sends
+// text/event-stream, otherwise as newline-delimited JSON (one event per
+// non-empty line, the last one with or without its newline). Each event goes to the callback as soon as its last
+// line is in; only the line and event being assembled are buffered.
+//
+// When the stream ends or drops, the subscription reconnects after the
+// delay set by the server's "retry:" field (1 s by default), sending
+// Last-Event-ID so the device can replay what was missed. Consecutive
+// attempts that deliver no event back off, doubling up to 30 s.
+
+#define SUBSCRIBE_RETRY_DELAY 1.0        // Seconds before reconnecting, unless the server sets one
+#define SUBSCRIBE_MAX_DELAY 30.0
+#define SUBSCRIBE_MAX_FAILURES 10        // Attempts in a row without an event before giving up
+#define SUBSCRIBE_MAX_EVENT (1024 * 1024)
+#define SUBSCRIBE_KEEPALIVE 30L          // TCP keepalive idle time, to notice a vanished device
+
+typedef struct {
+    loquat_event_cb callback;
+    void *userdata;
+    CURL *curl;
+    int checked;                 // Response code and content type looked at
+    int sse;                     // text/event-stream rather than NDJSON
+    int skip_lf;                 // Last line ended in CR; a following LF belongs to it
+    ResponseData line;           // Line being assembled
+    ResponseData data;           // SSE data lines of the event being assembled
+    char event[LOQUAT_EVENT_NAME_MAX + 1];
+    char id[LOQUAT_EVENT_ID_MAX + 1];        // Last event ID, kept across reconnects
+    char pending_id[LOQUAT_EVENT_ID_MAX + 1];
+    int has_pending_id;
+    double retry;                // Reconnect delay in seconds
+    unsigned long events;        // Delivered on this connection
+    int stopped;                 // The callback asked to stop
+    int too_large;
+} Subscription;
+
+// Append len bytes to a growing buffer, keeping it NUL-terminated
+static int subscribe_append(Subscription *sub, ResponseData *buf, const char *data, size_t len) {
+    if (buf->size + len > SUBSCRIBE_MAX_EVENT) {
+        sub->too_large = 1;
+        return 0;
+    }
+    if (buf->size + len + 1 > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 256;
+        while (capacity < buf->size + len + 1) capacity *= 2;
+        if (!loquat_response_reserve(buf, capacity)) {
+            return 0;
+        }
+    }
+    memcpy(buf->data + buf->size, data, len);
+    buf->size += len;
+    buf->data[buf->size] = '\0';
+    return 1;
+}
+
+static void subscribe_dispatch(Subscription *sub, const char *event, const char *data, size_t len) {
+    LoquatEvent ev;
+    ev.id = sub->id;
+    ev.event = event;
+    ev.data = data;
+    ev.data_len = len;
+    sub->events++;
+    if (!sub->callback(&ev, sub->userdata)) {
+        sub->stopped = 1;
+    }
+}
+
+// Copy at most size - 1 bytes of a field value and terminate it
+static void subscribe_copy(char *dst, size_t size, const char *value, size_t len) {
+    if (len > size - 1) len = size - 1;
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+}
+
+// Handle one complete SSE line (without its line ending)
+static void subscribe_sse_line(Subscription *sub, const char *line, size_t len) {
+    if (len == 0) {
+        // Blank line: the event is complete. Its ID stands even without data
+        if (sub->has_pending_id) {
+            memcpy(sub->id, sub->pending_id, sizeof(sub->id));
+            sub->has_pending_id = 0;
+        }
+        if (sub->data.size > 0) {
+            // The last data line's newline is not part of the data
+            sub->data.data[--sub->data.size] = '\0';
+            subscribe_dispatch(sub, sub->event[0] ? sub->event : "message", sub->data.data, sub->data.size);
+        }
+        sub->data.size = 0;
+        sub->event[0] = '\0';
+        return;
+    }
+    if (line[0] == ':') {
+        return;   // Comment, often a keepalive
+    }
+
+    const char *colon = memchr(line, ':', len);
+    size_t name_len = colon ? (size_t)(colon - line) : len;
+    const char *value = colon ? colon + 1 : line + len;
+    size_t value_len = colon ? len - name_len - 1 : 0;
+    if (value_len > 0 && *value == ' ') {
+        value++;
+        value_len--;
+    }
+
+    if (name_len == 4 && memcmp(line, "data", 4) == 0) {
+        if (subscribe_append(sub, &sub->data, value, value_len)) {
+            subscribe_append(sub, &sub->data, "\n", 1);
+        }
+    } else if (name_len == 5 && memcmp(line, "event", 5) == 0) {
+        subscribe_copy(sub->event, sizeof(sub->event), value, value_len);
+    } else if (name_len == 2 && memcmp(line, "id", 2) == 0) {
+        if (!memchr(value, '\0', value_len)) {
+            subscribe_copy(sub->pending_id, sizeof(sub->pending_id), value, value_len);
+            sub->has_pending_id = 1;
+        }
+    } else if (name_len == 5 && memcmp(line, "retry", 5) == 0) {
+        long ms = 0;
+        size_t i = 0;
+        for (; i < value_len && value[i] >= '0' && value[i] <= '9' && ms < 3600000; i++) {
+            ms = ms * 10 + (value[i] - '0');
+        }
+        if (i == value_len && value_len > 0) {
+            sub->retry = (double)ms / 1000.0;
+        }
+    }
+}
+
+static void subscribe_line(Subscription *sub, const char *line, size_t len) {
+    if (sub->sse) {
+        subscribe_sse_line(sub, line, len);
+    } else if (len > 0) {
+        // Copied so the event is NUL-terminated like an SSE one
+        sub->data.size = 0;
+        if (subscribe_append(sub, &sub->data, line, len)) {
+            subscribe_dispatch(sub, "", sub->data.data, sub->data.size);
+        }
+    }
+}
+
+// Split each chunk into lines as it arrives. A line wholly inside the
+// chunk is parsed in place; only one cut by the chunk's end is copied
+static size_t subscribe_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    Subscription *sub = userp;
+    size_t realsize = size * nmemb;
+    const char *p = contents;
+    const char *end = p + realsize;
+
+    if (!sub->checked) {
+        long code = 0;
+        curl_easy_getinfo(sub->curl, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 200) {
+            return realsize;   // An error body; the caller reports the code
+        }
+        char *type = NULL;
+        curl_easy_getinfo(sub->curl, CURLINFO_CONTENT_TYPE, &type);
+        sub->sse = type && strncasecmp(type, "text/event-stream", 17) == 0;
+        sub->checked = 1;
+    }
+
+    while (p < end && !sub->stopped) {
+        if (sub->skip_lf) {
+            sub->skip_lf = 0;
+            if (*p == '\n') {
+                p++;
+                continue;
+            }
+        }
+
+        const char *eol = p;
+        while (eol < end && *eol != '\n' && *eol != '\r') eol++;
+        if (eol == end) {
+            // Partial line: keep it for the next chunk
+            if (!subscribe_append(sub, &sub->line, p, (size_t)(end - p))) {
+                return 0;
+            }
+            break;
+        }
+
+        if (sub->line.size > 0) {
+            if (!subscribe_append(sub, &sub->line, p, (size_t)(eol - p))) {
+                return 0;
+            }
+            subscribe_line(sub, sub->line.data, sub->line.size);
+            sub->line.size = 0;
+        } else {
+            subscribe_line(sub, p, (size_t)(eol - p));
+        }
+        if (sub->too_large) {
+            return 0;
+        }
+        sub->skip_lf = (*eol == '\r');
+        p = eol + 1;
+    }
+
+    // Returning short aborts the transfer when the callback is done
+    return sub->stopped ? 0 : realsize;
+}
+
+// Stream events from endpoint until the callback returns 0
+int loquat_client_subscribe(LoquatClient *client, const char *endpoint, loquat_event_cb callback,
+                            void *userdata, int *http_code) {
+    if (!client || !client->curl || !endpoint || !callback || !http_code) {
+        return 0;
+    }
+    client->cache_age = -1.0;
+
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", endpoint);
+    if (!url) {
+        return 0;
+    }
+
+    Subscription sub;
+    memset(&sub, 0, sizeof(sub));
+    sub.callback = callback;
+    sub.userdata = userdata;
+    sub.curl = client->curl;
+    sub.retry = SUBSCRIBE_RETRY_DELAY;
+
+    int ok = 0;
+    int failures = 0;
+    for (;;) {
+        sub.checked = 0;
+        sub.skip_lf = 0;
+        sub.line.size = 0;
+        sub.data.size = 0;
+        sub.event[0] = '\0';
+        sub.has_pending_id = 0;
+        sub.events = 0;
+
+        struct curl_slist *headers = curl_slist_append(NULL, "Accept: text/event-stream, application/x-ndjson");
+        if (headers && sub.id[0]) {
+            char header[LOQUAT_EVENT_ID_MAX + 32];
+            snprintf(header, sizeof(header), "Last-Event-ID: %s", sub.id);
+            struct curl_slist *list = curl_slist_append(headers, header);
+            if (list) headers = list;
+        }
+
+        curl_easy_reset(client->curl);
+        loquat_client_setup_transfer(client, client->curl);
+        curl_easy_setopt(client->curl, CURLOPT_URL, url);
+        curl_easy_setopt(client->curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, subscribe_write_callback);
+        curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &sub);
+        curl_easy_setopt(client->curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(client->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+        // The stream stays open as long as the device likes; only the
+        // connect is timed, and keepalive probes notice a dead peer
+        curl_easy_setopt(client->curl, CURLOPT_CONNECTTIMEOUT, (long)DEFAULT_TIMEOUT);
+        curl_easy_setopt(client->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(client->curl, CURLOPT_TCP_KEEPIDLE, SUBSCRIBE_KEEPALIVE);
+        curl_easy_setopt(client->curl, CURLOPT_TCP_KEEPINTVL, SUBSCRIBE_KEEPALIVE);
+
+        CURLcode res = curl_easy_perform(client->curl);
+        curl_slist_free_all(headers);
+
+        // A stream that ends cleanly may leave its last NDJSON event
+        // without a newline. An unfinished SSE event is dropped, as the
+        // format requires
+        if (res == CURLE_OK && sub.checked && !sub.sse && sub.line.size > 0) {
+            subscribe_line(&sub, sub.line.data, sub.line.size);
+            sub.line.size = 0;
+        }
+
+        long code = 0;
+        curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &code);
+        *http_code = (int)code;
+
+        if (sub.stopped) {
+            ok = 1;
+            break;
+        }
+        if (sub.too_large) {
+            fprintf(stderr, "Event exceeds %d bytes\n", SUBSCRIBE_MAX_EVENT);
+            break;
+        }
+        if (res == CURLE_OK && code != 200) {
+            // Refused, or 204: the device wants no more reconnects
+            ok = 1;
+            break;
+        }
+
+        failures = sub.events > 0 ? 0 : failures + 1;
+        if (failures >= SUBSCRIBE_MAX_FAILURES) {
+            fprintf(stderr, "Giving up after %d attempts without an event\n", failures);
+            break;
+        }
+
+        double delay = sub.retry;
+        for (int i = 1; i < failures && delay < SUBSCRIBE_MAX_DELAY; i++) {
+            delay *= 2;
+        }
+        if (delay > SUBSCRIBE_MAX_DELAY) delay = SUBSCRIBE_MAX_DELAY;
+        if (res == CURLE_OK) {
+            fprintf(stderr, "Stream ended; reconnecting in %.1f s\n", delay);
+        } else {
+            fprintf(stderr, "Stream dropped (%s); reconnecting in %.1f s\n", curl_easy_strerror(res), delay);
+        }
+
+        struct timespec ts;
+        ts.tv_sec = (time_t)delay;
+        ts.tv_nsec = (long)((delay - (double)ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    }
+
+    loquat_response_data_free(&sub.line);
+    loquat_response_data_free(&sub.data);
+    loquat_url_release(url, url_buf);
+    return ok;
+}
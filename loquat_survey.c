@@ -0,0 +1,296 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Site survey: access points reported by many devices merged into one
+// entry per SSID (and BSSID, when reported). Entries live in one flat
+// array; the open-addressing table holds only hashes and entry numbers, so
+// probing stays within a few cache lines. Each sighting of an access point
+// by a device is a pair of integers in another flat array, turned into
+// per-entry device lists by two counting sorts when the report is made.
+
+#define SURVEY_INITIAL_SLOTS 256
+#define SURVEY_INITIAL_ENTRIES 128
+
+typedef struct {
+    unsigned long hash;
+    size_t entry;                // Entry number + 1; 0 if the slot is free
+} SurveySlot;
+
+typedef struct {
+    LoquatAccessPoint ap;        // As first reported (BSSID lowercased)
+    unsigned long hash;
+    int best_bars;
+    int worst_bars;
+    long bars_sum;
+    unsigned long observations;
+    int last_device;             // Device whose scan last reported it
+} SurveyEntry;
+
+typedef struct {
+    int entry;
+    int device;
+} SurveySighting;
+
+struct LoquatSurvey {
+    SurveySlot *slots;
+    size_t slot_count;           // Always a power of two
+    SurveyEntry *entries;
+    size_t entry_count;
+    size_t entry_capacity;
+    SurveySighting *sightings;
+    size_t sighting_count;
+    size_t sighting_capacity;
+    int device_limit;            // Highest device index seen + 1
+};
+
+// FNV-1a over the SSID, a separator and the lowercased BSSID
+static unsigned long survey_hash(const char *ssid, const char *bssid) {
+    unsigned long hash = 2166136261UL;
+    for (const char *p = ssid; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 16777619UL;
+    }
+    hash ^= 0xFF;
+    hash *= 16777619UL;
+    for (const char *p = bssid; *p; p++) {
+        hash ^= (unsigned char)tolower((unsigned char)*p);
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
+// Create an empty survey
+LoquatSurvey* loquat_survey_init(void) {
+    LoquatSurvey *survey = calloc(1, sizeof(LoquatSurvey));
+    if (!survey) {
+        fprintf(stderr, "Failed to allocate memory for survey\n");
+        return NULL;
+    }
+
+    survey->slots = calloc(SURVEY_INITIAL_SLOTS, sizeof(SurveySlot));
+    survey->entries = malloc(SURVEY_INITIAL_ENTRIES * sizeof(SurveyEntry));
+    if (!survey->slots || !survey->entries) {
+        fprintf(stderr, "Failed to allocate memory for survey\n");
+        loquat_survey_cleanup(survey);
+        return NULL;
+    }
+    survey->slot_count = SURVEY_INITIAL_SLOTS;
+    survey->entry_capacity = SURVEY_INITIAL_ENTRIES;
+    return survey;
+}
+
+// Free a survey
+void loquat_survey_cleanup(LoquatSurvey *survey) {
+    if (survey) {
+        free(survey->slots);
+        free(survey->entries);
+        free(survey->sightings);
+        free(survey);
+    }
+}
+
+// Double the table, keeping load factor at or below one half
+static int survey_grow_slots(LoquatSurvey *survey) {
+    size_t count = survey->slot_count * 2;
+    SurveySlot *slots = calloc(count, sizeof(SurveySlot));
+    if (!slots) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < survey->slot_count; i++) {
+        if (!survey->slots[i].entry) continue;
+        size_t pos = survey->slots[i].hash & (count - 1);
+        while (slots[pos].entry) {
+            pos = (pos + 1) & (count - 1);
+        }
+        slots[pos] = survey->slots[i];
+    }
+
+    free(survey->slots);
+    survey->slots = slots;
+    survey->slot_count = count;
+    return 1;
+}
+
+// Grow a flat array to hold at least one more element
+static int survey_reserve(void **items, size_t *capacity, size_t count, size_t item_size) {
+    if (count < *capacity) {
+        return 1;
+    }
+    size_t grown = *capacity ? *capacity * 2 : SURVEY_INITIAL_ENTRIES;
+    void *p = realloc(*items, grown * item_size);
+    if (!p) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 0;
+    }
+    *items = p;
+    *capacity = grown;
+    return 1;
+}
+
+// Find the entry for ssid/bssid, adding a slot for a new one
+static SurveyEntry* survey_lookup(LoquatSurvey *survey, const LoquatAccessPoint *ap) {
+    if ((survey->entry_count + 1) * 2 > survey->slot_count && !survey_grow_slots(survey)) {
+        return NULL;
+    }
+
+    unsigned long hash = survey_hash(ap->ssid, ap->bssid);
+    size_t mask = survey->slot_count - 1;
+    size_t pos = hash & mask;
+    while (survey->slots[pos].entry) {
+        if (survey->slots[pos].hash == hash) {
+            SurveyEntry *entry = &survey->entries[survey->slots[pos].entry - 1];
+            if (strcmp(entry->ap.ssid, ap->ssid) == 0 && strcasecmp(entry->ap.bssid, ap->bssid) == 0) {
+                return entry;
+            }
+        }
+        pos = (pos + 1) & mask;
+    }
+
+    if (!survey_reserve((void **)&survey->entries, &survey->entry_capacity,
+                        survey->entry_count, sizeof(SurveyEntry))) {
+        return NULL;
+    }
+
+    SurveyEntry *entry = &survey->entries[survey->entry_count++];
+    entry->ap = *ap;
+    for (char *p = entry->ap.bssid; *p; p++) {
+        *p = (char)tolower((unsigned char)*p);
+    }
+    entry->hash = hash;
+    entry->best_bars = ap->bars;
+    entry->worst_bars = ap->bars;
+    entry->bars_sum = 0;
+    entry->observations = 0;
+    entry->last_device = -1;
+    survey->slots[pos].hash = hash;
+    survey->slots[pos].entry = survey->entry_count;
+    return entry;
+}
+
+// Record one access point seen by a device
+int loquat_survey_add(LoquatSurvey *survey, int device, const LoquatAccessPoint *ap) {
+    if (!survey || !ap || device < 0) {
+        return 0;
+    }
+
+    SurveyEntry *entry = survey_lookup(survey, ap);
+    if (!entry) {
+        return 0;
+    }
+
+    if (ap->bars > entry->best_bars) entry->best_bars = ap->bars;
+    if (ap->bars < entry->worst_bars) entry->worst_bars = ap->bars;
+    entry->bars_sum += ap->bars;
+    entry->observations++;
+
+    // A device listing the same access point twice counts as one sighting
+    if (entry->last_device != device) {
+        if (!survey_reserve((void **)&survey->sightings, &survey->sighting_capacity,
+                            survey->sighting_count, sizeof(SurveySighting))) {
+            return 0;
+        }
+        SurveySighting *sighting = &survey->sightings[survey->sighting_count++];
+        sighting->entry = (int)(entry - survey->entries);
+        sighting->device = device;
+        entry->last_device = device;
+        if (device >= survey->device_limit) {
+            survey->device_limit = device + 1;
+        }
+    }
+    return 1;
+}
+
+// Number of distinct access points recorded
+size_t loquat_survey_size(const LoquatSurvey *survey) {
+    return survey ? survey->entry_count : 0;
+}
+
+static int survey_compare(const void *a, const void *b) {
+    const SurveyEntry *x = *(const SurveyEntry *const *)a;
+    const SurveyEntry *y = *(const SurveyEntry *const *)b;
+    int c = strcmp(x->ap.ssid, y->ap.ssid);
+    return c ? c : strcmp(x->ap.bssid, y->ap.bssid);
+}
+
+// Report every access point, ordered by SSID then BSSID
+int loquat_survey_report(LoquatSurvey *survey, loquat_survey_ap_cb callback, void *userdata) {
+    if (!survey || !callback) {
+        return 0;
+    }
+
+    size_t entries = survey->entry_count;
+    size_t sightings = survey->sighting_count;
+    size_t devices = (size_t)survey->device_limit;
+
+    SurveyEntry **order = malloc((entries ? entries : 1) * sizeof(SurveyEntry *));
+    size_t *offsets = calloc(entries + 1, sizeof(size_t));
+    size_t *device_offsets = calloc(devices + 1, sizeof(size_t));
+    SurveySighting *by_device = malloc((sightings ? sightings : 1) * sizeof(SurveySighting));
+    int *device_lists = malloc((sightings ? sightings : 1) * sizeof(int));
+    if (!order || !offsets || !device_offsets || !by_device || !device_lists) {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(order);
+        free(offsets);
+        free(device_offsets);
+        free(by_device);
+        free(device_lists);
+        return 0;
+    }
+
+    // Order sightings by device, then distribute them to their entries;
+    // both passes are stable, so every entry's device list comes out sorted
+    for (size_t i = 0; i < sightings; i++) {
+        device_offsets[survey->sightings[i].device + 1]++;
+        offsets[survey->sightings[i].entry + 1]++;
+    }
+    for (size_t d = 0; d < devices; d++) {
+        device_offsets[d + 1] += device_offsets[d];
+    }
+    for (size_t e = 0; e < entries; e++) {
+        offsets[e + 1] += offsets[e];
+    }
+    for (size_t i = 0; i < sightings; i++) {
+        by_device[device_offsets[survey->sightings[i].device]++] = survey->sightings[i];
+    }
+    for (size_t i = 0; i < sightings; i++) {
+        device_lists[offsets[by_device[i].entry]++] = by_device[i].device;
+    }
+    // offsets[e] now points at the end of entry e's list
+
+    for (size_t e = 0; e < entries; e++) {
+        order[e] = &survey->entries[e];
+    }
+    qsort(order, entries, sizeof(SurveyEntry *), survey_compare);
+
+    for (size_t i = 0; i < entries; i++) {
+        const SurveyEntry *entry = order[i];
+        size_t e = (size_t)(entry - survey->entries);
+        size_t start = e > 0 ? offsets[e - 1] : 0;
+
+        LoquatSurveyAp ap;
+        ap.ap = &entry->ap;
+        ap.best_bars = entry->best_bars;
+        ap.worst_bars = entry->worst_bars;
+        ap.mean_bars = (double)entry->bars_sum / (double)entry->observations;
+        ap.observations = entry->observations;
+        ap.devices = device_lists + start;
+        ap.device_count = (int)(offsets[e] - start);
+        callback(&ap, userdata);
+    }
+
+    free(order);
+    free(offsets);
+    free(device_offsets);
+    free(by_device);
+    free(device_lists);
+    return 1;
+}
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Request phase timings and HDR-style latency histograms. Values below
+// HISTOGRAM_SUB_BUCKETS microseconds get a bucket each; above that every
+// power of two is split into HISTOGRAM_SUB_BUCKETS / 2 linear buckets, so
+// the relative error stays under 2% from microseconds up to hours.
+
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+#define HISTOGRAM_SUB_BUCKETS (1UL << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+#define HISTOGRAM_MAX_US 0xFFFFFFFFFFULL   // About 12 days; larger values are clamped
+
+struct LoquatHistogram {
+    unsigned long *counts;
+    size_t bucket_count;           // Buckets allocated so far (grown on demand)
+    unsigned long total;
+    unsigned long long max_us;
+};
+
+static double curl_seconds(CURL *curl, CURLINFO info) {
+    curl_off_t us = 0;
+    curl_easy_getinfo(curl, info, &us);
+    return (double)us / 1e6;
+}
+
+// Read the phase timings of a finished transfer
+void loquat_timing_read(CURL *curl, LoquatTiming *timing) {
+    memset(timing, 0, sizeof(*timing));
+    timing->name_lookup = curl_seconds(curl, CURLINFO_NAMELOOKUP_TIME_T);
+    timing->connect = curl_seconds(curl, CURLINFO_CONNECT_TIME_T);
+    timing->app_connect = curl_seconds(curl, CURLINFO_APPCONNECT_TIME_T);
+    timing->pre_transfer = curl_seconds(curl, CURLINFO_PRETRANSFER_TIME_T);
+    timing->start_transfer = curl_seconds(curl, CURLINFO_STARTTRANSFER_TIME_T);
+    timing->total = curl_seconds(curl, CURLINFO_TOTAL_TIME_T);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &timing->bytes_down);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &timing->bytes_up);
+
+    long redirects = 0;
+    curl_easy_getinfo(curl, CURLINFO_REDIRECT_COUNT, &redirects);
+    timing->redirect_count = (int)redirects;
+}
+
+// Get the phase timings of the client's most recent request
+int loquat_client_get_timing(LoquatClient *client, LoquatTiming *timing) {
+    if (!client || !client->curl || !timing) {
+        return 0;
+    }
+    if (client->cache_age >= 0) {
+        // Served from the response cache; nothing went over the network
+        memset(timing, 0, sizeof(*timing));
+        return 1;
+    }
+    loquat_timing_read(client->curl, timing);
+    return 1;
+}
+
+// Bucket holding a value in microseconds
+static size_t histogram_bucket(unsigned long long us) {
+    if (us < HISTOGRAM_SUB_BUCKETS) {
+        return (size_t)us;
+    }
+    int msb = 63 - __builtin_clzll(us);
+    int shift = msb - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+    return HISTOGRAM_SUB_BUCKETS + (size_t)(shift - 1) * HISTOGRAM_HALF_BUCKETS +
+           (size_t)((us >> shift) - HISTOGRAM_HALF_BUCKETS);
+}
+
+// Largest value in microseconds that falls into a bucket
+static unsigned long long histogram_bucket_value(size_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t shift = (bucket - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_HALF_BUCKETS + 1;
+    unsigned long long sub = (bucket - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_HALF_BUCKETS + HISTOGRAM_HALF_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+// Create an empty latency histogram
+LoquatHistogram* loquat_histogram_init(void) {
+    LoquatHistogram *histogram = calloc(1, sizeof(LoquatHistogram));
+    if (!histogram) {
+        fprintf(stderr, "Failed to allocate memory for histogram\n");
+        return NULL;
+    }
+    return histogram;
+}
+
+// Free a latency histogram
+void loquat_histogram_cleanup(LoquatHistogram *histogram) {
+    if (histogram) {
+        free(histogram->counts);
+        free(histogram);
+    }
+}
+
+// Record one latency
+int loquat_histogram_record(LoquatHistogram *histogram, double seconds) {
+    if (!histogram) {
+        return 0;
+    }
+
+    double us_value = seconds > 0 ? seconds * 1e6 + 0.5 : 0;
+    unsigned long long us = us_value < (double)HISTOGRAM_MAX_US ? (unsigned long long)us_value : HISTOGRAM_MAX_US;
+    size_t bucket = histogram_bucket(us);
+
+    // Only allocate buckets up to the largest value seen
+    if (bucket >= histogram->bucket_count) {
+        size_t count = histogram->bucket_count ? histogram->bucket_count : HISTOGRAM_SUB_BUCKETS;
+        while (count <= bucket) {
+            count *= 2;
+        }
+        unsigned long *counts = realloc(histogram->counts, count * sizeof(unsigned long));
+        if (!counts) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 0;
+        }
+        memset(counts + histogram->bucket_count, 0, (count - histogram->bucket_count) * sizeof(unsigned long));
+        histogram->counts = counts;
+        histogram->bucket_count = count;
+    }
+
+    histogram->counts[bucket]++;
+    histogram->total++;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+    return 1;
+}
+
+// Number of recorded latencies
+unsigned long loquat_histogram_count(const LoquatHistogram *histogram) {
+    return histogram ? histogram->total : 0;
+}
+
+// Latency at or below which percentile% of the recorded values fall
+double loquat_histogram_percentile(const LoquatHistogram *histogram, double percentile) {
+    if (!histogram || histogram->total == 0) {
+        return 0.0;
+    }
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+
+    unsigned long rank = (unsigned long)(percentile / 100.0 * (double)histogram->total + 0.999999);
+    if (rank == 0) rank = 1;
+
+    unsigned long seen = 0;
+    for (size_t i = 0; i < histogram->bucket_count; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            unsigned long long us = histogram_bucket_value(i);
+            if (us > histogram->max_us) us = histogram->max_us;
+            return (double)us / 1e6;
+        }
+    }
+    return (double)histogram->max_us / 1e6;
+}
+
+// Largest recorded latency
+double loquat_histogram_max(const LoquatHistogram *histogram) {
+    return histogram ? (double)histogram->max_us / 1e6 : 0.0;
+}
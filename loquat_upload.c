@@ -0,0 +1,417 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "loquatcli.h"
+#include "loquat_internal.h"
+
+// Firmware and config uploads. The image is mapped read-only once per file
+// and every upload of it, from any thread, reads from that one mapping: the
+// read callback copies at most a chunk straight from the mapped pages into
+// libcurl's upload buffer, so nothing is ever loaded whole into the heap.
+//
+// Each attempt is a POST of bytes [offset, length) carrying
+//   Upload-Length: <image size>
+//   Upload-Offset: <offset>
+// When the link drops, a HEAD of the same URL asks the device how much it
+// has stored (Upload-Offset in the reply) and the next POST starts there.
+// A device that reports no offset gets the whole image again.
+
+#define UPLOAD_CHUNK_SIZE (256 * 1024)  // Bytes handed to libcurl per read callback
+#define UPLOAD_MAX_RESUMES 5
+#define UPLOAD_RESUME_DELAY 1.0         // First wait before asking for the offset; doubles
+#define UPLOAD_PROBE_TIMEOUT 10
+
+struct LoquatImage {
+    const char *data;            // NULL for an empty file
+    size_t size;
+    dev_t dev;                   // Identity of the mapped file
+    ino_t ino;
+    time_t mtime;
+    int refs;
+    LoquatImage *next;
+};
+
+// Images currently mapped, so opening a file again shares its mapping
+static LoquatImage *open_images = NULL;
+static pthread_mutex_t open_images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Map a file for uploading, or share the mapping of an image already open
+LoquatImage* loquat_image_open(const char *path) {
+    if (!path) {
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Cannot upload %s: not a regular file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&open_images_lock);
+    LoquatImage *image;
+    for (image = open_images; image; image = image->next) {
+        if (image->dev == st.st_dev && image->ino == st.st_ino &&
+            image->size == (size_t)st.st_size && image->mtime == st.st_mtime) {
+            image->refs++;
+            pthread_mutex_unlock(&open_images_lock);
+            close(fd);
+            return image;
+        }
+    }
+
+    image = calloc(1, sizeof(LoquatImage));
+    if (!image) {
+        fprintf(stderr, "Failed to allocate memory for image\n");
+        pthread_mutex_unlock(&open_images_lock);
+        close(fd);
+        return NULL;
+    }
+    image->size = (size_t)st.st_size;
+    image->dev = st.st_dev;
+    image->ino = st.st_ino;
+    image->mtime = st.st_mtime;
+    image->refs = 1;
+
+    if (image->size > 0) {
+        void *map = mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Cannot map %s: %s\n", path, strerror(errno));
+            pthread_mutex_unlock(&open_images_lock);
+            free(image);
+            close(fd);
+            return NULL;
+        }
+        // Every upload reads front to back
+        posix_madvise(map, image->size, POSIX_MADV_SEQUENTIAL);
+        image->data = map;
+    }
+    close(fd);
+
+    image->next = open_images;
+    open_images = image;
+    pthread_mutex_unlock(&open_images_lock);
+    return image;
+}
+
+// Drop a reference to an image, unmapping it after the last one
+void loquat_image_close(LoquatImage *image) {
+    if (!image) {
+        return;
+    }
+
+    pthread_mutex_lock(&open_images_lock);
+    if (--image->refs > 0) {
+        pthread_mutex_unlock(&open_images_lock);
+        return;
+    }
+    for (LoquatImage **p = &open_images; *p; p = &(*p)->next) {
+        if (*p == image) {
+            *p = image->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&open_images_lock);
+
+    if (image->data) {
+        munmap((void *)image->data, image->size);
+    }
+    free(image);
+}
+
+// Size of an image in bytes
+size_t loquat_image_size(const LoquatImage *image) {
+    return image ? image->size : 0;
+}
+
+static double upload_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Hand libcurl the next chunk of the image
+static size_t upload_read(char *buffer, size_t size, size_t nitems, void *userp) {
+    LoquatUpload *upload = userp;
+    size_t n = size * nitems;
+    size_t left = upload->image->size - upload->offset;
+    if (n > left) n = left;
+    if (n > UPLOAD_CHUNK_SIZE) n = UPLOAD_CHUNK_SIZE;
+
+    if (n > 0) {
+        memcpy(buffer, upload->image->data + upload->offset, n);
+        upload->offset += n;
+        upload->sent += n;
+    }
+    return n;
+}
+
+// Rewind within the current attempt (redirects, authentication retries)
+static int upload_seek(void *userp, curl_off_t offset, int origin) {
+    LoquatUpload *upload = userp;
+    if (origin != SEEK_SET || offset < 0 ||
+        (curl_off_t)(upload->image->size - upload->start) < offset) {
+        return CURL_SEEKFUNC_FAIL;
+    }
+    upload->offset = upload->start + (size_t)offset;
+    return CURL_SEEKFUNC_OK;
+}
+
+// Pick Upload-Offset out of the probe's reply headers
+static size_t upload_header(char *buffer, size_t size, size_t nitems, void *userp) {
+    LoquatUpload *upload = userp;
+    size_t len = size * nitems;
+    static const char name[] = "Upload-Offset:";
+    size_t name_len = sizeof(name) - 1;
+
+    if (len > name_len && strncasecmp(buffer, name, name_len) == 0) {
+        char value[32];
+        size_t n = len - name_len < sizeof(value) - 1 ? len - name_len : sizeof(value) - 1;
+        memcpy(value, buffer + name_len, n);
+        value[n] = '\0';
+
+        char *end;
+        errno = 0;
+        unsigned long long offset = strtoull(value, &end, 10);
+        if (end != value && errno == 0 && value[strspn(value, " \t")] != '-') {
+            upload->device_offset = (size_t)offset;
+            upload->have_offset = 1;
+        }
+    }
+    return len;
+}
+
+static int upload_add_header(LoquatUpload *upload, const char *header) {
+    struct curl_slist *list = curl_slist_append(upload->headers, header);
+    if (!list) {
+        fprintf(stderr, "Failed to allocate memory for request headers\n");
+        return 0;
+    }
+    upload->headers = list;
+    return 1;
+}
+
+// Start uploading image from its first byte
+void loquat_upload_begin(LoquatUpload *upload, LoquatImage *image) {
+    memset(upload, 0, sizeof(*upload));
+    upload->image = image;
+}
+
+// Configure the next transfer of an upload on a handle already set up
+// with its URL and write callback
+int loquat_upload_setup(LoquatUpload *upload, CURL *curl) {
+    curl_slist_free_all(upload->headers);
+    upload->headers = NULL;
+
+    if (upload->probing) {
+        upload->have_offset = 0;
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, upload_header);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, upload);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)UPLOAD_PROBE_TIMEOUT);
+        return 1;
+    }
+
+    char header[64];
+    if (!upload_add_header(upload, "Content-Type: application/octet-stream")) {
+        return 0;
+    }
+    snprintf(header, sizeof(header), "Upload-Length: %zu", upload->image->size);
+    if (!upload_add_header(upload, header)) {
+        return 0;
+    }
+    snprintf(header, sizeof(header), "Upload-Offset: %zu", upload->start);
+    if (!upload_add_header(upload, header)) {
+        return 0;
+    }
+    // Many devices never answer 100-continue, which would cost a second per attempt
+    if (!upload_add_header(upload, "Expect:")) {
+        return 0;
+    }
+
+    upload->offset = upload->start;
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, upload->headers);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_read);
+    curl_easy_setopt(curl, CURLOPT_READDATA, upload);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, upload_seek);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, upload);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)(upload->image->size - upload->start));
+    curl_easy_setopt(curl, CURLOPT_UPLOAD_BUFFERSIZE, (long)UPLOAD_CHUNK_SIZE);
+
+    // A large image may take much longer than any other request; only a
+    // stalled link counts as a timeout
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)DEFAULT_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)DEFAULT_TIMEOUT);
+    return 1;
+}
+
+// Failures worth resuming from: the link went away or the device is busy
+// or out of step with our offset
+static int upload_retryable(CURLcode res, long http_code) {
+    switch (res) {
+        case CURLE_OK:
+            return http_code == 409 || http_code == 503;
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_GOT_NOTHING:
+        case CURLE_OPERATION_TIMEDOUT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Decide what follows a finished transfer: 1 if another (a probe or the
+// resumed POST) should start after upload->delay seconds, 0 when done
+int loquat_upload_advance(LoquatUpload *upload, CURL *curl, CURLcode res) {
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+
+    if (upload->probing && res == CURLE_OK) {
+        // Any reply will do; one without an offset means starting over
+        upload->probing = 0;
+        upload->start = upload->have_offset && upload->device_offset <= upload->image->size ?
+                        upload->device_offset : 0;
+        upload->delay = 0.0;
+        return 1;
+    }
+    if (!upload->probing && !upload_retryable(res, code)) {
+        return 0;
+    }
+    // A device that could not be reached at all is not a dropped link
+    if (res == CURLE_COULDNT_CONNECT && upload->sent == 0 && upload->resumes == 0) {
+        return 0;
+    }
+    if (upload->resumes >= UPLOAD_MAX_RESUMES || (upload->probing && !upload_retryable(res, 0))) {
+        return 0;
+    }
+
+    upload->delay = UPLOAD_RESUME_DELAY * (double)(1 << upload->resumes);
+    upload->resumes++;
+    upload->probing = 1;
+    return 1;
+}
+
+// Free what an upload holds between transfers
+void loquat_upload_end(LoquatUpload *upload) {
+    curl_slist_free_all(upload->headers);
+    upload->headers = NULL;
+}
+
+// Upload an image to command on the client's device, resuming after dropped links
+int loquat_client_upload(LoquatClient *client, const char *command, LoquatImage *image,
+                         ResponseData *buffer, LoquatUploadResult *result) {
+    if (!client || !client->curl || !command || !image || !buffer || !result) {
+        return 0;
+    }
+
+    memset(result, 0, sizeof(*result));
+    result->size = image->size;
+
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", command);
+    if (!url) {
+        return 0;
+    }
+
+    LoquatUpload upload;
+    loquat_upload_begin(&upload, image);
+    double start = upload_now();
+    int ok = 0;
+
+    for (;;) {
+        // Reuse whatever capacity the buffer kept from earlier requests
+        buffer->size = 0;
+        buffer->curl = client->curl;
+        if (buffer->data && buffer->capacity > 0) {
+            buffer->data[0] = '\0';
+        }
+
+        curl_easy_reset(client->curl);
+        loquat_client_setup_transfer(client, client->curl);
+        curl_easy_setopt(client->curl, CURLOPT_URL, url);
+        curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+        curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, buffer);
+        curl_easy_setopt(client->curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(client->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+        if (!loquat_upload_setup(&upload, client->curl)) {
+            break;
+        }
+
+        CURLcode res = curl_easy_perform(client->curl);
+        int was_probing = upload.probing;
+        size_t reached = upload.offset;
+        long code = 0;
+        curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &code);
+
+        if (!loquat_upload_advance(&upload, client->curl, res)) {
+            if (res != CURLE_OK) {
+                fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+            } else {
+                result->http_code = (int)code;
+                ok = 1;
+            }
+            break;
+        }
+
+        if (!upload.probing) {
+            fprintf(stderr, "Resuming upload at byte %zu of %zu\n", upload.start, image->size);
+        } else if (was_probing) {
+            fprintf(stderr, "Device unreachable (%s); retrying in %.0f s\n",
+                    curl_easy_strerror(res), upload.delay);
+        } else if (res != CURLE_OK) {
+            fprintf(stderr, "Upload interrupted after %zu of %zu bytes (%s); resuming in %.0f s\n",
+                    reached, image->size, curl_easy_strerror(res), upload.delay);
+        } else {
+            fprintf(stderr, "Upload refused with HTTP %ld at byte %zu; resuming in %.0f s\n",
+                    code, upload.start, upload.delay);
+        }
+
+        if (upload.delay > 0) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)upload.delay;
+            ts.tv_nsec = (long)((upload.delay - (double)ts.tv_sec) * 1e9);
+            while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+            }
+        }
+    }
+
+    buffer->curl = NULL;
+    loquat_url_release(url, url_buf);
+    loquat_upload_end(&upload);
+
+    result->sent = upload.sent;
+    result->resumed_from = upload.start;
+    result->resumes = upload.resumes;
+    result->elapsed = upload_now() - start;
+
+    // An empty body still yields a valid string
+    if (ok && !buffer->data && !loquat_response_reserve(buffer, RESPONSE_INITIAL_CAPACITY)) {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        return 0;
+    }
+    if (ok && buffer->size == 0) {
+        buffer->data[0] = '\0';
+    }
+    return ok;
+}
@@ -1,27 +1,102 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <curl/curl.h>
 #include <cjson/cJSON.h>
 #include "loquatcli.h"
+#include "loquat_internal.h"
 
-#define MAX_URL_LENGTH 2048
-#define MAX_RESPONSE_LENGTH 8192
-#define DEFAULT_TIMEOUT 30
+#define BATCH_MAX_ARGS 32
+#define WATCH_DEFAULT_INTERVAL 1.0
+#define WATCH_DEFAULT_MAX_INTERVAL 30.0
+#define TIMING_PHASES 6
+#define SOCKET_PATH_MAX 108
+#define DAEMON_MAX_POST (1024 * 1024)      // Largest POST body the daemon accepts
+#define DAEMON_MAX_HEADER (64 * 1024)      // Longest request or reply line, base URL included
+#define DAEMON_READ_TIMEOUT 10             // Seconds the daemon waits for a client to send
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+#define LOAD_REPORT_INTERVAL 1.0
+#define LOAD_DEFAULT_DURATION 10.0
+#define LOAD_MAX_IN_FLIGHT 1024
+#define LOAD_MAX_OUTCOMES 32
 
-// Callback function to handle the response data
-static size_t write_callback(void *contents, size_t size, size_t nmemb, ResponseData *resp) {
-    size_t realsize = size * nmemb;
-    char *ptr = realloc(resp->data, resp->size + realsize + 1);
+typedef enum {
+    OUTPUT_TABLE = 0,
+    OUTPUT_JSON,
+    OUTPUT_NDJSON,
+    OUTPUT_CSV
+} OutputFormat;
+
+// Number of heap allocations made for response buffers
+static unsigned long response_alloc_count = 0;
+
+// Grow a response buffer to hold at least capacity bytes
+int loquat_response_reserve(ResponseData *resp, size_t capacity) {
+    if (capacity <= resp->capacity) {
+        return 1;
+    }
+    if (resp->fixed) {
+        return 0;
+    }
     
+    char *ptr = realloc(resp->data, capacity);
     if (ptr == NULL) {
-        printf("Memory allocation failed\n");
         return 0;
     }
+    __atomic_add_fetch(&response_alloc_count, 1, __ATOMIC_RELAXED);
     
     resp->data = ptr;
+    resp->capacity = capacity;
+    return 1;
+}
+
+// Callback function to handle the response data
+size_t loquat_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    ResponseData *resp = userp;
+    size_t realsize = size * nmemb;
+    size_t needed = resp->size + realsize + 1;
+    
+    if (needed > resp->capacity) {
+        size_t capacity = resp->capacity ? resp->capacity * 2 : RESPONSE_INITIAL_CAPACITY;
+        
+        // Size the buffer for the whole body up front when the server announced it
+        if (resp->size == 0 && resp->curl) {
+            curl_off_t length = -1;
+            curl_easy_getinfo(resp->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+            if (length > 0 && (size_t)length + 1 > capacity) {
+                capacity = (size_t)length + 1;
+            }
+        }
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        
+        if (!loquat_response_reserve(resp, capacity)) {
+            if (resp->fixed) {
+                fprintf(stderr, "Response exceeds buffer capacity (%zu bytes)\n", resp->capacity);
+            } else {
+                printf("Memory allocation failed\n");
+            }
+            return 0;
+        }
+    }
+    
     memcpy(&(resp->data[resp->size]), contents, realsize);
     resp->size += realsize;
     resp->data[resp->size] = 0;
@@ -29,6 +104,18 @@ static size_t write_callback(void *contents, size_t size, size_t nmemb, Response
     return realsize;
 }
 
+// Heap copy of a base URL or socket path, which may be of any length
+static char* copy_client_string(const char *value) {
+    size_t len = strlen(value);
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        fprintf(stderr, "Failed to allocate memory for client\n");
+        return NULL;
+    }
+    memcpy(copy, value, len + 1);
+    return copy;
+}
+
 // Initialize the HTTP client
 LoquatClient* loquat_client_init(const char *base_url) {
     LoquatClient *client = malloc(sizeof(LoquatClient));
@@ -37,24 +124,35 @@ LoquatClient* loquat_client_init(const char *base_url) {
         return NULL;
     }
     
-    // Initialize CURL
-    curl_global_init(CURL_GLOBAL_ALL);
+    // Initialize CURL (first client sets up the shared library context)
+    if (!loquat_global_init()) {
+        free(client);
+        return NULL;
+    }
     client->curl = curl_easy_init();
     
     if (!client->curl) {
         fprintf(stderr, "Failed to initialize CURL\n");
+        loquat_global_cleanup();
         free(client);
         return NULL;
     }
     
     // Set base URL
-    if (base_url) {
-        strncpy(client->base_url, base_url, sizeof(client->base_url) - 1);
-        client->base_url[sizeof(client->base_url) - 1] = '\0';
-    } else {
-        strcpy(client->base_url, "http://localhost:8080");
+    client->base_url = copy_client_string(base_url ? base_url : "http://localhost:8080");
+    if (!client->base_url) {
+        curl_easy_cleanup(client->curl);
+        loquat_global_cleanup();
+        free(client);
+        return NULL;
     }
     
+    client->cache = NULL;
+    client->cache_age = -1.0;
+    client->unix_socket = NULL;
+    client->single_flight = 0;
+    client->share_connections = 1;
+    
     return client;
 }
 
@@ -64,7 +162,9 @@ void loquat_client_cleanup(LoquatClient *client) {
         if (client->curl) {
             curl_easy_cleanup(client->curl);
         }
-        curl_global_cleanup();
+        loquat_global_cleanup();
+        free(client->base_url);
+        free(client->unix_socket);
         free(client);
     }
 }
@@ -72,8 +172,51 @@ void loquat_client_cleanup(LoquatClient *client) {
 // Set a new base URL
 void loquat_client_set_base_url(LoquatClient *client, const char *url) {
     if (client && url) {
-        strncpy(client->base_url, url, sizeof(client->base_url) - 1);
-        client->base_url[sizeof(client->base_url) - 1] = '\0';
+        // Keep the old URL if the copy cannot be made
+        char *copy = copy_client_string(url);
+        if (copy) {
+            free(client->base_url);
+            client->base_url = copy;
+        }
+    }
+}
+
+// Send requests over a UNIX domain socket instead of TCP (NULL for TCP)
+int loquat_client_set_unix_socket(LoquatClient *client, const char *path) {
+    if (!client) {
+        return 0;
+    }
+    char *copy = NULL;
+    if (path) {
+        copy = copy_client_string(path);
+        if (!copy) {
+            return 0;
+        }
+    }
+    free(client->unix_socket);
+    client->unix_socket = copy;
+    return 1;
+}
+
+// Share identical concurrent GETs with other single-flight clients
+void loquat_client_set_single_flight(LoquatClient *client, int enable) {
+    if (client) {
+        client->single_flight = enable ? 1 : 0;
+    }
+}
+
+void loquat_client_set_connection_sharing(LoquatClient *client, int enable) {
+    if (client) {
+        client->share_connections = enable ? 1 : 0;
+    }
+}
+
+// Options every transfer of a client starts from
+void loquat_client_setup_transfer(LoquatClient *client, CURL *curl) {
+    // Reuse DNS, TLS sessions and connections shared by all clients
+    curl_easy_setopt(curl, CURLOPT_SHARE, loquat_share_handle(client->share_connections));
+    if (client->unix_socket) {
+        curl_easy_setopt(curl, CURLOPT_UNIX_SOCKET_PATH, client->unix_socket);
     }
 }
 
@@ -82,33 +225,71 @@ const char* loquat_client_get_base_url(LoquatClient *client) {
     return client ? client->base_url : NULL;
 }
 
-// Make a GET request
-int loquat_client_get(LoquatClient *client, const char *command, char **response, int *http_code) {
-    if (!client || !client->curl || !command || !response || !http_code) {
+// Copy a fresh cached response for command into resp, if the client has one
+static int client_cache_fetch(LoquatClient *client, const char *command, ResponseData *resp) {
+    client->cache_age = -1.0;
+    if (!client->cache) {
         return 0;
     }
     
-    char url[MAX_URL_LENGTH];
-    snprintf(url, sizeof(url), "%s/%s", client->base_url, command);
+    LoquatCacheHit hit;
+    if (!loquat_cache_lookup(client->cache, client->base_url, client->unix_socket, command, &hit)) {
+        return 0;
+    }
     
-    // Initialize response data
+    int ok = loquat_response_reserve(resp, hit.body_len + 1);
+    if (ok) {
+        memcpy(resp->data, hit.body, hit.body_len);
+        resp->data[hit.body_len] = '\0';
+        resp->size = hit.body_len;
+        client->cache_age = hit.age;
+    }
+    loquat_cache_release(&hit);
+    return ok;
+}
+
+// Single-flight key of a GET to base_url, sep and endpoint
+static char* client_flight_key(LoquatClient *client, const char *sep, const char *endpoint,
+                               char **headers, int header_count) {
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, sep, endpoint);
+    if (!url) {
+        return NULL;
+    }
+    char *key = loquat_flight_key(url, client->unix_socket, headers, header_count);
+    loquat_url_release(url, url_buf);
+    return key;
+}
+
+static int client_get(LoquatClient *client, const char *command, char **response, int *http_code) {
+    // Initialize response data (allocated on the first chunk, pre-sized from Content-Length)
     ResponseData resp = {0};
-    resp.data = malloc(1);
-    resp.size = 0;
+    resp.curl = client->curl;
     
-    if (!resp.data) {
-        fprintf(stderr, "Failed to allocate memory for response\n");
+    // Answer from the response cache without touching the network
+    if (client_cache_fetch(client, command, &resp)) {
+        *http_code = 200;
+        *response = resp.data;
+        return 1;
+    }
+    
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", command);
+    if (!url) {
         return 0;
     }
     
     // Reset curl handle for new request
     curl_easy_reset(client->curl);
     
+    loquat_client_setup_transfer(client, client->curl);
+    
     // Set the URL
     curl_easy_setopt(client->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
     
     // Set the callback function to receive data
-    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
     curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &resp);
     
     // Set timeout
@@ -133,7 +314,19 @@ int loquat_client_get(LoquatClient *client, const char *command, char **response
     }
     
     // Get HTTP response code
-    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, http_code);
+    long response_code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+    
+    // An empty body still yields a valid string
+    if (!resp.data && !loquat_response_reserve(&resp, 1)) {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        return 0;
+    }
+    
+    if (client->cache && *http_code == 200) {
+        loquat_cache_store(client->cache, client->base_url, client->unix_socket, command, resp.data, resp.size);
+    }
     
     // Set response pointer
     *response = resp.data;
@@ -141,30 +334,50 @@ int loquat_client_get(LoquatClient *client, const char *command, char **response
     return 1;
 }
 
+// Make a GET request
+int loquat_client_get(LoquatClient *client, const char *command, char **response, int *http_code) {
+    if (!client || !client->curl || !command || !response || !http_code) {
+        return 0;
+    }
+    if (!client->single_flight) {
+        return client_get(client, command, response, http_code);
+    }
+    
+    LoquatFlight *flight;
+    int ok;
+    if (loquat_flight_begin(client_flight_key(client, "/", command, NULL, 0), &flight, &ok, response, http_code)) {
+        client->cache_age = -1.0;
+        return ok;
+    }
+    ok = client_get(client, command, response, http_code);
+    loquat_flight_land(flight, ok, ok ? *response : NULL, ok ? *http_code : 0);
+    return ok;
+}
+
 // Make a POST request
 int loquat_client_post(LoquatClient *client, const char *endpoint, const char *post_data, char **response, int *http_code) {
     if (!client || !client->curl || !endpoint || !response || !http_code) {
         return 0;
     }
     
-    char url[MAX_URL_LENGTH];
-    snprintf(url, sizeof(url), "%s/%s", client->base_url, endpoint);
-    
-    // Initialize response data
-    ResponseData resp = {0};
-    resp.data = malloc(1);
-    resp.size = 0;
-    
-    if (!resp.data) {
-        fprintf(stderr, "Failed to allocate memory for response\n");
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", endpoint);
+    if (!url) {
         return 0;
     }
     
+    // Initialize response data (allocated on the first chunk, pre-sized from Content-Length)
+    ResponseData resp = {0};
+    resp.curl = client->curl;
+    
     // Reset curl handle for new request
     curl_easy_reset(client->curl);
     
+    loquat_client_setup_transfer(client, client->curl);
+    
     // Set the URL
     curl_easy_setopt(client->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
     
     // Set POST method
     curl_easy_setopt(client->curl, CURLOPT_POST, 1L);
@@ -176,11 +389,11 @@ int loquat_client_post(LoquatClient *client, const char *endpoint, const char *p
     }
     
     // Set the callback function to receive data
-    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
     curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &resp);
     
     // Set timeout - longer for connect command
-    long timeout = (strcmp(endpoint, "connect") == 0) ? 120L : DEFAULT_TIMEOUT;
+    long timeout = (strcmp(endpoint, "connect") == 0) ? CONNECT_TIMEOUT : DEFAULT_TIMEOUT;
     curl_easy_setopt(client->curl, CURLOPT_TIMEOUT, timeout);
     
     // Follow redirects
@@ -202,7 +415,15 @@ int loquat_client_post(LoquatClient *client, const char *endpoint, const char *p
     }
     
     // Get HTTP response code
-    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, http_code);
+    long response_code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+    
+    // An empty body still yields a valid string
+    if (!resp.data && !loquat_response_reserve(&resp, 1)) {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        return 0;
+    }
     
     // Set response pointer
     *response = resp.data;
@@ -210,35 +431,29 @@ int loquat_client_post(LoquatClient *client, const char *endpoint, const char *p
     return 1;
 }
 
-// Make a GET request with custom headers
-int loquat_client_get_with_headers(LoquatClient *client, const char *endpoint, 
-                                   char **headers, int header_count, 
-                                   char **response, int *http_code) {
-    if (!client || !client->curl || !endpoint || !response || !http_code) {
+static int client_get_with_headers(LoquatClient *client, const char *endpoint, char **headers,
+                                   int header_count, char **response, int *http_code) {
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "", endpoint);
+    if (!url) {
         return 0;
     }
     
-    char url[MAX_URL_LENGTH];
-    snprintf(url, sizeof(url), "%s%s", client->base_url, endpoint);
-    
-    // Initialize response data
+    // Initialize response data (allocated on the first chunk, pre-sized from Content-Length)
     ResponseData resp = {0};
-    resp.data = malloc(1);
-    resp.size = 0;
-    
-    if (!resp.data) {
-        fprintf(stderr, "Failed to allocate memory for response\n");
-        return 0;
-    }
+    resp.curl = client->curl;
     
     // Reset curl handle for new request
     curl_easy_reset(client->curl);
     
+    loquat_client_setup_transfer(client, client->curl);
+    
     // Set the URL
     curl_easy_setopt(client->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
     
     // Set the callback function to receive data
-    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
     curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &resp);
     
     // Set timeout
@@ -272,7 +487,15 @@ int loquat_client_get_with_headers(LoquatClient *client, const char *endpoint,
     }
     
     // Get HTTP response code
-    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, http_code);
+    long response_code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+    
+    // An empty body still yields a valid string
+    if (!resp.data && !loquat_response_reserve(&resp, 1)) {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        return 0;
+    }
     
     // Set response pointer
     *response = resp.data;
@@ -280,9 +503,267 @@ int loquat_client_get_with_headers(LoquatClient *client, const char *endpoint,
     return 1;
 }
 
-// Free response memory
+// Make a GET request with custom headers
+int loquat_client_get_with_headers(LoquatClient *client, const char *endpoint, 
+                                   char **headers, int header_count, 
+                                   char **response, int *http_code) {
+    if (!client || !client->curl || !endpoint || !response || !http_code) {
+        return 0;
+    }
+    if (!client->single_flight) {
+        return client_get_with_headers(client, endpoint, headers, header_count, response, http_code);
+    }
+    
+    LoquatFlight *flight;
+    int ok;
+    if (loquat_flight_begin(client_flight_key(client, "", endpoint, headers, header_count), &flight, &ok,
+                            response, http_code)) {
+        return ok;
+    }
+    ok = client_get_with_headers(client, endpoint, headers, header_count, response, http_code);
+    loquat_flight_land(flight, ok, ok ? *response : NULL, ok ? *http_code : 0);
+    return ok;
+}
+
+// Make a GET request into a caller-owned, reusable buffer
+int loquat_client_get_into(LoquatClient *client, const char *command, ResponseData *buffer, int *http_code) {
+    if (!client || !client->curl || !command || !buffer || !http_code) {
+        return 0;
+    }
+    
+    // Reuse whatever capacity the buffer kept from earlier requests
+    buffer->size = 0;
+    buffer->curl = NULL;
+    if (buffer->data && buffer->capacity > 0) {
+        buffer->data[0] = '\0';
+    }
+    
+    // Answer from the response cache without touching the network
+    if (client_cache_fetch(client, command, buffer)) {
+        *http_code = 200;
+        return 1;
+    }
+    
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", command);
+    if (!url) {
+        return 0;
+    }
+    buffer->curl = client->curl;
+    
+    // Reset curl handle for new request
+    curl_easy_reset(client->curl);
+    
+    loquat_client_setup_transfer(client, client->curl);
+    
+    // Set the URL
+    curl_easy_setopt(client->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
+    
+    // Set the callback function to receive data
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, buffer);
+    
+    // Set timeout
+    curl_easy_setopt(client->curl, CURLOPT_TIMEOUT, DEFAULT_TIMEOUT);
+    
+    // Follow redirects
+    curl_easy_setopt(client->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    
+    // Set user agent
+    curl_easy_setopt(client->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+    
+    // Perform the request
+    CURLcode res = curl_easy_perform(client->curl);
+    buffer->curl = NULL;
+    
+    if (res != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        return 0;
+    }
+    
+    // An empty body still yields a valid string
+    if (!buffer->data && !loquat_response_reserve(buffer, RESPONSE_INITIAL_CAPACITY)) {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        return 0;
+    }
+    if (buffer->size == 0) {
+        buffer->data[0] = '\0';
+    }
+    
+    // Get HTTP response code
+    long response_code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+    
+    if (client->cache && *http_code == 200) {
+        loquat_cache_store(client->cache, client->base_url, client->unix_socket, command,
+                           buffer->data, buffer->size);
+    }
+    
+    return 1;
+}
+
+// Copy a header value, trimming surrounding whitespace and the line ending
+static void copy_header_value(char *dst, size_t dst_size, const char *value, size_t len) {
+    while (len > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)value[len - 1])) {
+        len--;
+    }
+    if (len >= dst_size) {
+        // Truncated validators would never match; drop them
+        len = 0;
+    }
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+}
+
+// Header callback collecting ETag and Last-Modified from the response
+static size_t validators_header_callback(char *buffer, size_t size, size_t nitems, void *userp) {
+    LoquatValidators *validators = userp;
+    size_t len = size * nitems;
+
+    // A new status line (e.g. after a redirect) starts a fresh set of headers
+    if (len > 5 && strncmp(buffer, "HTTP/", 5) == 0) {
+        memset(validators, 0, sizeof(*validators));
+    } else if (len > 5 && strncasecmp(buffer, "ETag:", 5) == 0) {
+        copy_header_value(validators->etag, sizeof(validators->etag), buffer + 5, len - 5);
+    } else if (len > 14 && strncasecmp(buffer, "Last-Modified:", 14) == 0) {
+        copy_header_value(validators->last_modified, sizeof(validators->last_modified),
+                          buffer + 14, len - 14);
+    }
+    return len;
+}
+
+// Make a conditional GET request into a reusable buffer
+int loquat_client_get_conditional(LoquatClient *client, const char *command, LoquatValidators *validators,
+                                  ResponseData *buffer, int *http_code) {
+    if (!client || !client->curl || !command || !validators || !buffer || !http_code) {
+        return 0;
+    }
+    
+    char url_buf[MAX_URL_LENGTH];
+    char *url = loquat_url_join(url_buf, sizeof(url_buf), client->base_url, "/", command);
+    if (!url) {
+        return 0;
+    }
+    
+    buffer->size = 0;
+    buffer->curl = client->curl;
+    if (buffer->data && buffer->capacity > 0) {
+        buffer->data[0] = '\0';
+    }
+    
+    // Send the validators from the last full response
+    struct curl_slist *header_list = NULL;
+    char header[256];
+    if (validators->etag[0]) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", validators->etag);
+        header_list = curl_slist_append(header_list, header);
+    }
+    if (validators->last_modified[0]) {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", validators->last_modified);
+        header_list = curl_slist_append(header_list, header);
+    }
+    
+    LoquatValidators received;
+    memset(&received, 0, sizeof(received));
+    
+    // Reset curl handle for new request
+    curl_easy_reset(client->curl);
+    
+    loquat_client_setup_transfer(client, client->curl);
+    
+    // Set the URL
+    curl_easy_setopt(client->curl, CURLOPT_URL, url);
+    loquat_url_release(url, url_buf);
+    
+    // Set the callback function to receive data
+    curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, loquat_write_callback);
+    curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, buffer);
+    
+    // Collect the validators of this response
+    curl_easy_setopt(client->curl, CURLOPT_HEADERFUNCTION, validators_header_callback);
+    curl_easy_setopt(client->curl, CURLOPT_HEADERDATA, &received);
+    
+    // Set conditional headers
+    curl_easy_setopt(client->curl, CURLOPT_HTTPHEADER, header_list);
+    
+    // Set timeout
+    curl_easy_setopt(client->curl, CURLOPT_TIMEOUT, DEFAULT_TIMEOUT);
+    
+    // Follow redirects
+    curl_easy_setopt(client->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    
+    // Set user agent
+    curl_easy_setopt(client->curl, CURLOPT_USERAGENT, "LoquatClient/1.0");
+    
+    // Perform the request
+    CURLcode res = curl_easy_perform(client->curl);
+    buffer->curl = NULL;
+    
+    // Clean up headers
+    curl_slist_free_all(header_list);
+    
+    if (res != CURLE_OK) {
+        fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        return 0;
+    }
+    
+    // An empty body still yields a valid string
+    if (!buffer->data && !loquat_response_reserve(buffer, RESPONSE_INITIAL_CAPACITY)) {
+        fprintf(stderr, "Failed to allocate memory for response\n");
+        return 0;
+    }
+    if (buffer->size == 0) {
+        buffer->data[0] = '\0';
+    }
+    
+    // Get HTTP response code
+    long response_code = 0;
+    curl_easy_getinfo(client->curl, CURLINFO_RESPONSE_CODE, &response_code);
+    *http_code = (int)response_code;
+    
+    // A full response replaces the validators; a 304 keeps them
+    if (*http_code == 200) {
+        *validators = received;
+    }
+    
+    return 1;
+}
+
+// Prepare a response buffer, optionally backed by caller storage
+void loquat_response_data_init(ResponseData *buffer, char *storage, size_t capacity) {
+    if (!buffer) return;
+    memset(buffer, 0, sizeof(*buffer));
+    if (storage && capacity > 0) {
+        buffer->data = storage;
+        buffer->capacity = capacity;
+        buffer->fixed = 1;
+        storage[0] = '\0';
+    }
+}
+
+// Release memory the library allocated for a response buffer
+void loquat_response_data_free(ResponseData *buffer) {
+    if (!buffer) return;
+    if (!buffer->fixed) {
+        free(buffer->data);
+    }
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+// Number of response buffer allocations made so far
+unsigned long loquat_response_alloc_count(void) {
+    return __atomic_load_n(&response_alloc_count, __ATOMIC_RELAXED);
+}
+
+// Free response memory, once every caller sharing it has released it
 void loquat_client_free_response(char *response) {
-    if (response) {
+    if (response && !loquat_flight_release(response)) {
         free(response);
     }
 }
@@ -296,6 +777,7 @@ int is_valid_command(const char *command) {
     if (strcmp(command, "connect") == 0) return 1;
     if (strcmp(command, "apikey") == 0) return 1;
     if (strcmp(command, "get_net_info") == 0) return 1;
+    if (strcmp(command, "upload") == 0) return 1;
 
     return 0;
 }
@@ -312,15 +794,300 @@ int is_get_command(const char *command) {
     return 0;
 }
 
-void print_scan_result(const char *response) {
-    if (!response) {
-        fprintf(stderr, "No response data\n");
-        return;
-    }
-    
-    fprintf(stderr, "\n=== WiFi Access Points ===\n");
-    fprintf(stderr, "%-40s %-8s %-12s\n", "SSID", "Bars", "Security");
-    fprintf(stderr, "%-40s %-8s %-12s\n", "--------------------", "--------", "------------");
+// Scan and net-info results are formatted into one buffer that is written
+// out in large pieces instead of one unbuffered stderr write per field.
+// Tables go to stderr as before; machine-readable formats go to stdout.
+static OutputFormat output_format = OUTPUT_TABLE;
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_len = 0;
+
+static const char *output_format_names[] = { "table", "json", "ndjson", "csv", NULL };
+
+// Select the output format by name; 0 if the name is unknown
+int set_output_format(const char *name) {
+    for (int i = 0; output_format_names[i]; i++) {
+        if (strcmp(name, output_format_names[i]) == 0) {
+            output_format = (OutputFormat)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void output_write(const char *data, size_t len) {
+    int fd = output_format == OUTPUT_TABLE ? STDERR_FILENO : STDOUT_FILENO;
+    // Keep anything already queued in stdio ahead of our bytes
+    fflush(output_format == OUTPUT_TABLE ? stderr : stdout);
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+// Write out everything buffered so far
+void output_flush(void) {
+    if (output_len > 0) {
+        output_write(output_buffer, output_len);
+        output_len = 0;
+    }
+}
+
+static void output_append(const char *data, size_t len) {
+    if (output_len + len > sizeof(output_buffer)) {
+        output_flush();
+        if (len > sizeof(output_buffer)) {
+            output_write(data, len);
+            return;
+        }
+    }
+    memcpy(output_buffer + output_len, data, len);
+    output_len += len;
+}
+
+static void output_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t space = sizeof(output_buffer) - output_len;
+    int n = vsnprintf(output_buffer + output_len, space, format, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < space) {
+        output_len += (size_t)n;
+        return;
+    }
+
+    // Did not fit: flush and format again
+    output_flush();
+    va_start(args, format);
+    if ((size_t)n < sizeof(output_buffer)) {
+        output_len = (size_t)vsnprintf(output_buffer, sizeof(output_buffer), format, args);
+    } else {
+        char *text = malloc((size_t)n + 1);
+        if (text) {
+            vsnprintf(text, (size_t)n + 1, format, args);
+            output_write(text, (size_t)n);
+            free(text);
+        }
+    }
+    va_end(args);
+}
+
+static void output_json_string(const char *value) {
+    output_append("\"", 1);
+    const char *run = value;
+    for (const char *p = value; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+        output_append(run, (size_t)(p - run));
+        if (c == '"' || c == '\\') {
+            char escaped[2] = { '\\', (char)c };
+            output_append(escaped, 2);
+        } else {
+            output_printf("\\u%04x", c);
+        }
+        run = p + 1;
+    }
+    output_append(run, strlen(run));
+    output_append("\"", 1);
+}
+
+static void output_csv_field(const char *value) {
+    if (!strpbrk(value, ",\"\r\n")) {
+        output_append(value, strlen(value));
+        return;
+    }
+    output_append("\"", 1);
+    for (const char *p = value; *p; p++) {
+        output_append(p, 1);
+        if (*p == '"') {
+            output_append("\"", 1);
+        }
+    }
+    output_append("\"", 1);
+}
+
+// Start a list of access points
+void output_scan_begin(void) {
+    switch (output_format) {
+        case OUTPUT_TABLE:
+            output_printf("\n=== WiFi Access Points ===\n");
+            output_printf("%-40s %-8s %-12s\n", "SSID", "Bars", "Security");
+            output_printf("%-40s %-8s %-12s\n", "--------------------", "--------", "------------");
+            break;
+        case OUTPUT_JSON:
+            output_append("[", 1);
+            break;
+        case OUTPUT_CSV:
+            output_printf("ssid,bars,security\n");
+            break;
+        case OUTPUT_NDJSON:
+            break;
+    }
+}
+
+// Add the index'th access point to the list
+void output_scan_ap(const char *ssid, int bars, const char *security, int index) {
+    switch (output_format) {
+        case OUTPUT_TABLE:
+            output_printf("%-40s %-8d %-12s\n", ssid, bars, security);
+            break;
+        case OUTPUT_JSON:
+        case OUTPUT_NDJSON:
+            if (output_format == OUTPUT_JSON && index > 0) {
+                output_append(",", 1);
+            }
+            output_append("{\"ssid\":", 8);
+            output_json_string(ssid);
+            output_printf(",\"bars\":%d,\"security\":", bars);
+            output_json_string(security);
+            output_append(output_format == OUTPUT_JSON ? "}" : "}\n", output_format == OUTPUT_JSON ? 1 : 2);
+            break;
+        case OUTPUT_CSV:
+            output_csv_field(ssid);
+            output_printf(",%d,", bars);
+            output_csv_field(security);
+            output_append("\n", 1);
+            break;
+    }
+}
+
+// Finish the list and write it out
+void output_scan_end(void) {
+    if (output_format == OUTPUT_TABLE) {
+        output_append("\n", 1);
+    } else if (output_format == OUTPUT_JSON) {
+        output_append("]\n", 2);
+    }
+    output_flush();
+}
+
+// How result bodies are parsed. By default a scan from a single device is
+// parsed as it streams in, and rows are printed as they arrive. With
+// "extract" the body is read whole and then walked in place. With "cjson"
+// everything goes through cJSON. Complete bodies (net info, batch and
+// forwarded replies) use the extractor unless cJSON is selected. Bodies
+// the extractor rejects go through cJSON either way, so malformed
+// responses get the same messages as before.
+typedef enum {
+    RESULT_PARSER_STREAM,
+    RESULT_PARSER_EXTRACT,
+    RESULT_PARSER_CJSON
+} ResultParser;
+
+static ResultParser result_parser = RESULT_PARSER_STREAM;
+
+// Select the result parser ("stream", "extract" or "cjson"); 0 if the name is unknown
+int set_result_parser(const char *name) {
+    if (strcmp(name, "stream") == 0) {
+        result_parser = RESULT_PARSER_STREAM;
+    } else if (strcmp(name, "extract") == 0) {
+        result_parser = RESULT_PARSER_EXTRACT;
+    } else if (strcmp(name, "cjson") == 0) {
+        result_parser = RESULT_PARSER_CJSON;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Longest extracted field printed from a stack copy
+#define EXTRACT_FIELD_MAX 1024
+
+// Access points of one body, collected so nothing is printed for a body
+// that turns out to be malformed. The array is kept for the next body
+typedef struct {
+    LoquatScanView *rows;
+    size_t count;
+    size_t capacity;
+    int failed;               // Out of memory, or a field too long to print
+} ExtractRows;
+
+static ExtractRows extract_rows;
+
+static void extract_collect_row(const LoquatScanView *ap, void *userdata) {
+    ExtractRows *rows = userdata;
+    if (rows->failed) {
+        return;
+    }
+    if (ap->ssid.len >= EXTRACT_FIELD_MAX || ap->security.len >= EXTRACT_FIELD_MAX) {
+        rows->failed = 1;
+        return;
+    }
+    if (rows->count == rows->capacity) {
+        size_t capacity = rows->capacity ? rows->capacity * 2 : 64;
+        LoquatScanView *grown = realloc(rows->rows, capacity * sizeof(LoquatScanView));
+        if (!grown) {
+            rows->failed = 1;
+            return;
+        }
+        rows->rows = grown;
+        rows->capacity = capacity;
+    }
+    rows->rows[rows->count++] = *ap;
+}
+
+static void extract_print_row(const LoquatScanView *ap, int index) {
+    char ssid[EXTRACT_FIELD_MAX];
+    char security[EXTRACT_FIELD_MAX];
+    if (ap->has_ssid) {
+        loquat_string_view_copy(&ap->ssid, ssid, sizeof(ssid));
+    } else {
+        strcpy(ssid, "Unknown");
+    }
+    if (ap->has_security) {
+        loquat_string_view_copy(&ap->security, security, sizeof(security));
+    } else {
+        strcpy(security, "Unknown");
+    }
+    output_scan_ap(ssid, ap->bars, security, index);
+}
+
+// Print a scan body with the extractor; 0 if it has to go through cJSON
+static int print_scan_result_extract(const char *response) {
+    extract_rows.count = 0;
+    extract_rows.failed = 0;
+    if (loquat_extract_scan(response, strlen(response), extract_collect_row, &extract_rows) < 0 ||
+        extract_rows.failed) {
+        return 0;
+    }
+    output_scan_begin();
+    for (size_t i = 0; i < extract_rows.count; i++) {
+        extract_print_row(&extract_rows.rows[i], (int)i);
+    }
+    output_scan_end();
+    return 1;
+}
+
+// Print one access point row as soon as the streaming parser completes it.
+// The row is written out straight away rather than left in the output
+// buffer, which would otherwise hold it until the scan ends
+void print_scan_row(const LoquatAccessPoint *ap, void *userdata) {
+    int *rows = userdata;
+    if (*rows == 0) {
+        output_scan_begin();
+    }
+    output_scan_ap(ap->ssid, ap->bars, ap->security, (*rows)++);
+    output_flush();
+}
+
+void print_scan_result(const char *response) {
+    if (!response) {
+        fprintf(stderr, "No response data\n");
+        return;
+    }
+
+    if (result_parser != RESULT_PARSER_CJSON && print_scan_result_extract(response)) {
+        return;
+    }
     
     // Parse JSON using cJSON
     cJSON *json = cJSON_Parse(response);
@@ -336,10 +1103,12 @@ void print_scan_result(const char *response) {
         return;
     }
     
+    output_scan_begin();
+    
     // Iterate through the array
-    int array_size = cJSON_GetArraySize(json);
-    for (int i = 0; i < array_size; i++) {
-        cJSON *ap = cJSON_GetArrayItem(json, i);
+    int index = 0;
+    const cJSON *ap;
+    cJSON_ArrayForEach(ap, json) {
         if (!cJSON_IsObject(ap)) continue;
         
         // Get SSID
@@ -354,23 +1123,75 @@ void print_scan_result(const char *response) {
         cJSON *security_json = cJSON_GetObjectItem(ap, "security");
         const char *security = (security_json && cJSON_IsString(security_json)) ? security_json->valuestring : "Unknown";
         
-        // Print the AP information in a row
-        fprintf(stderr, "%-40s %-8d %-12s\n", ssid, bars, security);
+        // Add the AP information as a row
+        output_scan_ap(ssid, bars, security, index++);
     }
     
-    fprintf(stderr, "\n");
+    output_scan_end();
     
     // Clean up
     cJSON_Delete(json);
 }
 
+// Print the three net-info fields in the selected format
+static void output_net_info(const char *status, const char *ip, const char *ssid) {
+    switch (output_format) {
+        case OUTPUT_TABLE:
+            output_printf("\n=== Network Information ===\n");
+            output_printf("Connection Status: %s\n", status);
+            output_printf("IP Address: %s\n", ip);
+            output_printf("Connected SSID: %s\n\n", ssid);
+            break;
+        case OUTPUT_JSON:
+        case OUTPUT_NDJSON:
+            output_append("{\"status\":", 10);
+            output_json_string(status);
+            output_append(",\"ip_address\":", 14);
+            output_json_string(ip);
+            output_append(",\"ssid\":", 8);
+            output_json_string(ssid);
+            output_append("}\n", 2);
+            break;
+        case OUTPUT_CSV:
+            output_printf("status,ip_address,ssid\n");
+            output_csv_field(status);
+            output_append(",", 1);
+            output_csv_field(ip);
+            output_append(",", 1);
+            output_csv_field(ssid);
+            output_append("\n", 1);
+            break;
+    }
+    output_flush();
+}
+
+// Copy an extracted net-info field, or "Unknown" if it was not a string
+static void extract_field(const LoquatStringView *view, char *dst, size_t size) {
+    if (view->ptr) {
+        loquat_string_view_copy(view, dst, size);
+    } else {
+        snprintf(dst, size, "Unknown");
+    }
+}
+
 void print_net_info_response(const char *response) {
     if (!response) {
         fprintf(stderr, "No response data\n");
         return;
     }
-    
-    fprintf(stderr, "\n=== Network Information ===\n");
+
+    LoquatNetInfoView info;
+    if (result_parser != RESULT_PARSER_CJSON &&
+        loquat_extract_net_info(response, strlen(response), &info) &&
+        info.status.len < EXTRACT_FIELD_MAX && info.ip_address.len < EXTRACT_FIELD_MAX &&
+        info.ssid.len < EXTRACT_FIELD_MAX) {
+        char status[EXTRACT_FIELD_MAX], ip[EXTRACT_FIELD_MAX], ssid[EXTRACT_FIELD_MAX];
+        extract_field(&info.status, status, sizeof(status));
+        extract_field(&info.ip_address, ip, sizeof(ip));
+        extract_field(&info.ssid, ssid, sizeof(ssid));
+        output_net_info(status, ip, ssid);
+        return;
+    }
     
     // Parse JSON using cJSON
     cJSON *json = cJSON_Parse(response);
@@ -382,35 +1203,36 @@ void print_net_info_response(const char *response) {
     // Get status
     cJSON *status_json = cJSON_GetObjectItem(json, "status");
     const char *status = (status_json && cJSON_IsString(status_json)) ? status_json->valuestring : "Unknown";
-    fprintf(stderr, "Connection Status: %s\n", status);
     
     // Get IP address
     cJSON *ip_json = cJSON_GetObjectItem(json, "ip_address");
     const char *ip = (ip_json && cJSON_IsString(ip_json)) ? ip_json->valuestring : "Unknown";
-    fprintf(stderr, "IP Address: %s\n", ip);
     
     // Get SSID
     cJSON *ssid_json = cJSON_GetObjectItem(json, "ssid");
     const char *ssid = (ssid_json && cJSON_IsString(ssid_json)) ? ssid_json->valuestring : "Unknown";
-    fprintf(stderr, "Connected SSID: %s\n", ssid);
     
-    fprintf(stderr, "\n");
+    output_net_info(status, ip, ssid);
     
     // Clean up
     cJSON_Delete(json);
 }
 
+
 void print_response(const char *command, const char *response) {
     if (strcmp(command, "get_scan_result") == 0) {
         print_scan_result(response);
-    } else if (strcmp(command, "connect") == 0) {
-        fprintf(stderr, "Response:\n%s\n", response);
-    } else if (strcmp(command, "apikey") == 0) {
-        fprintf(stderr, "Response:\n%s\n", response);
     } else if (strcmp(command, "get_net_info") == 0) {
         print_net_info_response(response);
-    } else {
+    } else if (strcmp(command, "connect") != 0 && strcmp(command, "apikey") != 0 &&
+               strcmp(command, "upload") != 0) {
         fprintf(stderr, "Invalid print response: %s\n", command);
+    } else if (output_format == OUTPUT_TABLE) {
+        fprintf(stderr, "Response:\n%s\n", response);
+    } else {
+        // The device's reply is already JSON; pass it through
+        output_printf("%s\n", response);
+        output_flush();
     }
 }
 
@@ -506,162 +1328,2476 @@ char* get_post_apikey_data(const char *apikey, const char *aiserver) {
     return json_string;
 }
 
-
-
-// Example usage and main function
-int main(int argc, char *argv[]) {
-    char *server = NULL;
-    char *port = NULL;
-    char *command = NULL;
-    char *ssid = NULL;
-    char *psk = NULL;
-    char *security = NULL;
-    char *apikey = NULL;
-    char *aiserver = NULL;
-    
-    int opt;
-    const char *optstring = "s:p:c:w:k:e:a:i:";
-    static struct option long_options[] = {
-        {"server", required_argument, 0, 's'},
-        {"port", required_argument, 0, 'p'},
-        {"com", required_argument, 0, 'c'},
-        {"ssid", required_argument, 0, 'w'},
-        {"psk", required_argument, 0, 'k'},
-        {"security", required_argument, 0, 'e'},
-        {"apikey", required_argument, 0, 'a'},
-        {"aiserver", required_argument, 0, 'i'},
-        {0, 0, 0, 0}
-    };
-    
-    // Parse command line arguments
-    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
-        switch (opt) {
-            case 's':
-                server = optarg;
-                break;
-            case 'p':
-                port = optarg;
-                break;
-            case 'c':
-                command = optarg;
-                break;
-            case 'w':
-                ssid = optarg;
-                break;
-            case 'k':
-                psk = optarg;
-                break;
-            case 'e':
-                security = optarg;
-                break;
-            case 'a':
-                apikey = optarg;
-                break;
-            case 'i':
-                aiserver = optarg;
-                break;
-            case '?':
-                fprintf(stderr, "Usage: %s --server <ip> --port <port> --com <command> [--ssid <ssid>] [--psk <key>] [--security <type>] [--apikey <key>] [--aiserver <server>]\n", argv[0]);
-                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result\n", argv[0]);
-                fprintf(stderr, "Example: %s --server localhost --port 3000 --com status --ssid MyWiFi --psk password123 --security WPA2\n", argv[0]);
-                fprintf(stderr, "Example: %s --server api.example.com --port 443 --com connect --ssid MyWiFi --psk password123 --apikey your-api-key\n", argv[0]);
-                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result --aiserver ai.example.com\n", argv[0]);
-                return 1;
-            default:
-                fprintf(stderr, "Unknown option: %c\n", opt);
-                return 1;
-        }
-    }
-    
-    // Check required parameters
-    if (!server || !port || !command) {
-        fprintf(stderr, "Error: --server, --port, and --com are required parameters\n");
-        fprintf(stderr, "Usage: %s --server <ip> --port <port> --com <command> [--ssid <ssid>] [--psk <key>] [--security <type>] [--apikey <key>] [--aiserver <server>]\n", argv[0]);
-        return 1;
+// Map the file given with --file for the upload command
+LoquatImage* open_upload_image(const char *path) {
+    if (!path || !path[0]) {
+        fprintf(stderr, "Error: --file is required for upload command\n");
+        return NULL;
     }
-    
-    // Construct the base URL
-    char base_url[512];
-    snprintf(base_url, sizeof(base_url), "http://%s:%s", server, port);
-    
-    fprintf(stderr, "Connecting to: %s\n", base_url);
-    fprintf(stderr, "Command: %s\n", command);
-    if (ssid) fprintf(stderr, "SSID: %s\n", ssid);
-    if (psk) fprintf(stderr, "PSK: %s\n", psk);
-    if (security) fprintf(stderr, "Security: %s\n", security);
-    if (apikey) fprintf(stderr, "API Key: %s\n", apikey);
-    if (aiserver) fprintf(stderr, "AI Server: %s\n", aiserver);
-    fprintf(stderr, "Full URL: %s/%s\n\n", base_url, command);
-    
-    // Create client instance
-    LoquatClient *client = loquat_client_init(base_url);
-    if (!client) {
-        fprintf(stderr, "Failed to initialize client\n");
-        return 1;
+    return loquat_image_open(path);
+}
+
+void free_targets(char **targets, int count) {
+    if (!targets) return;
+    for (int i = 0; i < count; i++) {
+        free(targets[i]);
     }
-    
-    char *response = NULL;
-    int http_code;
+    free(targets);
+}
 
-    if (!is_valid_command(command)) {
-        fprintf(stderr, "Invalid command: %s\n", command);
-        goto cleanup;
+// Read a list of devices, one per line, as base URLs. Lines may hold a
+// full URL, "host:port", or a bare host that uses default_port.
+// Blank lines and lines starting with '#' are ignored. path "-" reads stdin.
+// A file that lists no devices gives an empty list with count 0; NULL is
+// returned only after an error has been reported.
+char** load_targets(const char *path, const char *default_port, int *count) {
+    FILE *fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open targets file: %s\n", path);
+        return NULL;
     }
 
-    if (is_get_command(command)) {
-        fprintf(stderr, "Making GET request...\n");
-        if (loquat_client_get(client, command, &response, &http_code)) {
-            if (http_code != 200) {
-                fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
-            } else {
-                print_response(command, response);
+    char **targets = NULL;
+    int capacity = 0;
+    int n = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int lineno = 0;
+    int failed = 0;
+
+    // Lines are read whole, however long, so none is split into two targets
+    while (getline(&line, &line_size, fp) != -1) {
+        lineno++;
+
+        // Trim surrounding whitespace
+        char *start = line;
+        while (isspace((unsigned char)*start)) start++;
+        char *end = start + strlen(start);
+        while (end > start && isspace((unsigned char)end[-1])) end--;
+        *end = '\0';
+
+        if (*start == '\0' || *start == '#') continue;
+
+        // Scheme and port are added where the line leaves them out
+        const char *scheme = "http://";
+        const char *port = "";
+        if (strstr(start, "://")) {
+            scheme = "";
+        } else if (!strchr(start, ':')) {
+            if (!default_port) {
+                fprintf(stderr, "Error: No port for target '%s' (use host:port or --port)\n", start);
+                continue;
             }
-            loquat_client_free_response(response);
+            port = default_port;
         }
-        else if (strcmp(command, "get_net_info") == 0) {
-            fprintf(stderr, "Getting network information...\n");
-            if (loquat_client_get(client, command, &response, &http_code)) {
-                if (http_code != 200) {
-                    fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
-                } else {
-                    print_response(command, response);
-                }
-                loquat_client_free_response(response);
+
+        if (n == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(targets, capacity * sizeof(char *));
+            if (!grown) {
+                fprintf(stderr, "Memory allocation failed\n");
+                failed = 1;
+                break;
             }
+            targets = grown;
         }
-    } else {
-        fprintf(stderr, "Making POST request...\n");
-        
-        // Get POST data for commands that need it
-        char *post_data = NULL;
-        if (strcmp(command, "connect") == 0) {
-            post_data = get_post_connect_wifi_data(ssid, psk, security);
-            printf("POST data: %s\n", post_data);
-            fprintf(stderr, "Using 120-second timeout for WiFi connection...\n");
-        } else if (strcmp(command, "apikey") == 0) {
-            post_data = get_post_apikey_data(apikey, aiserver);
-            printf("POST data: %s\n", post_data);
-            fprintf(stderr, "Using 120-second timeout for API key...\n");
-        }
-        
-        if (loquat_client_post(client, command, post_data, &response, &http_code)) {
-            if (http_code != 200) {
-                fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
-            } else {
-                print_response(command, response);
-            }
-            loquat_client_free_response(response);
+        int url_len = snprintf(NULL, 0, "%s%s%s%s", scheme, start, port[0] ? ":" : "", port);
+        targets[n] = url_len < 0 ? NULL : malloc((size_t)url_len + 1);
+        if (!targets[n]) {
+            fprintf(stderr, "Memory allocation failed\n");
+            failed = 1;
+            break;
         }
-        
-        // Free POST data if it was allocated
-        if (post_data) {
-            free(post_data);
+        snprintf(targets[n], (size_t)url_len + 1, "%s%s%s%s", scheme, start, port[0] ? ":" : "", port);
+        n++;
+    }
+
+    if (!failed && ferror(fp)) {
+        fprintf(stderr, "Error: Cannot read targets file: %s\n", path);
+        failed = 1;
+    }
+    free(line);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+
+    if (!failed && !targets) {
+        targets = malloc(sizeof(char *));
+        if (!targets) {
+            fprintf(stderr, "Memory allocation failed\n");
+            failed = 1;
         }
     }
+    // A partial list would silently leave devices out
+    if (failed) {
+        free_targets(targets, n);
+        *count = 0;
+        return NULL;
+    }
 
-cleanup:    
+    *count = n;
+    return targets;
+}
+
+static const char *timing_phase_names[TIMING_PHASES] = {
+    "dns", "connect", "tls", "pretransfer", "ttfb", "total"
+};
+
+// Latency histograms for one command or one device
+typedef struct {
+    char *label;
+    LoquatHistogram *phases[TIMING_PHASES];   // NULL for phases not tracked
+} TimingSeries;
+
+// Latency histograms collected by --timing over a batch, watch or fleet run
+typedef struct {
+    TimingSeries *series;
+    int count;
+    int capacity;
+} TimingReport;
+
+// Seconds from the start of the request to the end of a phase
+static double timing_phase(const LoquatTiming *timing, int phase) {
+    switch (phase) {
+        case 0: return timing->name_lookup;
+        case 1: return timing->connect;
+        case 2: return timing->app_connect;
+        case 3: return timing->pre_transfer;
+        case 4: return timing->start_transfer;
+        default: return timing->total;
+    }
+}
+
+// Print the phase timings of one request
+void print_timing(const LoquatTiming *timing) {
+    fprintf(stderr, "Timing:");
+    for (int i = 0; i < TIMING_PHASES; i++) {
+        fprintf(stderr, "%s %s %.3f ms", i ? "," : "", timing_phase_names[i], timing_phase(timing, i) * 1000.0);
+    }
+    fprintf(stderr, " (%lld bytes down, %lld up, %d redirects)\n",
+            (long long)timing->bytes_down, (long long)timing->bytes_up, timing->redirect_count);
+}
+
+// Find the series for label, adding it if needed
+static TimingSeries* timing_report_series(TimingReport *report, const char *label) {
+    for (int i = 0; i < report->count; i++) {
+        if (strcmp(report->series[i].label, label) == 0) {
+            return &report->series[i];
+        }
+    }
+
+    if (report->count == report->capacity) {
+        int capacity = report->capacity ? report->capacity * 2 : 16;
+        TimingSeries *series = realloc(report->series, (size_t)capacity * sizeof(TimingSeries));
+        if (!series) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return NULL;
+        }
+        report->series = series;
+        report->capacity = capacity;
+    }
+
+    TimingSeries *series = &report->series[report->count];
+    memset(series, 0, sizeof(TimingSeries));
+    series->label = strdup(label);
+    if (!series->label) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return NULL;
+    }
+    report->count++;
+    return series;
+}
+
+// Record one phase of a request in a series
+static void timing_series_record(TimingSeries *series, int phase, double seconds) {
+    if (!series->phases[phase]) {
+        series->phases[phase] = loquat_histogram_init();
+        if (!series->phases[phase]) return;
+    }
+    loquat_histogram_record(series->phases[phase], seconds);
+}
+
+// Add one completed request to the per-command and per-device histograms.
+// Commands track every phase; devices track total time only, so that
+// fleet runs over thousands of devices stay small.
+void timing_report_record(TimingReport *report, const char *command, const char *device,
+                          const LoquatTiming *timing) {
+    // Labels are joined like URLs, on the heap when a device name is long
+    char label_buf[MAX_URL_LENGTH];
+    char *label = loquat_url_join(label_buf, sizeof(label_buf), "command ", "", command);
+    TimingSeries *series = label ? timing_report_series(report, label) : NULL;
+    loquat_url_release(label, label_buf);
+    if (series) {
+        for (int i = 0; i < TIMING_PHASES; i++) {
+            // No TLS handshake on plain HTTP
+            if (i == 2 && timing->app_connect <= 0) continue;
+            timing_series_record(series, i, timing_phase(timing, i));
+        }
+    }
+
+    label = loquat_url_join(label_buf, sizeof(label_buf), "device ", "", device);
+    series = label ? timing_report_series(report, label) : NULL;
+    loquat_url_release(label, label_buf);
+    if (series) {
+        timing_series_record(series, TIMING_PHASES - 1, timing->total);
+    }
+}
+
+// Print p50/p90/p99/max of every series in the report
+void timing_report_print(const TimingReport *report) {
+    if (report->count == 0) {
+        return;
+    }
+
+    fprintf(stderr, "\nTiming summary (ms):\n");
+    fprintf(stderr, "%-40s %-12s %8s %10s %10s %10s %10s\n", "series", "phase", "count", "p50", "p90", "p99", "max");
+    for (int i = 0; i < report->count; i++) {
+        const TimingSeries *series = &report->series[i];
+        for (int j = 0; j < TIMING_PHASES; j++) {
+            const LoquatHistogram *h = series->phases[j];
+            if (!h) continue;
+            fprintf(stderr, "%-40s %-12s %8lu %10.3f %10.3f %10.3f %10.3f\n",
+                    series->label, timing_phase_names[j], loquat_histogram_count(h),
+                    loquat_histogram_percentile(h, 50) * 1000.0,
+                    loquat_histogram_percentile(h, 90) * 1000.0,
+                    loquat_histogram_percentile(h, 99) * 1000.0,
+                    loquat_histogram_max(h) * 1000.0);
+        }
+    }
+}
+
+// Free the histograms held by a report
+void timing_report_free(TimingReport *report) {
+    for (int i = 0; i < report->count; i++) {
+        free(report->series[i].label);
+        for (int j = 0; j < TIMING_PHASES; j++) {
+            loquat_histogram_cleanup(report->series[i].phases[j]);
+        }
+    }
+    free(report->series);
+    memset(report, 0, sizeof(TimingReport));
+}
+
+// Rounded to microseconds for output
+static double timing_ms(double seconds) {
+    return (double)(long long)(seconds * 1e6) / 1000.0;
+}
+
+// Print one structured (JSON) result line for a completed command; timing
+// adds a breakdown of the request phases when not NULL
+void print_result_line(const char *target, const char *command, int ok, int http_code,
+                       const char *error, const char *response, size_t response_size,
+                       double total_time, const LoquatTiming *timing) {
+    cJSON *json = cJSON_CreateObject();
+    if (!json) {
+        fprintf(stderr, "Failed to create JSON object\n");
+        return;
+    }
+
+    cJSON_AddStringToObject(json, "target", target);
+    cJSON_AddStringToObject(json, "command", command);
+    if (ok) {
+        cJSON_AddNumberToObject(json, "http_code", http_code);
+        // Embed JSON bodies as-is, anything else as a string
+        cJSON *body = cJSON_ParseWithLength(response, response_size);
+        if (body) {
+            cJSON_AddItemToObject(json, "response", body);
+        } else {
+            cJSON_AddStringToObject(json, "response", response);
+        }
+    } else {
+        cJSON_AddStringToObject(json, "error", error);
+    }
+    cJSON_AddNumberToObject(json, "time_ms", timing_ms(total_time));
+    if (timing) {
+        cJSON *phases = cJSON_AddObjectToObject(json, "timing");
+        if (phases) {
+            for (int i = 0; i < TIMING_PHASES; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "%s_ms", timing_phase_names[i]);
+                cJSON_AddNumberToObject(phases, name, timing_ms(timing_phase(timing, i)));
+            }
+            cJSON_AddNumberToObject(phases, "bytes_down", (double)timing->bytes_down);
+            cJSON_AddNumberToObject(phases, "bytes_up", (double)timing->bytes_up);
+            cJSON_AddNumberToObject(phases, "redirects", timing->redirect_count);
+        }
+    }
+
+    char *line = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    if (!line) {
+        fprintf(stderr, "Failed to create JSON string\n");
+        return;
+    }
+
+    printf("%s\n", line);
+    fflush(stdout);
+    cJSON_free(line);
+}
+
+static const char* connect_state_name(int state) {
+    switch (state) {
+        case LOQUAT_CONNECT_JOINED: return "joined";
+        case LOQUAT_CONNECT_FAILED: return "failed";
+        default: return "timeout";
+    }
+}
+
+// Print the outcome of a Wi-Fi join
+void print_connect_result(const LoquatConnectResult *result) {
+    if (result->state == LOQUAT_CONNECT_JOINED) {
+        fprintf(stderr, "Connected in %.1f s", result->elapsed);
+        if (result->ip_address[0]) {
+            fprintf(stderr, " (IP address: %s)", result->ip_address);
+        }
+        fprintf(stderr, "\n");
+    } else if (result->state == LOQUAT_CONNECT_FAILED) {
+        fprintf(stderr, "Error: Connection failed after %.1f s (%s)\n", result->elapsed, result->status);
+    } else {
+        fprintf(stderr, "Error: Not connected after %.1f s (last status: %s)\n", result->elapsed,
+                result->status[0] ? result->status : "unknown");
+    }
+}
+
+void print_upload_result(const LoquatUploadResult *result) {
+    fprintf(stderr, "Uploaded %zu bytes in %.1f s", result->size, result->elapsed);
+    if (result->resumes > 0) {
+        fprintf(stderr, " (resumed %d time(s), last from byte %zu)", result->resumes, result->resumed_from);
+    }
+    fprintf(stderr, "\n");
+}
+
+void print_download_result(const LoquatDownloadResult *result) {
+    fprintf(stderr, "Downloaded %zu bytes in %.1f s", result->size, result->elapsed);
+    if (result->ranged) {
+        fprintf(stderr, " (%d segment(s)", result->segments);
+        if (result->resumed > 0) {
+            fprintf(stderr, ", %zu bytes kept from an earlier attempt", result->resumed);
+        }
+        fprintf(stderr, ")");
+    } else {
+        fprintf(stderr, " (single stream; the device does not support Range)");
+    }
+    fprintf(stderr, "\n");
+}
+
+// Describe the outcome of a Wi-Fi join as a JSON object (caller frees with cJSON_free)
+char* connect_result_json(const LoquatConnectResult *result) {
+    cJSON *json = cJSON_CreateObject();
+    if (!json) {
+        return NULL;
+    }
+    cJSON_AddStringToObject(json, "state", connect_state_name(result->state));
+    cJSON_AddStringToObject(json, "status", result->status);
+    cJSON_AddStringToObject(json, "ip_address", result->ip_address);
+    cJSON_AddNumberToObject(json, "probes", result->probes);
+    char *text = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return text;
+}
+
+// What the fleet result callback needs to print and record a result
+typedef struct {
+    const char *command;
+    TimingReport *report;     // NULL unless --timing
+    int concurrency;          // Limit when the last request finished
+    int retried;              // Requests sent again after a 429 or 503
+} FleetOutput;
+
+// Print one result line per device as soon as it completes
+void print_fleet_result(const LoquatFleetResult *result, void *userdata) {
+    FleetOutput *output = userdata;
+    print_result_line(result->target, output->command, result->ok, result->http_code, result->error,
+                      result->response, result->response_size, result->total_time,
+                      output->report ? &result->timing : NULL);
+    if (output->report && result->ok) {
+        timing_report_record(output->report, output->command, result->target, &result->timing);
+    }
+    if (result->resumes > 0) {
+        fprintf(stderr, "%s: upload resumed %d time(s)\n", result->target, result->resumes);
+    }
+    if (result->retries > 0) {
+        fprintf(stderr, "%s: refused, sent %d more time(s)\n", result->target, result->retries);
+        output->retried++;
+    }
+    output->concurrency = result->concurrency;
+}
+
+// Run one command against every device listed in targets_file, or upload
+// image to each when it is set. At most device_rate requests per second go
+// to any one device (0 for no limit)
+int run_fleet(const char *targets_file, const char *default_port, const char *command,
+              const char *post_data, LoquatImage *image, int concurrency, double device_rate,
+              TimingReport *report) {
+    int count = 0;
+    char **targets = load_targets(targets_file, default_port, &count);
+    if (!targets) {
+        return 0;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Error: No targets listed in %s\n", targets_file);
+        free_targets(targets, count);
+        return 0;
+    }
+
+    LoquatFleetOptions options;
+    loquat_fleet_options_init(&options, concurrency);
+    options.device_rate = device_rate;
+
+    fprintf(stderr, "Running %s on %d device(s), concurrency up to %d\n", command, count,
+            concurrency > 0 ? concurrency : 32);
+    FleetOutput output = { command, report, 0, 0 };
+    int ret = loquat_fleet_run_paced((const char **)targets, count, command, post_data, image, &options,
+                                     print_fleet_result, &output);
+    if (count > 0) {
+        fprintf(stderr, "Concurrency ended at %d", output.concurrency);
+        if (output.retried > 0) {
+            fprintf(stderr, "; %d request(s) refused and sent again", output.retried);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    free_targets(targets, count);
+    return ret;
+}
+
+// Merging scans from every device at a site
+typedef struct {
+    LoquatSurvey *survey;
+    int device;
+} SurveyDevice;
+
+typedef struct {
+    LoquatSurvey *survey;
+    int scanned;              // Devices whose scan was merged
+    int failed;               // Devices with no usable scan
+    TimingReport *report;     // NULL unless --timing
+} SurveyRun;
+
+// What the survey report callback needs
+typedef struct {
+    char **targets;
+    int printed;
+    char *devices;               // Space-joined devices of a CSV row, reused
+    size_t devices_capacity;
+} SurveyOutput;
+
+// Join the devices that saw ap with spaces into output->devices
+static const char* survey_device_list(SurveyOutput *output, const LoquatSurveyAp *ap) {
+    size_t len = 0;
+    for (int i = 0; i < ap->device_count; i++) {
+        len += strlen(output->targets[ap->devices[i]]) + 1;
+    }
+    if (len + 1 > output->devices_capacity) {
+        char *grown = realloc(output->devices, len + 1);
+        if (!grown) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return "";
+        }
+        output->devices = grown;
+        output->devices_capacity = len + 1;
+    }
+
+    char *p = output->devices;
+    for (int i = 0; i < ap->device_count; i++) {
+        const char *target = output->targets[ap->devices[i]];
+        size_t target_len = strlen(target);
+        if (i > 0) *p++ = ' ';
+        memcpy(p, target, target_len);
+        p += target_len;
+    }
+    *p = '\0';
+    return output->devices;
+}
+
+static void survey_add_ap(const LoquatAccessPoint *ap, void *userdata) {
+    SurveyDevice *device = userdata;
+    loquat_survey_add(device->survey, device->device, ap);
+}
+
+// Merge one device's scan as soon as it arrives
+static void survey_device_result(const LoquatFleetResult *result, void *userdata) {
+    SurveyRun *run = userdata;
+    if (!result->ok) {
+        fprintf(stderr, "%s: %s\n", result->target, result->error);
+        run->failed++;
+        return;
+    }
+    if (result->http_code != 200) {
+        fprintf(stderr, "%s: HTTP Code: %d\n", result->target, result->http_code);
+        run->failed++;
+        return;
+    }
+
+    SurveyDevice device = { run->survey, result->index };
+    LoquatScanParser parser;
+    loquat_scan_parser_init(&parser, survey_add_ap, &device);
+    loquat_scan_parser_feed(&parser, result->response, result->response_size);
+    if (!loquat_scan_parser_finish(&parser)) {
+        // Access points before the error have already been merged
+        fprintf(stderr, "%s: Failed to parse scan result\n", result->target);
+        run->failed++;
+        return;
+    }
+    run->scanned++;
+    if (run->report) {
+        timing_report_record(run->report, "get_scan_result", result->target, &result->timing);
+    }
+}
+
+// Print one merged access point
+static void print_survey_ap(const LoquatSurveyAp *ap, void *userdata) {
+    SurveyOutput *output = userdata;
+    char **targets = output->targets;
+    const LoquatAccessPoint *info = ap->ap;
+
+    switch (output_format) {
+        case OUTPUT_TABLE:
+            output_printf("%-32s %-17s %-12s %4d %5d %5.1f %7d\n", info->ssid,
+                          info->bssid[0] ? info->bssid : "-", info->security,
+                          ap->best_bars, ap->worst_bars, ap->mean_bars, ap->device_count);
+            break;
+        case OUTPUT_JSON:
+        case OUTPUT_NDJSON:
+            if (output_format == OUTPUT_JSON && output->printed > 0) {
+                output_append(",\n", 2);
+            }
+            output_append("{\"ssid\":", 8);
+            output_json_string(info->ssid);
+            if (info->bssid[0]) {
+                output_append(",\"bssid\":", 9);
+                output_json_string(info->bssid);
+            }
+            output_append(",\"security\":", 12);
+            output_json_string(info->security);
+            output_printf(",\"best_bars\":%d,\"worst_bars\":%d,\"mean_bars\":%.2f,\"observations\":%lu,\"devices\":[",
+                          ap->best_bars, ap->worst_bars, ap->mean_bars, ap->observations);
+            for (int i = 0; i < ap->device_count; i++) {
+                if (i > 0) output_append(",", 1);
+                output_json_string(targets[ap->devices[i]]);
+            }
+            output_append(output_format == OUTPUT_JSON ? "]}" : "]}\n", output_format == OUTPUT_JSON ? 2 : 3);
+            break;
+        case OUTPUT_CSV:
+            output_csv_field(info->ssid);
+            output_append(",", 1);
+            output_csv_field(info->bssid);
+            output_append(",", 1);
+            output_csv_field(info->security);
+            output_printf(",%d,%d,%.2f,%lu,", ap->best_bars, ap->worst_bars, ap->mean_bars, ap->observations);
+            // Devices as one field, separated by spaces and quoted like the others
+            output_csv_field(survey_device_list(output, ap));
+            output_append("\n", 1);
+            break;
+    }
+    output->printed++;
+}
+
+// Scan every device in targets_file and print the merged access points
+int run_survey(const char *targets_file, const char *default_port, int concurrency, TimingReport *report) {
+    int count = 0;
+    char **targets = load_targets(targets_file, default_port, &count);
+    if (!targets) {
+        return 0;
+    }
+    if (count == 0) {
+        fprintf(stderr, "Error: No targets listed in %s\n", targets_file);
+        free_targets(targets, count);
+        return 0;
+    }
+
+    SurveyRun run = { loquat_survey_init(), 0, 0, report };
+    if (!run.survey) {
+        free_targets(targets, count);
+        return 0;
+    }
+
+    fprintf(stderr, "Surveying %d device(s), concurrency %d\n", count, concurrency);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = loquat_fleet_run((const char **)targets, count, "get_scan_result", NULL,
+                               concurrency, survey_device_result, &run);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    switch (output_format) {
+        case OUTPUT_TABLE:
+            output_printf("\n=== Site Survey ===\n");
+            output_printf("%-32s %-17s %-12s %4s %5s %5s %7s\n", "SSID", "BSSID", "Security",
+                          "Best", "Worst", "Mean", "Devices");
+            break;
+        case OUTPUT_JSON:
+            // One access point per line
+            output_append("[\n", 2);
+            break;
+        case OUTPUT_CSV:
+            output_printf("ssid,bssid,security,best_bars,worst_bars,mean_bars,observations,devices\n");
+            break;
+        case OUTPUT_NDJSON:
+            break;
+    }
+    SurveyOutput output = { targets, 0, NULL, 0 };
+    ret = loquat_survey_report(run.survey, print_survey_ap, &output) && ret;
+    free(output.devices);
+    if (output_format == OUTPUT_JSON) {
+        output_append(output.printed > 0 ? "\n]\n" : "]\n", output.printed > 0 ? 3 : 2);
+    }
+    output_flush();
+
+    fprintf(stderr, "%zu access point(s) from %d device(s) (%d failed) in %.1f ms\n",
+            loquat_survey_size(run.survey), run.scanned, run.failed,
+            (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1e6);
+
+    loquat_survey_cleanup(run.survey);
+    free_targets(targets, count);
+    return ret && run.scanned > 0;
+}
+
+// Load generation: one command at a fixed rate (open loop) or with a fixed
+// number of requests in flight (closed loop) for a set duration. In open
+// loop mode each request's latency is measured from when it was due, not
+// from when it was sent, so a device that stalls is charged for the whole
+// backlog instead of the generator quietly slowing down with it.
+typedef struct {
+    int http_code;            // 0 for transport errors
+    const char *error;        // Transport error message, NULL for HTTP responses
+    unsigned long count;
+} LoadOutcome;
+
+typedef struct LoadRequest {
+    struct LoadRun *run;
+    double due;               // When the request was scheduled to go out
+    struct LoadRequest *next; // Free list link
+} LoadRequest;
+
+typedef struct LoadRun {
+    LoquatAsync *async;
+    const char *base_url;
+    const char *command;
+    const char *post_data;    // NULL for a GET
+    double start;
+    int in_flight;
+    unsigned long sent;
+    unsigned long completed;
+    unsigned long errors;     // Transport errors and HTTP codes >= 400
+    unsigned long window_sent;
+    unsigned long window_completed;
+    unsigned long window_errors;
+    double window_start;
+    LoquatHistogram *latency; // Whole run
+    LoquatHistogram *window;  // Current report interval
+    LoadOutcome outcomes[LOAD_MAX_OUTCOMES];
+    int outcome_count;
+    unsigned long other_outcomes;
+    LoadRequest *free_list;
+    int rows;                 // Interval rows printed
+} LoadRun;
+
+static double load_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Count one response code or transport error
+static void load_count_outcome(LoadRun *run, int http_code, const char *error) {
+    for (int i = 0; i < run->outcome_count; i++) {
+        LoadOutcome *outcome = &run->outcomes[i];
+        if (outcome->http_code == http_code &&
+            (outcome->error == error || (outcome->error && error && strcmp(outcome->error, error) == 0))) {
+            outcome->count++;
+            return;
+        }
+    }
+    if (run->outcome_count == LOAD_MAX_OUTCOMES) {
+        run->other_outcomes++;
+        return;
+    }
+    LoadOutcome *outcome = &run->outcomes[run->outcome_count++];
+    outcome->http_code = http_code;
+    outcome->error = error;
+    outcome->count = 1;
+}
+
+static void load_request_done(const LoquatAsyncResult *result, void *userdata) {
+    LoadRequest *req = userdata;
+    LoadRun *run = req->run;
+    double latency = load_now() - req->due;
+
+    loquat_histogram_record(run->latency, latency);
+    loquat_histogram_record(run->window, latency);
+    run->completed++;
+    run->window_completed++;
+    if (!result->ok || result->http_code >= 400) {
+        run->errors++;
+        run->window_errors++;
+    }
+    load_count_outcome(run, result->ok ? result->http_code : 0, result->ok ? NULL : result->error);
+
+    run->in_flight--;
+    req->next = run->free_list;
+    run->free_list = req;
+}
+
+// Send one request that was due at the given time
+static int load_submit(LoadRun *run, double due) {
+    LoadRequest *req = run->free_list;
+    if (req) {
+        run->free_list = req->next;
+    } else {
+        req = malloc(sizeof(LoadRequest));
+        if (!req) {
+            fprintf(stderr, "Memory allocation failed\n");
+            return 0;
+        }
+    }
+    req->run = run;
+    req->due = due;
+
+    int ok = run->post_data
+        ? loquat_async_post(run->async, run->base_url, run->command, run->post_data, load_request_done, req)
+        : loquat_async_get(run->async, run->base_url, run->command, load_request_done, req);
+    if (!ok) {
+        req->next = run->free_list;
+        run->free_list = req;
+        return 0;
+    }
+    run->in_flight++;
+    run->sent++;
+    run->window_sent++;
+    return 1;
+}
+
+// Print the report interval that ends now and start the next one
+static void load_print_interval(LoadRun *run, double now) {
+    double span = now - run->window_start;
+    double rate = span > 0 ? (double)run->window_completed / span : 0.0;
+    double p50 = loquat_histogram_percentile(run->window, 50) * 1000.0;
+    double p90 = loquat_histogram_percentile(run->window, 90) * 1000.0;
+    double p99 = loquat_histogram_percentile(run->window, 99) * 1000.0;
+    double max = loquat_histogram_max(run->window) * 1000.0;
+    double elapsed = now - run->start;
+
+    switch (output_format) {
+        case OUTPUT_TABLE:
+            output_printf("%8.1f %8lu %8lu %9.1f %8lu %10.3f %10.3f %10.3f %10.3f\n", elapsed,
+                          run->window_sent, run->window_completed, rate, run->window_errors,
+                          p50, p90, p99, max);
+            break;
+        case OUTPUT_JSON:
+        case OUTPUT_NDJSON:
+            if (output_format == OUTPUT_JSON && run->rows > 0) {
+                output_append(",\n", 2);
+            }
+            output_printf("{\"time\":%.3f,\"sent\":%lu,\"completed\":%lu,\"rate\":%.1f,\"errors\":%lu,"
+                          "\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}%s",
+                          elapsed, run->window_sent, run->window_completed, rate, run->window_errors,
+                          p50, p90, p99, max, output_format == OUTPUT_NDJSON ? "\n" : "");
+            break;
+        case OUTPUT_CSV:
+            output_printf("%.3f,%lu,%lu,%.1f,%lu,%.3f,%.3f,%.3f,%.3f\n", elapsed, run->window_sent,
+                          run->window_completed, rate, run->window_errors, p50, p90, p99, max);
+            break;
+    }
+    output_flush();
+    run->rows++;
+
+    loquat_histogram_cleanup(run->window);
+    run->window = loquat_histogram_init();
+    run->window_sent = 0;
+    run->window_completed = 0;
+    run->window_errors = 0;
+    run->window_start = now;
+}
+
+// Drive command at rate requests per second (open loop) or, when rate is
+// 0, with concurrency requests always in flight (closed loop)
+int run_load(const char *base_url, const char *unix_socket, const char *command, const char *post_data,
+             double rate, int concurrency, double duration) {
+    LoadRun run;
+    memset(&run, 0, sizeof(run));
+    run.base_url = base_url;
+    run.command = command;
+    run.post_data = post_data;
+    run.async = loquat_async_init();
+    run.latency = loquat_histogram_init();
+    run.window = loquat_histogram_init();
+    if (!run.async || !run.latency || !run.window ||
+        !loquat_async_set_unix_socket(run.async, unix_socket)) {
+        loquat_async_cleanup(run.async);
+        loquat_histogram_cleanup(run.latency);
+        loquat_histogram_cleanup(run.window);
+        return 0;
+    }
+
+    int max_in_flight = concurrency > 0 ? concurrency : LOAD_MAX_IN_FLIGHT;
+    if (rate > 0) {
+        fprintf(stderr, "Load: %s/%s at %.1f req/s for %.1f s (open loop, up to %d in flight)\n",
+                base_url, command, rate, duration, max_in_flight);
+    } else {
+        fprintf(stderr, "Load: %s/%s with %d in flight for %.1f s (closed loop)\n",
+                base_url, command, max_in_flight, duration);
+    }
+
+    switch (output_format) {
+        case OUTPUT_TABLE:
+            output_printf("%8s %8s %8s %9s %8s %10s %10s %10s %10s\n", "time", "sent", "done", "req/s",
+                          "errors", "p50 ms", "p90 ms", "p99 ms", "max ms");
+            break;
+        case OUTPUT_JSON:
+            output_append("[\n", 2);
+            break;
+        case OUTPUT_CSV:
+            output_printf("time,sent,completed,rate,errors,p50_ms,p90_ms,p99_ms,max_ms\n");
+            break;
+        case OUTPUT_NDJSON:
+            break;
+    }
+    output_flush();
+
+    int ok = 1;
+    unsigned long scheduled = 0;   // Open loop: requests due so far
+    run.start = load_now();
+    run.window_start = run.start;
+    double end = run.start + duration;
+    double next_report = run.start + LOAD_REPORT_INTERVAL;
+
+    for (;;) {
+        double now = load_now();
+        if (now >= next_report && next_report <= end) {
+            load_print_interval(&run, next_report);
+            next_report += LOAD_REPORT_INTERVAL;
+        }
+        if (now >= end) {
+            break;
+        }
+
+        // Send everything that has come due (or top up the closed loop)
+        double next_due = end;
+        while (ok && run.in_flight < max_in_flight) {
+            double due = now;
+            if (rate > 0) {
+                due = run.start + (double)scheduled / rate;
+                if (due > now) {
+                    next_due = due;
+                    break;
+                }
+                scheduled++;
+            }
+            ok = load_submit(&run, due);
+        }
+        if (!ok) {
+            break;
+        }
+
+        // Sleep until the next request is due, a report or the end, unless
+        // the in-flight limit holds requests back until one completes
+        double wake = next_report < end ? next_report : end;
+        if (run.in_flight < max_in_flight && next_due < wake) {
+            wake = next_due;
+        }
+        long wait_ms = (long)((wake - load_now()) * 1000.0);
+        if (!loquat_async_run_once(run.async, wait_ms > 0 ? wait_ms : 0)) {
+            ok = 0;
+            break;
+        }
+    }
+
+    // Requests that came due but were held back by the in-flight limit
+    unsigned long not_sent = 0;
+    if (rate > 0) {
+        double due_total = duration * rate;
+        unsigned long total = (unsigned long)due_total + (due_total > (double)(unsigned long)due_total);
+        not_sent = total > run.sent ? total - run.sent : 0;
+    }
+
+    if (run.in_flight > 0) {
+        fprintf(stderr, "Waiting for %d request(s) in flight\n", run.in_flight);
+    }
+    while (ok && run.in_flight > 0) {
+        ok = loquat_async_run_once(run.async, -1);
+    }
+    double elapsed = load_now() - run.start;
+    if (run.window_sent > 0 || run.window_completed > 0) {
+        load_print_interval(&run, load_now());
+    }
+    if (output_format == OUTPUT_JSON) {
+        output_append(run.rows > 0 ? "\n]\n" : "]\n", run.rows > 0 ? 3 : 2);
+        output_flush();
+    }
+
+    fprintf(stderr, "\nLoad summary: %lu sent, %lu completed, %lu errors in %.2f s (%.1f req/s)\n",
+            run.sent, run.completed, run.errors, elapsed,
+            elapsed > 0 ? (double)run.completed / elapsed : 0.0);
+    if (not_sent > 0) {
+        fprintf(stderr, "%lu scheduled request(s) not sent (limit of %d in flight reached)\n", not_sent, max_in_flight);
+    }
+    for (int i = 0; i < run.outcome_count; i++) {
+        const LoadOutcome *outcome = &run.outcomes[i];
+        if (outcome->error) {
+            fprintf(stderr, "  %-32s %10lu\n", outcome->error, outcome->count);
+        } else {
+            fprintf(stderr, "  HTTP %-27d %10lu\n", outcome->http_code, outcome->count);
+        }
+    }
+    if (run.other_outcomes > 0) {
+        fprintf(stderr, "  %-32s %10lu\n", "other", run.other_outcomes);
+    }
+    fprintf(stderr, "Latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n",
+            loquat_histogram_percentile(run.latency, 50) * 1000.0,
+            loquat_histogram_percentile(run.latency, 90) * 1000.0,
+            loquat_histogram_percentile(run.latency, 99) * 1000.0,
+            loquat_histogram_percentile(run.latency, 99.9) * 1000.0,
+            loquat_histogram_max(run.latency) * 1000.0);
+
+    loquat_async_cleanup(run.async);
+    while (run.free_list) {
+        LoadRequest *req = run.free_list;
+        run.free_list = req->next;
+        free(req);
+    }
+    loquat_histogram_cleanup(run.latency);
+    loquat_histogram_cleanup(run.window);
+    return ok;
+}
+
+// Split a batch line into arguments. Whitespace separates arguments;
+// single or double quotes group them and backslash escapes one character.
+// The line is modified in place. Returns the argument count, or -1 on error.
+int split_batch_line(char *line, char **args, int max_args) {
+    int count = 0;
+    char *src = line;
+
+    while (*src) {
+        while (isspace((unsigned char)*src)) src++;
+        if (*src == '\0' || (*src == '#' && count == 0)) break;
+        if (count == max_args) return -1;
+
+        char *dst = src;
+        args[count++] = dst;
+        char quote = 0;
+        while (*src && (quote || !isspace((unsigned char)*src))) {
+            if (quote && *src == quote) {
+                quote = 0;
+                src++;
+            } else if (!quote && (*src == '"' || *src == '\'')) {
+                quote = *src++;
+            } else if (*src == '\\' && src[1] && quote != '\'') {
+                src++;
+                *dst++ = *src++;
+            } else {
+                *dst++ = *src++;
+            }
+        }
+        if (quote) return -1;
+        if (*src) src++;
+        *dst = '\0';
+    }
+
+    return count;
+}
+
+// Run one batch line on the shared client and print its result line.
+// Returns the HTTP code of the last reply to a request it sent on the
+// client's handle, or 0 if it sent none (bad line, cache hit, no reply)
+int run_batch_command(LoquatClient *client, ResponseData *buffer, int argc, char **argv,
+                       TimingReport *report) {
+    char *command = NULL;
+    char *ssid = NULL;
+    char *psk = NULL;
+    char *security = NULL;
+    char *apikey = NULL;
+    char *aiserver = NULL;
+    char *upload_file = NULL;
+    double deadline = CONNECT_TIMEOUT;
+    const char *base_url = loquat_client_get_base_url(client);
+
+    // Same vocabulary as the command line options
+    static struct option batch_options[] = {
+        {"com", required_argument, 0, 'c'},
+        {"ssid", required_argument, 0, 'w'},
+        {"psk", required_argument, 0, 'k'},
+        {"security", required_argument, 0, 'e'},
+        {"apikey", required_argument, 0, 'a'},
+        {"aiserver", required_argument, 0, 'i'},
+        {"deadline", required_argument, 0, 'd'},
+        {"file", required_argument, 0, 'F'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    optind = 0;
+    while ((opt = getopt_long(argc, argv, "c:w:k:e:a:i:d:F:", batch_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c': command = optarg; break;
+            case 'w': ssid = optarg; break;
+            case 'k': psk = optarg; break;
+            case 'e': security = optarg; break;
+            case 'a': apikey = optarg; break;
+            case 'i': aiserver = optarg; break;
+            case 'd': deadline = atof(optarg); break;
+            case 'F': upload_file = optarg; break;
+            default:
+                print_result_line(base_url, argv[1], 0, 0, "Invalid option", "", 0, 0.0, NULL);
+                return 0;
+        }
+    }
+
+    // The command may also be given as the first word of the line
+    if (!command && optind < argc) {
+        command = argv[optind];
+    }
+    if (!command || !is_valid_command(command)) {
+        print_result_line(base_url, command ? command : "", 0, 0, "Invalid command", "", 0, 0.0, NULL);
+        return 0;
+    }
+
+    int ok;
+    int http_code = 0;
+    const char *response = "";
+    size_t response_size = 0;
+    char *post_response = NULL;
+
+    if (is_get_command(command)) {
+        // GET bodies land in the reused buffer
+        ok = loquat_client_get_into(client, command, buffer, &http_code);
+        if (ok) {
+            response = buffer->data;
+            response_size = buffer->size;
+        }
+    } else if (strcmp(command, "upload") == 0) {
+        LoquatImage *image = upload_file ? loquat_image_open(upload_file) : NULL;
+        if (!image) {
+            print_result_line(base_url, command, 0, 0, upload_file ? "Cannot open file" : "Missing arguments",
+                              "", 0, 0.0, NULL);
+            return 0;
+        }
+        LoquatUploadResult result;
+        ok = loquat_client_upload(client, command, image, buffer, &result);
+        loquat_image_close(image);
+        LoquatTiming timing;
+        loquat_client_get_timing(client, &timing);
+        print_result_line(base_url, command, ok, result.http_code, ok ? NULL : "Upload failed",
+                          ok ? buffer->data : "", ok ? buffer->size : 0, result.elapsed,
+                          report ? &timing : NULL);
+        if (report && ok) {
+            timing_report_record(report, command, base_url, &timing);
+        }
+        return result.http_code;
+    } else {
+        char *post_data = NULL;
+        if (strcmp(command, "connect") == 0) {
+            post_data = get_post_connect_wifi_data(ssid, psk, security);
+        } else if (strcmp(command, "apikey") == 0) {
+            post_data = get_post_apikey_data(apikey, aiserver);
+        }
+        if (!post_data) {
+            print_result_line(base_url, command, 0, 0, "Missing arguments", "", 0, 0.0, NULL);
+            return 0;
+        }
+
+        // Joins finish as soon as the device reports the outcome
+        if (strcmp(command, "connect") == 0) {
+            LoquatConnectResult result;
+            int code = 0;
+            if (!loquat_client_connect_wifi(client, post_data, deadline, &result)) {
+                print_result_line(base_url, command, 0, 0, "Request failed", "", 0, 0.0, NULL);
+            } else {
+                // Only the POST goes out on the client's handle; probes use their own
+                code = result.http_code;
+                char *summary = connect_result_json(&result);
+                const char *error = result.state == LOQUAT_CONNECT_FAILED ? "Connection failed" :
+                                    result.state == LOQUAT_CONNECT_TIMEOUT ? "Connection timed out" : NULL;
+                print_result_line(base_url, command, error == NULL, result.http_code, error,
+                                  summary ? summary : "", summary ? strlen(summary) : 0, result.elapsed, NULL);
+                cJSON_free(summary);
+            }
+            free(post_data);
+            return code;
+        }
+
+        ok = loquat_client_post(client, command, post_data, &post_response, &http_code);
+        if (ok) {
+            response = post_response;
+            response_size = strlen(post_response);
+        }
+        free(post_data);
+    }
+
+    LoquatTiming timing;
+    loquat_client_get_timing(client, &timing);
+    int cached = loquat_client_cache_age(client) >= 0;
+    print_result_line(base_url, command, ok, http_code, ok ? NULL : "Request failed",
+                      response, response_size, timing.total, report ? &timing : NULL);
+    if (report && ok && !cached) {
+        timing_report_record(report, command, base_url, &timing);
+    }
+
+    loquat_client_free_response(post_response);
+    return cached ? 0 : http_code;
+}
+
+// Execute every command in a batch file sequentially over one client,
+// so the whole sequence shares a single kept-alive connection
+int run_batch(const char *base_url, const char *unix_socket, const char *path, LoquatCache *cache,
+              double rate, TimingReport *report) {
+    FILE *fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open batch file: %s\n", path);
+        return 0;
+    }
+
+    LoquatClient *client = loquat_client_init(base_url);
+    if (!client || !loquat_client_set_unix_socket(client, unix_socket)) {
+        fprintf(stderr, "Failed to initialize client\n");
+        loquat_client_cleanup(client);
+        if (fp != stdin) fclose(fp);
+        return 0;
+    }
+    loquat_client_set_cache(client, cache);
+
+    ResponseData buffer;
+    loquat_response_data_init(&buffer, NULL, 0);
+
+    // Commands go out no faster than rate, and not before a Retry-After
+    LoquatTokenBucket bucket;
+    loquat_bucket_init(&bucket, rate, 1.0, load_now());
+
+    // Lines are read whole, so a long one is never run as two commands
+    char *line = NULL;
+    size_t line_size = 0;
+    int lineno = 0;
+    while (getline(&line, &line_size, fp) != -1) {
+        lineno++;
+
+        // args[0] stands in for the program name so getopt_long can be reused
+        char *args[BATCH_MAX_ARGS + 1];
+        args[0] = "batch";
+        int count = split_batch_line(line, args + 1, BATCH_MAX_ARGS);
+        if (count < 0) {
+            fprintf(stderr, "Error: Cannot parse batch line %d\n", lineno);
+            continue;
+        }
+        if (count == 0) continue;
+
+        double wait = loquat_bucket_wait(&bucket, load_now());
+        if (wait > 0) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)wait;
+            ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1e9);
+            nanosleep(&ts, NULL);
+            loquat_bucket_wait(&bucket, load_now());
+        }
+        loquat_bucket_take(&bucket);
+
+        // Only a reply to this line's request can ask for a pause
+        int code = run_batch_command(client, &buffer, count + 1, args, report);
+        double retry_after = (code == 429 || code == 503) ? loquat_retry_after(client->curl) : -1.0;
+        if (retry_after > 0) {
+            fprintf(stderr, "Device asked to wait %.0f s\n", retry_after);
+            loquat_bucket_pause(&bucket, load_now() + retry_after);
+        }
+    }
+
+    free(line);
+    loquat_response_data_free(&buffer);
+    loquat_client_cleanup(client);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return 1;
+}
+
+// Set by SIGINT/SIGTERM to end watch and daemon mode
+static volatile sig_atomic_t stop_requested = 0;
+
+static void stop_signal_handler(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+// Print the local time at the start of a watch output line
+static void print_watch_time(void) {
+    char stamp[16];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&now));
+    printf("%s ", stamp);
+}
+
+// Print one access point difference between consecutive scans
+void print_scan_change(int change, const LoquatAccessPoint *ap, int old_bars, void *userdata) {
+    (void)userdata;
+    print_watch_time();
+    if (change == LOQUAT_AP_ADDED) {
+        printf("+ %-40s %-8d %-12s\n", ap->ssid, ap->bars, ap->security);
+    } else if (change == LOQUAT_AP_REMOVED) {
+        printf("- %-40s %-8d %-12s\n", ap->ssid, ap->bars, ap->security);
+    } else {
+        char bars[32];
+        snprintf(bars, sizeof(bars), "%d -> %d", old_bars, ap->bars);
+        printf("~ %-40s %-8s %-12s\n", ap->ssid, bars, ap->security);
+    }
+}
+
+static void watch_add_ap(const LoquatAccessPoint *ap, void *userdata) {
+    loquat_scan_index_add(userdata, ap);
+}
+
+// Print the top-level fields that differ between two JSON objects
+int print_json_changes(const cJSON *prev, const cJSON *cur) {
+    int changes = 0;
+    const cJSON *item;
+
+    cJSON_ArrayForEach(item, cur) {
+        const cJSON *old = prev ? cJSON_GetObjectItemCaseSensitive(prev, item->string) : NULL;
+        char *value = cJSON_PrintUnformatted(item);
+        char *old_value = old ? cJSON_PrintUnformatted(old) : NULL;
+
+        if (!old_value) {
+            print_watch_time();
+            printf("+ %s: %s\n", item->string, value ? value : "");
+            changes++;
+        } else if (!value || strcmp(value, old_value) != 0) {
+            print_watch_time();
+            printf("~ %s: %s -> %s\n", item->string, old_value, value ? value : "");
+            changes++;
+        }
+        cJSON_free(value);
+        cJSON_free(old_value);
+    }
+
+    if (prev) {
+        cJSON_ArrayForEach(item, prev) {
+            if (!cJSON_GetObjectItemCaseSensitive(cur, item->string)) {
+                print_watch_time();
+                printf("- %s\n", item->string);
+                changes++;
+            }
+        }
+    }
+
+    return changes;
+}
+
+// Poll a command until interrupted, printing only what changed. The
+// interval doubles while nothing changes (up to max_interval) and drops
+// back to interval as soon as something does.
+int run_watch(const char *base_url, const char *unix_socket, const char *command, double interval,
+              double max_interval, TimingReport *report) {
+    LoquatClient *client = loquat_client_init(base_url);
+    if (!client || !loquat_client_set_unix_socket(client, unix_socket)) {
+        fprintf(stderr, "Failed to initialize client\n");
+        loquat_client_cleanup(client);
+        return 0;
+    }
+
+    int is_scan = (strcmp(command, "get_scan_result") == 0);
+    LoquatScanIndex *index = is_scan ? loquat_scan_index_init() : NULL;
+    if (is_scan && !index) {
+        loquat_client_cleanup(client);
+        return 0;
+    }
+
+    ResponseData buffer;
+    loquat_response_data_init(&buffer, NULL, 0);
+    LoquatValidators validators;
+    memset(&validators, 0, sizeof(validators));
+    cJSON *prev = NULL;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    double wait = interval;
+    while (!stop_requested) {
+        int http_code = 0;
+        int changes = 0;
+
+        if (loquat_client_get_conditional(client, command, &validators, &buffer, &http_code)) {
+            if (report) {
+                LoquatTiming timing;
+                loquat_client_get_timing(client, &timing);
+                timing_report_record(report, command, base_url, &timing);
+            }
+            if (http_code == 200 && is_scan) {
+                LoquatScanParser parser;
+                loquat_scan_parser_init(&parser, watch_add_ap, index);
+                loquat_scan_index_begin(index);
+                loquat_scan_parser_feed(&parser, buffer.data, buffer.size);
+                if (loquat_scan_parser_finish(&parser)) {
+                    changes = loquat_scan_index_commit(index, print_scan_change, NULL);
+                } else {
+                    fprintf(stderr, "Failed to parse JSON response\n");
+                    // Ask for a full response next time rather than a 304
+                    memset(&validators, 0, sizeof(validators));
+                }
+            } else if (http_code == 200) {
+                cJSON *cur = cJSON_ParseWithLength(buffer.data, buffer.size);
+                if (cur) {
+                    changes = print_json_changes(prev, cur);
+                    cJSON_Delete(prev);
+                    prev = cur;
+                } else {
+                    fprintf(stderr, "Failed to parse JSON response\n");
+                }
+            } else if (http_code != 304) {
+                fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+            }
+        }
+        fflush(stdout);
+
+        // Adapt the polling interval to how often the device changes
+        wait = (changes > 0) ? interval : wait * 2;
+        if (wait > max_interval) wait = max_interval;
+
+        struct timespec ts;
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    }
+
+    cJSON_Delete(prev);
+    loquat_response_data_free(&buffer);
+    loquat_scan_index_cleanup(index);
+    loquat_client_cleanup(client);
+    return 1;
+}
+
+// Print one pushed event as soon as it arrives
+static int print_event(const LoquatEvent *event, void *userdata) {
+    unsigned long *count = userdata;
+    (*count)++;
+
+    switch (output_format) {
+        case OUTPUT_JSON:
+        case OUTPUT_NDJSON: {
+            // One object per line either way: the stream has no end to close an array at
+            output_append("{\"event\":", 9);
+            output_json_string(event->event);
+            output_append(",\"id\":", 6);
+            output_json_string(event->id);
+            output_append(",\"data\":", 8);
+            cJSON *data = cJSON_ParseWithLength(event->data, event->data_len);
+            char *text = data ? cJSON_PrintUnformatted(data) : NULL;
+            if (text) {
+                output_append(text, strlen(text));
+            } else {
+                output_json_string(event->data);
+            }
+            output_append("}\n", 2);
+            cJSON_free(text);
+            cJSON_Delete(data);
+            output_flush();
+            break;
+        }
+        case OUTPUT_CSV:
+            if (*count == 1) {
+                output_printf("event,id,data\n");
+            }
+            output_csv_field(event->event);
+            output_append(",", 1);
+            output_csv_field(event->id);
+            output_append(",", 1);
+            output_csv_field(event->data);
+            output_append("\n", 1);
+            output_flush();
+            break;
+        default:
+            print_watch_time();
+            if (event->event[0]) printf("[%s] ", event->event);
+            if (event->id[0]) printf("#%s ", event->id);
+            printf("%s\n", event->data);
+            fflush(stdout);
+            break;
+    }
+    return 1;
+}
+
+// Print the events a device pushes on endpoint until interrupted
+int run_subscribe(const char *base_url, const char *unix_socket, const char *endpoint) {
+    LoquatClient *client = loquat_client_init(base_url);
+    if (!client || !loquat_client_set_unix_socket(client, unix_socket)) {
+        fprintf(stderr, "Failed to initialize client\n");
+        loquat_client_cleanup(client);
+        return 0;
+    }
+
+    unsigned long count = 0;
+    int http_code = 0;
+    int ok = loquat_client_subscribe(client, endpoint, print_event, &count, &http_code);
+    if (ok && http_code != 200) {
+        if (http_code == 204) {
+            fprintf(stderr, "Device closed the subscription\n");
+        } else {
+            fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+            ok = 0;
+        }
+    }
+
+    loquat_client_cleanup(client);
+    return ok;
+}
+
+// Default path of the daemon's UNIX socket
+void default_socket_path(char *path, size_t size) {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && *runtime) {
+        snprintf(path, size, "%s/loquatcli.sock", runtime);
+    } else {
+        snprintf(path, size, "/tmp/loquatcli-%lu.sock", (unsigned long)getuid());
+    }
+}
+
+static int socket_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return 0;
+    }
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+static int write_full(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static int read_full(int fd, char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+// Read until *buf holds a complete header line, NUL-terminating it in
+// place. The buffer is malloc'd and grown as needed, up to max bytes; the
+// caller frees it. Returns the header length (excluding the newline) or -1;
+// *have is the number of bytes read, which may run past the header.
+static long read_header(int fd, char **buf, size_t max, size_t *have) {
+    size_t size = 0;
+    *buf = NULL;
+    *have = 0;
+    for (;;) {
+        char *nl = *buf ? memchr(*buf, '\n', *have) : NULL;
+        if (nl) {
+            *nl = '\0';
+            return (long)(nl - *buf);
+        }
+        if (*have == size) {
+            if (size == max) return -1;
+            size_t grown_size = size ? size * 2 : 256;
+            if (grown_size > max) grown_size = max;
+            char *grown = realloc(*buf, grown_size);
+            if (!grown) return -1;
+            *buf = grown;
+            size = grown_size;
+        }
+        ssize_t n = read(fd, *buf + *have, size - *have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        *have += (size_t)n;
+    }
+}
+
+// One device the daemon keeps a warm connection to. Requests to the same
+// device are serialized on its client; different devices run in parallel.
+typedef struct {
+    char *base_url;
+    LoquatClient *client;
+    ResponseData buffer;           // Reused for every GET to this device
+    pthread_mutex_t lock;
+} DaemonDevice;
+
+static DaemonDevice **daemon_devices = NULL;
+static int daemon_device_count = 0;
+static int daemon_device_capacity = 0;
+static pthread_mutex_t daemon_devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Connections being served (guarded by daemon_devices_lock); the daemon
+// waits for this to reach 0 before freeing the devices
+static int daemon_active = 0;
+static pthread_cond_t daemon_idle = PTHREAD_COND_INITIALIZER;
+
+// Find the device for base_url, creating its client the first time
+static DaemonDevice* daemon_device(const char *base_url) {
+    DaemonDevice *device = NULL;
+
+    pthread_mutex_lock(&daemon_devices_lock);
+    for (int i = 0; i < daemon_device_count; i++) {
+        if (strcmp(daemon_devices[i]->base_url, base_url) == 0) {
+            device = daemon_devices[i];
+            goto done;
+        }
+    }
+
+    if (daemon_device_count == daemon_device_capacity) {
+        int capacity = daemon_device_capacity ? daemon_device_capacity * 2 : 16;
+        DaemonDevice **devices = realloc(daemon_devices, (size_t)capacity * sizeof(DaemonDevice *));
+        if (!devices) {
+            fprintf(stderr, "Memory allocation failed\n");
+            goto done;
+        }
+        daemon_devices = devices;
+        daemon_device_capacity = capacity;
+    }
+
+    device = calloc(1, sizeof(DaemonDevice));
+    if (!device) {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto done;
+    }
+    device->base_url = strdup(base_url);
+    device->client = device->base_url ? loquat_client_init(base_url) : NULL;
+    if (!device->client) {
+        free(device->base_url);
+        free(device);
+        device = NULL;
+        goto done;
+    }
+    // Each device is served on its own threads over its own warm connection,
+    // without taking the library-wide connection cache lock for every request
+    loquat_client_set_connection_sharing(device->client, 0);
+    loquat_response_data_init(&device->buffer, NULL, 0);
+    pthread_mutex_init(&device->lock, NULL);
+    daemon_devices[daemon_device_count++] = device;
+
+done:
+    pthread_mutex_unlock(&daemon_devices_lock);
+    return device;
+}
+
+// Free every device client
+static void daemon_devices_free(void) {
+    for (int i = 0; i < daemon_device_count; i++) {
+        loquat_client_cleanup(daemon_devices[i]->client);
+        loquat_response_data_free(&daemon_devices[i]->buffer);
+        pthread_mutex_destroy(&daemon_devices[i]->lock);
+        free(daemon_devices[i]->base_url);
+        free(daemon_devices[i]);
+    }
+    free(daemon_devices);
+    daemon_devices = NULL;
+    daemon_device_count = 0;
+    daemon_device_capacity = 0;
+}
+
+// Send one response: "<ok> <http_code> <cache_age> <length>\n" and the body
+// (the error message when ok is 0)
+static void daemon_reply(int fd, int ok, int http_code, double cache_age, const char *body, size_t len) {
+    char header[96];
+    int n = snprintf(header, sizeof(header), "%d %d %.3f %zu\n", ok, http_code, cache_age, len);
+    if (write_full(fd, header, (size_t)n)) {
+        write_full(fd, body, len);
+    }
+}
+
+static void daemon_reply_error(int fd, const char *error) {
+    daemon_reply(fd, 0, 0, -1.0, error, strlen(error));
+}
+
+// Serve one forwarded invocation. A request is the header line
+// "LOQUAT1\t<max_age>\t<base_url>\t<command>\t<post_length>\n" followed by
+// post_length bytes of POST data; post_length is "-" for a GET.
+static void* daemon_connection(void *arg) {
+    int fd = (int)(long)arg;
+    char *buf = NULL;
+    size_t have = 0;
+    char *post_data = NULL;
+
+    long header_len = read_header(fd, &buf, DAEMON_MAX_HEADER, &have);
+    if (header_len < 0) {
+        daemon_reply_error(fd, "Invalid request");
+        goto done;
+    }
+
+    char *fields[5];
+    char *save = NULL;
+    int count = 0;
+    for (char *tok = strtok_r(buf, "\t", &save); tok && count < 5; tok = strtok_r(NULL, "\t", &save)) {
+        fields[count++] = tok;
+    }
+    if (count != 5 || strcmp(fields[0], "LOQUAT1") != 0 || !is_valid_command(fields[3])) {
+        daemon_reply_error(fd, "Invalid request");
+        goto done;
+    }
+    double max_age = atof(fields[1]);
+    const char *base_url = fields[2];
+    const char *command = fields[3];
+
+    if (strcmp(fields[4], "-") != 0) {
+        // The length comes from another process: bound it before allocating
+        char *end = NULL;
+        errno = 0;
+        unsigned long long post_len = strtoull(fields[4], &end, 10);
+        if (errno != 0 || end == fields[4] || *end != '\0' || fields[4][0] == '-' ||
+            post_len > DAEMON_MAX_POST) {
+            daemon_reply_error(fd, "Invalid request");
+            goto done;
+        }
+        // Part of the POST data may have arrived with the header
+        size_t early = have - (size_t)header_len - 1;
+        post_data = malloc((size_t)post_len + 1);
+        if (!post_data || early > post_len) {
+            daemon_reply_error(fd, "Invalid request");
+            goto done;
+        }
+        memcpy(post_data, buf + header_len + 1, early);
+        if (!read_full(fd, post_data + early, (size_t)post_len - early)) {
+            goto done;
+        }
+        post_data[post_len] = '\0';
+    }
+
+    DaemonDevice *device = daemon_device(base_url);
+    if (!device) {
+        daemon_reply_error(fd, "Failed to initialize client");
+        goto done;
+    }
+
+    pthread_mutex_lock(&device->lock);
+
+    // Honour the invocation's --max-age / --no-cache
+    LoquatCache *cache = loquat_cache_open(NULL, max_age);
+    loquat_client_set_cache(device->client, cache);
+
+    int http_code = 0;
+    if (!post_data) {
+        if (loquat_client_get_into(device->client, command, &device->buffer, &http_code)) {
+            daemon_reply(fd, 1, http_code, loquat_client_cache_age(device->client),
+                         device->buffer.data, device->buffer.size);
+        } else {
+            daemon_reply_error(fd, "Request failed");
+        }
+    } else {
+        char *response = NULL;
+        if (loquat_client_post(device->client, command, post_data, &response, &http_code)) {
+            daemon_reply(fd, 1, http_code, -1.0, response, strlen(response));
+            loquat_client_free_response(response);
+        } else {
+            daemon_reply_error(fd, "Request failed");
+        }
+    }
+
+    loquat_client_set_cache(device->client, NULL);
+    loquat_cache_close(cache);
+    pthread_mutex_unlock(&device->lock);
+
+done:
+    free(post_data);
+    free(buf);
+    close(fd);
+
+    pthread_mutex_lock(&daemon_devices_lock);
+    if (--daemon_active == 0) {
+        pthread_cond_broadcast(&daemon_idle);
+    }
+    pthread_mutex_unlock(&daemon_devices_lock);
+    return NULL;
+}
+
+// Keep warm clients to every device asked for and serve forwarded
+// invocations on a UNIX socket until interrupted
+int run_daemon(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (!socket_address(socket_path, &addr)) {
+        return 0;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Cannot create socket: %s\n", strerror(errno));
+        return 0;
+    }
+
+    // Refuse to take over the socket of a daemon that is still running
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "Error: A daemon is already listening on %s\n", socket_path);
+        close(fd);
+        return 0;
+    }
+    unlink(socket_path);
+
+    mode_t old_mask = umask(077);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound != 0 || listen(fd, 128) != 0) {
+        fprintf(stderr, "Error: Cannot listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    // Keep DNS, TLS and connection caches alive between requests
+    if (!loquat_global_init()) {
+        close(fd);
+        unlink(socket_path);
+        return 0;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Daemon listening on %s (Ctrl-C to stop)\n", socket_path);
+
+    while (!stop_requested) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "Error: accept() failed: %s\n", strerror(errno));
+            break;
+        }
+
+        // A client that stops sending must not hold its thread (and the
+        // daemon's shutdown) forever
+        struct timeval timeout = { DAEMON_READ_TIMEOUT, 0 };
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        pthread_mutex_lock(&daemon_devices_lock);
+        daemon_active++;
+        pthread_mutex_unlock(&daemon_devices_lock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, daemon_connection, (void *)(long)conn) != 0) {
+            close(conn);
+            pthread_mutex_lock(&daemon_devices_lock);
+            daemon_active--;
+            pthread_mutex_unlock(&daemon_devices_lock);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(fd);
+    unlink(socket_path);
+
+    // Let every connection thread finish before tearing down the clients
+    // and the shared handle they use
+    pthread_mutex_lock(&daemon_devices_lock);
+    while (daemon_active > 0) {
+        pthread_cond_wait(&daemon_idle, &daemon_devices_lock);
+    }
+    daemon_devices_free();
+    pthread_mutex_unlock(&daemon_devices_lock);
+
+    loquat_global_cleanup();
+    return 1;
+}
+
+// Say what request is being made, before its result. Printed by the
+// direct and the forwarded path alike, so both look the same
+static void print_request_start(const char *command, const char *post_data, double deadline) {
+    if (is_get_command(command)) {
+        fprintf(stderr, "Making GET request...\n");
+        return;
+    }
+    fprintf(stderr, "Making POST request...\n");
+    if (post_data) {
+        printf("POST data: %s\n", post_data);
+    }
+    if (strcmp(command, "connect") == 0) {
+        fprintf(stderr, "Waiting up to %.0f seconds for the WiFi connection...\n", deadline > 0 ? deadline : (double)CONNECT_TIMEOUT);
+    } else if (strcmp(command, "apikey") == 0) {
+        fprintf(stderr, "Using 120-second timeout for API key...\n");
+    }
+}
+
+// Thin client: hand one invocation to a running daemon and print its
+// result like the direct path would. Returns -1 without printing anything
+// when no daemon is listening, so the caller can fall back to direct mode.
+int run_forwarded(const char *socket_path, const char *base_url, const char *command,
+                  const char *post_data, double max_age) {
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Sized to the base URL; one the daemon would refuse is sent directly
+    char post_len[32] = "-";
+    if (post_data) {
+        snprintf(post_len, sizeof(post_len), "%zu", strlen(post_data));
+    }
+    const char *format = "LOQUAT1\t%.3f\t%s\t%s\t%s\n";
+    int n = snprintf(NULL, 0, format, max_age, base_url, command, post_len);
+    char *header = (n < 0 || n >= DAEMON_MAX_HEADER) ? NULL : malloc((size_t)n + 1);
+    if (header) {
+        snprintf(header, (size_t)n + 1, format, max_age, base_url, command, post_len);
+    }
+    if (!header || !write_full(fd, header, (size_t)n) ||
+        (post_data && !write_full(fd, post_data, strlen(post_data)))) {
+        free(header);
+        close(fd);
+        return -1;
+    }
+    free(header);
+    print_request_start(command, post_data, 0.0);
+
+    // Reply: "<ok> <http_code> <cache_age> <length>\n" and the body
+    char *reply = NULL;
+    size_t have = 0;
+    long reply_len = read_header(fd, &reply, 128, &have);
+    int ok = 0;
+    int http_code = 0;
+    double cache_age = -1.0;
+    size_t body_len = 0;
+    if (reply_len < 0 || sscanf(reply, "%d %d %lf %zu", &ok, &http_code, &cache_age, &body_len) != 4) {
+        fprintf(stderr, "Error: Invalid reply from daemon on %s\n", socket_path);
+        free(reply);
+        close(fd);
+        return 1;
+    }
+
+    char *body = malloc(body_len + 1);
+    size_t early = have - (size_t)reply_len - 1;
+    if (!body || early > body_len) {
+        fprintf(stderr, "Error: Invalid reply from daemon on %s\n", socket_path);
+        free(body);
+        free(reply);
+        close(fd);
+        return 1;
+    }
+    memcpy(body, reply + reply_len + 1, early);
+    free(reply);
+    int complete = read_full(fd, body + early, body_len - early);
+    close(fd);
+    if (!complete) {
+        fprintf(stderr, "Error: Daemon on %s closed the connection\n", socket_path);
+        free(body);
+        return 1;
+    }
+    body[body_len] = '\0';
+
+    if (!ok) {
+        fprintf(stderr, "Error: %s\n", body);
+    } else if (http_code != 200) {
+        fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+    } else if (strcmp(command, "get_scan_result") == 0 && result_parser == RESULT_PARSER_STREAM) {
+        // Same rows as the streaming direct path
+        int rows = 0;
+        LoquatScanParser parser;
+        loquat_scan_parser_init(&parser, print_scan_row, &rows);
+        loquat_scan_parser_feed(&parser, body, body_len);
+        if (!loquat_scan_parser_finish(&parser)) {
+            fprintf(stderr, "Failed to parse JSON response\n");
+        } else {
+            if (rows == 0) {
+                output_scan_begin();
+            }
+            output_scan_end();
+        }
+    } else {
+        print_response(command, body);
+    }
+    if (ok && cache_age >= 0) {
+        fprintf(stderr, "Served from cache (%.1f s old; --no-cache to refresh)\n", cache_age);
+    }
+
+    free(body);
+    return 0;
+}
+
+// Example usage and main function
+// (left out with -DLOQUAT_NO_MAIN when linking the benchmarks)
+#ifndef LOQUAT_NO_MAIN
+int main(int argc, char *argv[]) {
+    char *server = NULL;
+    char *port = NULL;
+    char *command = NULL;
+    char *ssid = NULL;
+    char *psk = NULL;
+    char *security = NULL;
+    char *apikey = NULL;
+    char *aiserver = NULL;
+    char *targets_file = NULL;
+    int concurrency = 0;
+    char *batch_file = NULL;
+    int watch = 0;
+    double interval = WATCH_DEFAULT_INTERVAL;
+    double max_interval = WATCH_DEFAULT_MAX_INTERVAL;
+    int show_timing = 0;
+    TimingReport report = {0};
+    double max_age = -1.0;
+    LoquatCache *cache = NULL;
+    double deadline = CONNECT_TIMEOUT;
+    int daemon = 0;
+    int no_daemon = 0;
+    int raw = 0;
+    const char *output_file = NULL;
+    int survey = 0;
+    int load = 0;
+    double rate = 0.0;
+    double load_duration = LOAD_DEFAULT_DURATION;
+    const char *unix_socket = NULL;
+    const char *upload_file = NULL;
+    const char *resource = NULL;
+    const char *subscribe = NULL;
+    char socket_path[SOCKET_PATH_MAX];
+    default_socket_path(socket_path, sizeof(socket_path));
+    
+    int opt;
+    const char *optstring = "s:p:c:w:k:e:a:i:t:j:b:WI:M:Tm:NDS:nd:ro:f:uP:LR:U:X:F:g:Z:";
+    static struct option long_options[] = {
+        {"server", required_argument, 0, 's'},
+        {"port", required_argument, 0, 'p'},
+        {"com", required_argument, 0, 'c'},
+        {"ssid", required_argument, 0, 'w'},
+        {"psk", required_argument, 0, 'k'},
+        {"security", required_argument, 0, 'e'},
+        {"apikey", required_argument, 0, 'a'},
+        {"aiserver", required_argument, 0, 'i'},
+        {"targets", required_argument, 0, 't'},
+        {"concurrency", required_argument, 0, 'j'},
+        {"batch", required_argument, 0, 'b'},
+        {"watch", no_argument, 0, 'W'},
+        {"interval", required_argument, 0, 'I'},
+        {"max-interval", required_argument, 0, 'M'},
+        {"timing", no_argument, 0, 'T'},
+        {"max-age", required_argument, 0, 'm'},
+        {"no-cache", no_argument, 0, 'N'},
+        {"daemon", no_argument, 0, 'D'},
+        {"daemon-socket", required_argument, 0, 'S'},
+        {"no-daemon", no_argument, 0, 'n'},
+        {"deadline", required_argument, 0, 'd'},
+        {"raw", no_argument, 0, 'r'},
+        {"output", required_argument, 0, 'o'},
+        {"format", required_argument, 0, 'f'},
+        {"parser", required_argument, 0, 'P'},
+        {"survey", no_argument, 0, 'u'},
+        {"load", no_argument, 0, 'L'},
+        {"rate", required_argument, 0, 'R'},
+        {"duration", required_argument, 0, 'U'},
+        {"unix-socket", required_argument, 0, 'X'},
+        {"file", required_argument, 0, 'F'},
+        {"resource", required_argument, 0, 'g'},
+        {"subscribe", required_argument, 0, 'Z'},
+        {0, 0, 0, 0}
+    };
+    
+    // Parse command line arguments
+    while ((opt = getopt_long(argc, argv, optstring, long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                server = optarg;
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            case 'c':
+                command = optarg;
+                break;
+            case 'w':
+                ssid = optarg;
+                break;
+            case 'k':
+                psk = optarg;
+                break;
+            case 'e':
+                security = optarg;
+                break;
+            case 'a':
+                apikey = optarg;
+                break;
+            case 'i':
+                aiserver = optarg;
+                break;
+            case 't':
+                targets_file = optarg;
+                break;
+            case 'j':
+                concurrency = atoi(optarg);
+                break;
+            case 'b':
+                batch_file = optarg;
+                break;
+            case 'W':
+                watch = 1;
+                break;
+            case 'I':
+                interval = atof(optarg);
+                break;
+            case 'M':
+                max_interval = atof(optarg);
+                break;
+            case 'T':
+                show_timing = 1;
+                break;
+            case 'm':
+                max_age = atof(optarg);
+                break;
+            case 'N':
+                max_age = 0.0;
+                break;
+            case 'D':
+                daemon = 1;
+                break;
+            case 'S':
+                snprintf(socket_path, sizeof(socket_path), "%s", optarg);
+                break;
+            case 'n':
+                no_daemon = 1;
+                break;
+            case 'd':
+                deadline = atof(optarg);
+                break;
+            case 'r':
+                raw = 1;
+                break;
+            case 'o':
+                output_file = optarg;
+                raw = 1;
+                break;
+            case 'u':
+                survey = 1;
+                break;
+            case 'L':
+                load = 1;
+                break;
+            case 'R':
+                rate = atof(optarg);
+                break;
+            case 'U':
+                load_duration = atof(optarg);
+                break;
+            case 'f':
+                if (!set_output_format(optarg)) {
+                    fprintf(stderr, "Unknown format: %s (expected table, json, ndjson or csv)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'X':
+                unix_socket = optarg;
+                break;
+            case 'F':
+                upload_file = optarg;
+                break;
+            case 'g':
+                resource = optarg;
+                break;
+            case 'Z':
+                subscribe = optarg;
+                break;
+            case 'P':
+                if (!set_result_parser(optarg)) {
+                    fprintf(stderr, "Unknown parser: %s (expected stream, extract or cjson)\n", optarg);
+                    return 1;
+                }
+                break;
+            case '?':
+                fprintf(stderr, "Usage: %s --server <ip> --port <port> --com <command> [--ssid <ssid>] [--psk <key>] [--security <type>] [--deadline <sec>] [--file <path>] [--resource <path>] [--format table|json|ndjson|csv] [--parser stream|extract|cjson] [--raw | --output <file>] [--apikey <key>] [--aiserver <server>] [--targets <file|-> [--concurrency <n>] [--rate <req/s>] [--survey]] [--load --rate <req/s> | --concurrency <n> [--duration <sec>]] [--batch <file|-> [--rate <req/s>]] [--watch [--interval <sec>] [--max-interval <sec>]] [--subscribe <endpoint>] [--timing] [--max-age <sec> | --no-cache] [--unix-socket <path>] [--daemon] [--daemon-socket <path>] [--no-daemon]\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result\n", argv[0]);
+                fprintf(stderr, "Example: %s --server localhost --port 3000 --com status --ssid MyWiFi --psk password123 --security WPA2\n", argv[0]);
+                fprintf(stderr, "Example: %s --server api.example.com --port 443 --com connect --ssid MyWiFi --psk password123 --apikey your-api-key\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result --aiserver ai.example.com\n", argv[0]);
+                fprintf(stderr, "Example: %s --targets devices.txt --port 8080 --com get_status --concurrency 64\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --batch provision.txt\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result --watch --interval 2\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --subscribe events --format ndjson\n", argv[0]);
+                fprintf(stderr, "Example: %s --targets devices.txt --port 8080 --com get_status --timing\n", argv[0]);
+                fprintf(stderr, "Example: %s --targets site.txt --port 8080 --survey --format ndjson\n", argv[0]);
+                fprintf(stderr, "Example: %s --targets devices.txt --port 8080 --com upload --file firmware.bin --concurrency 16\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com download --resource logs/dump.bin --output dump.bin\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result --max-age 60\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_status --load --rate 200 --duration 30\n", argv[0]);
+                fprintf(stderr, "Example: %s --unix-socket /run/loquat.sock --com get_status\n", argv[0]);
+                fprintf(stderr, "Example: %s --daemon &\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result --raw | jq .\n", argv[0]);
+                fprintf(stderr, "Example: %s --server 192.168.1.100 --port 8080 --com get_scan_result --format csv > scan.csv\n", argv[0]);
+                return 1;
+            default:
+                fprintf(stderr, "Unknown option: %c\n", opt);
+                return 1;
+        }
+    }
+    
+    // Daemon mode: keep warm clients and serve forwarded invocations
+    if (daemon) {
+        return run_daemon(socket_path) ? 0 : 1;
+    }
+    
+    // Survey mode: merge the scans of every device in the targets list
+    if (survey) {
+        if (!targets_file) {
+            fprintf(stderr, "Error: --survey requires --targets\n");
+            return 1;
+        }
+        int ok = run_survey(targets_file, port, concurrency, show_timing ? &report : NULL);
+        timing_report_print(&report);
+        timing_report_free(&report);
+        return ok ? 0 : 1;
+    }
+    
+    // Fleet mode: same command against every device in the targets list
+    if (targets_file) {
+        if (!command) {
+            fprintf(stderr, "Error: --com is required with --targets\n");
+            return 1;
+        }
+        if (!is_valid_command(command)) {
+            fprintf(stderr, "Invalid command: %s\n", command);
+            return 1;
+        }
+
+        // Every device's upload reads from one mapping of the image
+        char *post_data = NULL;
+        LoquatImage *image = NULL;
+        if (strcmp(command, "connect") == 0) {
+            post_data = get_post_connect_wifi_data(ssid, psk, security);
+            if (!post_data) return 1;
+        } else if (strcmp(command, "apikey") == 0) {
+            post_data = get_post_apikey_data(apikey, aiserver);
+            if (!post_data) return 1;
+        } else if (strcmp(command, "upload") == 0) {
+            image = open_upload_image(upload_file);
+            if (!image) return 1;
+        }
+
+        int ok = run_fleet(targets_file, port, command, post_data, image, concurrency, rate,
+                           show_timing ? &report : NULL);
+        free(post_data);
+        loquat_image_close(image);
+        timing_report_print(&report);
+        timing_report_free(&report);
+        return ok ? 0 : 1;
+    }
+
+    // Over a UNIX socket the server only names the Host header
+    if (unix_socket && !server) {
+        server = "localhost";
+    }
+
+    // Check required parameters
+    if (!server || (!port && !unix_socket) || (!command && !batch_file && !subscribe)) {
+        fprintf(stderr, "Error: --server, --port, and --com (or --batch or --subscribe) are required parameters\n");
+        fprintf(stderr, "Usage: %s --server <ip> --port <port> --com <command> [--ssid <ssid>] [--psk <key>] [--security <type>] [--deadline <sec>] [--file <path>] [--resource <path>] [--format table|json|ndjson|csv] [--parser stream|extract|cjson] [--raw | --output <file>] [--apikey <key>] [--aiserver <server>] [--targets <file|-> [--concurrency <n>] [--rate <req/s>] [--survey]] [--load --rate <req/s> | --concurrency <n> [--duration <sec>]] [--batch <file|-> [--rate <req/s>]] [--watch [--interval <sec>] [--max-interval <sec>]] [--subscribe <endpoint>] [--timing] [--max-age <sec> | --no-cache] [--unix-socket <path>] [--daemon] [--daemon-socket <path>] [--no-daemon]\n", argv[0]);
+        return 1;
+    }
+    
+    // Construct the base URL, on the heap so any host name and port fit
+    const char *base_format = port ? "http://%s:%s" : "http://%s";
+    int base_len = snprintf(NULL, 0, base_format, server, port);
+    char *base_url = base_len < 0 ? NULL : malloc((size_t)base_len + 1);
+    if (!base_url) {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    snprintf(base_url, (size_t)base_len + 1, base_format, server, port);
+    
+    // Load mode: drive one command at a set rate or concurrency
+    if (load) {
+        if (!command || !is_valid_command(command)) {
+            fprintf(stderr, "Invalid command: %s\n", command ? command : "(none)");
+            free(base_url);
+            return 1;
+        }
+        if (strcmp(command, "upload") == 0) {
+            fprintf(stderr, "Error: --load does not support upload\n");
+            free(base_url);
+            return 1;
+        }
+        if (rate <= 0 && concurrency <= 0) {
+            fprintf(stderr, "Error: --load requires --rate or --concurrency\n");
+            free(base_url);
+            return 1;
+        }
+        if (load_duration <= 0) {
+            fprintf(stderr, "Error: --duration must be positive\n");
+            free(base_url);
+            return 1;
+        }
+
+        char *post_data = NULL;
+        if (strcmp(command, "connect") == 0) {
+            post_data = get_post_connect_wifi_data(ssid, psk, security);
+            if (!post_data) {
+                free(base_url);
+                return 1;
+            }
+        } else if (strcmp(command, "apikey") == 0) {
+            post_data = get_post_apikey_data(apikey, aiserver);
+            if (!post_data) {
+                free(base_url);
+                return 1;
+            }
+        }
+
+        int ok = run_load(base_url, unix_socket, command, post_data, rate, concurrency, load_duration);
+        free(post_data);
+        free(base_url);
+        return ok ? 0 : 1;
+    }
+    
+    // Subscribe mode: print events as the device pushes them
+    if (subscribe) {
+        fprintf(stderr, "Subscribed to %s/%s (Ctrl-C to stop)\n", base_url, subscribe);
+        int ok = run_subscribe(base_url, unix_socket, subscribe);
+        free(base_url);
+        return ok ? 0 : 1;
+    }
+    
+    // Batch mode: many commands over one connection
+    if (batch_file) {
+        // Cached GET responses are shared with other invocations
+        cache = loquat_cache_open(NULL, max_age);
+        fprintf(stderr, "Connecting to: %s\n", base_url);
+        int ok = run_batch(base_url, unix_socket, batch_file, cache, rate, show_timing ? &report : NULL);
+        timing_report_print(&report);
+        timing_report_free(&report);
+        loquat_cache_close(cache);
+        free(base_url);
+        return ok ? 0 : 1;
+    }
+    
+    // Watch mode: poll and print only what changed
+    if (watch) {
+        if (!is_get_command(command)) {
+            fprintf(stderr, "Error: --watch requires a GET command\n");
+            free(base_url);
+            return 1;
+        }
+        if (interval <= 0) interval = WATCH_DEFAULT_INTERVAL;
+        if (max_interval < interval) max_interval = interval;
+        fprintf(stderr, "Watching %s/%s (Ctrl-C to stop)\n", base_url, command);
+        int ok = run_watch(base_url, unix_socket, command, interval, max_interval, show_timing ? &report : NULL);
+        timing_report_print(&report);
+        timing_report_free(&report);
+        free(base_url);
+        return ok ? 0 : 1;
+    }
+    
+    // Printed the same whether the request is forwarded or made here
+    fprintf(stderr, "Connecting to: %s\n", base_url);
+    fprintf(stderr, "Command: %s\n", command);
+    if (ssid) fprintf(stderr, "SSID: %s\n", ssid);
+    if (psk) fprintf(stderr, "PSK: %s\n", psk);
+    if (security) fprintf(stderr, "Security: %s\n", security);
+    if (apikey) fprintf(stderr, "API Key: %s\n", apikey);
+    if (aiserver) fprintf(stderr, "AI Server: %s\n", aiserver);
+    if (unix_socket) fprintf(stderr, "UNIX Socket: %s\n", unix_socket);
+    fprintf(stderr, "Full URL: %s/%s\n\n", base_url, command);
+    
+    // Thin client: let a running daemon make the request over its warm
+    // connection; fall back to a direct request when there is none.
+    // The daemon only fetches: it returns the raw body, which this process
+    // renders with its own --format and --parser exactly as the direct path
+    // does, and --max-age/--no-cache travel with the request. Only plain GET
+    // commands are forwarded. POSTs trace the transfer on stderr, which the
+    // daemon cannot hand back, and --raw/--output and --timing need the
+    // transfer itself. --unix-socket stays here too: the daemon's clients
+    // use TCP
+    if (!no_daemon && !unix_socket && !show_timing && !raw && is_get_command(command)) {
+        int status = run_forwarded(socket_path, base_url, command, NULL, max_age);
+        if (status >= 0) {
+            free(base_url);
+            return status;
+        }
+    }
+    
+    // Cached GET responses are shared with other invocations
+    cache = loquat_cache_open(NULL, max_age);
+    
+    // Create client instance
+    LoquatClient *client = loquat_client_init(base_url);
+    if (!client || !loquat_client_set_unix_socket(client, unix_socket)) {
+        fprintf(stderr, "Failed to initialize client\n");
+        loquat_client_cleanup(client);
+        loquat_cache_close(cache);
+        free(base_url);
+        return 1;
+    }
+    loquat_client_set_cache(client, cache);
+    
+    char *response = NULL;
+    int http_code;
+
+    // Downloads are only made from a single device, so no other mode accepts them
+    if (strcmp(command, "download") != 0 && !is_valid_command(command)) {
+        fprintf(stderr, "Invalid command: %s\n", command);
+        goto cleanup;
+    }
+
+    if (strcmp(command, "download") == 0) {
+        if (!resource) {
+            fprintf(stderr, "Error: --resource is required for download command\n");
+            goto cleanup;
+        }
+        // Default to the resource's file name in the current directory
+        const char *path = output_file;
+        if (!path) {
+            const char *slash = strrchr(resource, '/');
+            path = slash ? slash + 1 : resource;
+        }
+        if (!path[0]) {
+            fprintf(stderr, "Error: --output is required when --resource names a directory\n");
+            goto cleanup;
+        }
+        fprintf(stderr, "Downloading %s to %s...\n", resource, path);
+
+        LoquatDownloadResult result;
+        if (loquat_client_download(client, resource, path, concurrency, &result)) {
+            if (result.http_code != 200 && result.http_code != 206) {
+                fprintf(stderr, "Error: HTTP Code: %d\n", result.http_code);
+            } else {
+                print_download_result(&result);
+            }
+        }
+    } else if (strcmp(command, "upload") == 0) {
+        LoquatImage *image = open_upload_image(upload_file);
+        if (!image) {
+            goto cleanup;
+        }
+        fprintf(stderr, "Uploading %s (%zu bytes)...\n", upload_file, loquat_image_size(image));
+
+        ResponseData buffer;
+        loquat_response_data_init(&buffer, NULL, 0);
+        LoquatUploadResult result;
+        if (loquat_client_upload(client, command, image, &buffer, &result)) {
+            if (result.http_code != 200) {
+                fprintf(stderr, "Error: HTTP Code: %d\n", result.http_code);
+            } else {
+                print_upload_result(&result);
+                print_response(command, buffer.data);
+            }
+        }
+        loquat_response_data_free(&buffer);
+        loquat_image_close(image);
+    } else if (raw) {
+        // Body bytes go to the output unformatted, as they arrive
+        int fd = STDOUT_FILENO;
+        if (output_file) {
+            fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                fprintf(stderr, "Cannot open %s: %s\n", output_file, strerror(errno));
+                goto cleanup;
+            }
+        }
+        
+        char *post_data = NULL;
+        if (strcmp(command, "connect") == 0) {
+            post_data = get_post_connect_wifi_data(ssid, psk, security);
+        } else if (strcmp(command, "apikey") == 0) {
+            post_data = get_post_apikey_data(apikey, aiserver);
+        }
+        
+        if ((post_data || is_get_command(command)) &&
+            loquat_client_stream(client, command, post_data, fd, &http_code) && http_code != 200) {
+            fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+        }
+        free(post_data);
+        
+        if (output_file && close(fd) != 0) {
+            fprintf(stderr, "Cannot write %s: %s\n", output_file, strerror(errno));
+        }
+    } else if (is_get_command(command)) {
+        print_request_start(command, NULL, deadline);
+        if (strcmp(command, "get_scan_result") == 0 && result_parser == RESULT_PARSER_STREAM) {
+            // Rows are printed as each access point arrives
+            int rows = 0;
+            if (loquat_client_get_scan_stream(client, print_scan_row, &rows, &http_code)) {
+                if (http_code != 200) {
+                    fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+                } else {
+                    if (rows == 0) {
+                        output_scan_begin();
+                    }
+                    output_scan_end();
+                }
+            }
+            // Rows received before a failure still get written
+            output_flush();
+        }
+        else if (loquat_client_get(client, command, &response, &http_code)) {
+            if (http_code != 200) {
+                fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+            } else {
+                print_response(command, response);
+            }
+            loquat_client_free_response(response);
+        }
+        else if (strcmp(command, "get_net_info") == 0) {
+            fprintf(stderr, "Getting network information...\n");
+            if (loquat_client_get(client, command, &response, &http_code)) {
+                if (http_code != 200) {
+                    fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+                } else {
+                    print_response(command, response);
+                }
+                loquat_client_free_response(response);
+            }
+        }
+    } else {
+        // Get POST data for commands that need it
+        char *post_data = NULL;
+        if (strcmp(command, "connect") == 0) {
+            post_data = get_post_connect_wifi_data(ssid, psk, security);
+        } else if (strcmp(command, "apikey") == 0) {
+            post_data = get_post_apikey_data(apikey, aiserver);
+        }
+        print_request_start(command, post_data, deadline);
+        
+        LoquatConnectResult result;
+        if (strcmp(command, "connect") == 0) {
+            // Return as soon as the device reports the join succeeded or failed
+            if (post_data && loquat_client_connect_wifi(client, post_data, deadline, &result)) {
+                print_connect_result(&result);
+            }
+        } else if (loquat_client_post(client, command, post_data, &response, &http_code)) {
+            if (http_code != 200) {
+                fprintf(stderr, "Error: HTTP Code: %d\n", http_code);
+            } else {
+                print_response(command, response);
+            }
+            loquat_client_free_response(response);
+        }
+        
+        // Free POST data if it was allocated
+        if (post_data) {
+            free(post_data);
+        }
+    }
+
+    if (loquat_client_cache_age(client) >= 0) {
+        fprintf(stderr, "Served from cache (%.1f s old; --no-cache to refresh)\n", loquat_client_cache_age(client));
+    } else if (show_timing) {
+        LoquatTiming timing;
+        loquat_client_get_timing(client, &timing);
+        print_timing(&timing);
+    }
+
+cleanup:    
     // Clean up
     loquat_client_cleanup(client);
+    loquat_cache_close(cache);
     
+    free(base_url);
     return 0;
-} 
+}
+#endif // LOQUAT_NO_MAIN
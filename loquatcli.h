@@ -7,16 +7,293 @@
 typedef struct {
     char *data;
     size_t size;
+    size_t capacity;   // Bytes allocated for data
+    int fixed;         // 1 if data is caller storage that must never be reallocated
+    CURL *curl;        // Transfer filling the buffer (used to pre-size from Content-Length)
 } ResponseData;
 
+// Opaque on-disk response cache (see loquat_cache_open)
+typedef struct LoquatCache LoquatCache;
+
 // Structure for the HTTP client
 typedef struct {
     CURL *curl;
-    char base_url[256];
+    char *base_url;       // Any length; change with loquat_client_set_base_url()
+    LoquatCache *cache;   // Response cache consulted by GET requests, or NULL
+    double cache_age;     // Age in seconds of the last response if served from cache, -1 otherwise
+    char *unix_socket;    // UNIX domain socket requests go over, or NULL for TCP
+    int single_flight;    // Share identical concurrent GETs with other clients
+    int share_connections; // Take connections from the library-wide cache (default 1)
 } LoquatClient;
 
+// Counts of GETs made by clients with single-flight enabled
+typedef struct {
+    unsigned long issued;     // Requests that went to the device
+    unsigned long coalesced;  // Requests answered by an identical one already in progress
+} LoquatFlightStats;
+
+// Maximum stored lengths of access point strings (longer values are truncated)
+#define LOQUAT_SSID_MAX 128
+#define LOQUAT_SECURITY_MAX 32
+#define LOQUAT_BSSID_MAX 32
+
+// One access point from a get_scan_result response
+typedef struct {
+    char ssid[LOQUAT_SSID_MAX + 1];
+    int bars;
+    char security[LOQUAT_SECURITY_MAX + 1];
+    char bssid[LOQUAT_BSSID_MAX + 1];     // Empty if the device does not report it
+} LoquatAccessPoint;
+
+// Callback invoked for each access point as soon as its object is complete
+typedef void (*loquat_scan_ap_cb)(const LoquatAccessPoint *ap, void *userdata);
+
+// Deepest container nesting the incremental scan parser accepts
+#define LOQUAT_SCAN_MAX_DEPTH 512
+
+// State of an incremental get_scan_result parser. Memory use is fixed
+// regardless of how many access points the response contains.
+typedef struct {
+    loquat_scan_ap_cb callback;
+    void *userdata;
+    CURL *curl;                   // Transfer feeding the parser, if any
+    LoquatAccessPoint ap;         // Access point being parsed
+    int count;                    // Access points emitted so far
+    int depth;                    // Container nesting depth
+    unsigned char objects[LOQUAT_SCAN_MAX_DEPTH / 8];  // Bit per open container: object or array
+    int expect;                   // Token the grammar allows next
+    int scalar;                   // Number or literal being read, and how far
+    const char *literal;          // Literal being matched ("true", "false" or "null")
+    int scalar_len;               // Bytes of the literal matched so far
+    int in_object;                // Inside an access point object
+    int field;                    // Field the current value belongs to
+    int seen;                     // Fields whose first key has been read (later duplicates are ignored)
+    int has_ssid, has_bars, has_security;
+    int in_string, escape, string_role, string_truncated;
+    int unicode_digits;
+    unsigned long unicode, high_surrogate;
+    size_t string_len;
+    char key[16];
+    char number[32];
+    size_t number_len;
+    int error;                    // Malformed input seen
+} LoquatScanParser;
+
+// A string inside a response body; not NUL-terminated. escaped is set when
+// it contains backslash escapes (see loquat_string_view_copy)
+typedef struct {
+    const char *ptr;              // NULL if the field is absent or not a string
+    size_t len;
+    int escaped;
+} LoquatStringView;
+
+// One access point extracted in place from a get_scan_result body
+typedef struct {
+    LoquatStringView ssid;
+    LoquatStringView security;
+    LoquatStringView bssid;
+    int bars;                     // Integer part, 0 if absent or not a number
+    int has_ssid, has_bars, has_security, has_bssid;
+} LoquatScanView;
+
+// Callback invoked for each access point object of an extracted scan
+typedef void (*loquat_scan_view_cb)(const LoquatScanView *ap, void *userdata);
+
+// Fields extracted in place from a get_net_info body
+typedef struct {
+    LoquatStringView status;
+    LoquatStringView ip_address;
+    LoquatStringView ssid;
+} LoquatNetInfoView;
+
+// Kinds of change reported when comparing consecutive scans
+#define LOQUAT_AP_ADDED   1
+#define LOQUAT_AP_REMOVED 2
+#define LOQUAT_AP_CHANGED 3
+
+// Callback for one difference between consecutive scans; old_bars is the
+// previously reported bars for LOQUAT_AP_CHANGED
+typedef void (*loquat_scan_diff_cb)(int change, const LoquatAccessPoint *ap, int old_bars, void *userdata);
+
+// Opaque snapshot of the last scan, keyed by SSID (see loquat_scan_index_init)
+typedef struct LoquatScanIndex LoquatScanIndex;
+
+// Opaque merge of many devices' scans (see loquat_survey_init)
+typedef struct LoquatSurvey LoquatSurvey;
+
+// One distinct access point of a survey and what the devices saw of it
+typedef struct {
+    const LoquatAccessPoint *ap;  // SSID, BSSID and security as first reported
+    int best_bars;
+    int worst_bars;
+    double mean_bars;             // Mean over all observations
+    unsigned long observations;   // Reports of this access point across all scans
+    const int *devices;           // Indexes of the devices that saw it, ascending
+    int device_count;
+} LoquatSurveyAp;
+
+// Callback for one access point of a survey report
+typedef void (*loquat_survey_ap_cb)(const LoquatSurveyAp *ap, void *userdata);
+
+// Cache validators for conditional requests
+typedef struct {
+    char etag[128];            // Last ETag from the device ("" if none)
+    char last_modified[64];    // Last Last-Modified from the device ("" if none)
+} LoquatValidators;
+
+// Phase timings of one request, as reported by libcurl. Times are in
+// seconds from the start of the request, so each includes the phases before it.
+typedef struct {
+    double name_lookup;       // Name resolution done
+    double connect;           // TCP connection established
+    double app_connect;       // TLS handshake done (0 for plain HTTP)
+    double pre_transfer;      // About to send the request
+    double start_transfer;    // First response byte received
+    double total;             // Request complete
+    curl_off_t bytes_down;    // Response body bytes received
+    curl_off_t bytes_up;      // Request body bytes sent
+    int redirect_count;       // Redirects followed
+} LoquatTiming;
+
+// Outcomes of a Wi-Fi join (see loquat_client_connect_wifi)
+#define LOQUAT_CONNECT_JOINED  1   // Device reports connected (with an IP address when it reports one)
+#define LOQUAT_CONNECT_FAILED  2   // Device rejected the request or reported a failed join
+#define LOQUAT_CONNECT_TIMEOUT 3   // Neither happened before the deadline
+
+// Result of a Wi-Fi join
+typedef struct {
+    int state;                // LOQUAT_CONNECT_* outcome
+    int http_code;            // HTTP code of the connect POST (0 if it had not completed)
+    char status[32];          // Last status the device reported ("" if none)
+    char ip_address[64];      // Address once joined ("" if the device does not report one)
+    double elapsed;           // Seconds until the outcome was known
+    int probes;               // Status probes made
+} LoquatConnectResult;
+
+// Read-only mapping of a file to upload, shared by every upload of it
+// (see loquat_image_open)
+typedef struct LoquatImage LoquatImage;
+
+// Result of an upload
+typedef struct {
+    int http_code;            // HTTP code of the final POST
+    size_t size;              // Image size in bytes
+    size_t sent;              // Body bytes sent, counting those sent again after a resume
+    size_t resumed_from;      // Offset the final POST started at (0 if never resumed)
+    int resumes;              // Times the device was asked for its offset after a failure
+    double elapsed;           // Seconds the upload took, waits between attempts included
+} LoquatUploadResult;
+
+// Result of a download
+typedef struct {
+    int http_code;            // HTTP code of the probe (206 when downloaded in ranges)
+    int ranged;               // Fetched as concurrent Range segments
+    size_t size;              // Resource size in bytes
+    size_t resumed;           // Bytes kept from an earlier, interrupted attempt
+    int segments;             // Range segments the resource was cut into
+    double elapsed;           // Seconds the download took
+} LoquatDownloadResult;
+
+#define LOQUAT_EVENT_NAME_MAX 63      // Longest SSE event type kept
+#define LOQUAT_EVENT_ID_MAX 255       // Longest SSE event ID kept
+
+// One event pushed by a subscribed device
+typedef struct {
+    const char *id;           // Last event ID seen ("" if the device sends none)
+    const char *event;        // SSE event type ("message" by default, "" for NDJSON)
+    const char *data;         // Event data, NUL-terminated (SSE data lines joined by '\n')
+    size_t data_len;          // Length of data in bytes
+} LoquatEvent;
+
+// Called for each event; return 0 to end the subscription
+typedef int (*loquat_event_cb)(const LoquatEvent *event, void *userdata);
+
+// Opaque latency histogram (see loquat_histogram_init)
+typedef struct LoquatHistogram LoquatHistogram;
+
+// Opaque context for non-blocking requests (see loquat_async_init)
+typedef struct LoquatAsync LoquatAsync;
+
+// Result of a completed async request
+typedef struct {
+    int ok;                   // 1 if the transfer completed, 0 on transport error
+    int http_code;            // HTTP response code (0 if the transfer failed)
+    const char *error;        // Transport error message when ok is 0, NULL otherwise
+    const char *response;     // Response body (valid only for the duration of the callback)
+    size_t response_size;     // Response body length in bytes
+    double total_time;        // Wall-clock time of the request in seconds
+    LoquatTiming timing;      // Phase timings of the request
+} LoquatAsyncResult;
+
+// Completion callback for an async request
+typedef void (*loquat_async_cb)(const LoquatAsyncResult *result, void *userdata);
+
+// Opaque pool of worker threads for blocking requests (see loquat_pool_init)
+typedef struct LoquatPool LoquatPool;
+
+// Opaque handle to the eventual result of a pool request (see loquat_pool_submit)
+typedef struct LoquatFuture LoquatFuture;
+
+// Opaque request built once and sent many times (see loquat_request_prepare)
+typedef struct LoquatRequest LoquatRequest;
+
+// Socket readiness flags used by the async API
+#define LOQUAT_POLL_IN     0x1
+#define LOQUAT_POLL_OUT    0x2
+#define LOQUAT_POLL_ERR    0x4
+#define LOQUAT_POLL_REMOVE 0x8
+
+// Called when the set of events to watch on fd changes (LOQUAT_POLL_REMOVE: stop watching)
+typedef void (*loquat_async_socket_cb)(int fd, int events, void *userdata);
+
+// Called when the next timeout action is due in timeout_ms (-1: cancel the timer)
+typedef void (*loquat_async_timer_cb)(long timeout_ms, void *userdata);
+
+// Result of one device request in a fleet run
+typedef struct {
+    const char *target;       // Base URL of the device
+    int index;                // Position of the target in the input list
+    int ok;                   // 1 if the transfer completed, 0 on transport error
+    int http_code;            // HTTP response code (0 if the transfer failed)
+    const char *error;        // Transport error message when ok is 0, NULL otherwise
+    const char *response;     // Response body (valid only for the duration of the callback)
+    size_t response_size;     // Response body length in bytes
+    double total_time;        // Wall-clock time of the request in seconds
+    LoquatTiming timing;      // Phase timings of the request
+    int resumes;              // Upload resumes after a dropped link (0 for other commands)
+    int retries;              // Times the request was sent again after a 429 or 503
+    int concurrency;          // The run's concurrency limit when the request finished
+} LoquatFleetResult;
+
+// Pacing of a fleet run (see loquat_fleet_options_init)
+typedef struct {
+    int max_concurrency;      // Most requests in flight at once (<= 0 for the default of 32)
+    int adaptive;             // Find and keep to the concurrency the fleet sustains, up to max_concurrency
+    double device_rate;       // Requests per second to any one device (0 for no limit)
+    double device_burst;      // Requests a device may receive back to back (at least 1)
+    int max_retries;          // Times a request refused with 429 or 503 is sent again
+} LoquatFleetOptions;
+
+// Callback invoked once per device as soon as its request completes
+typedef void (*loquat_fleet_result_cb)(const LoquatFleetResult *result, void *userdata);
+
 // Function declarations
 
+/**
+ * Initialize the library context shared by all clients (DNS cache,
+ * TLS session cache and connection pool). Reference-counted and
+ * thread-safe; loquat_client_init() calls it implicitly, so applications
+ * only need it to keep the shared caches alive between clients.
+ * @return 1 on success, 0 on failure
+ */
+int loquat_global_init(void);
+
+/**
+ * Release one reference taken by loquat_global_init(); the shared
+ * context is torn down when the last reference is released
+ */
+void loquat_global_cleanup(void);
+
 /**
  * Initialize the HTTP client
  * @param base_url The base URL for the client (can be NULL for default)
@@ -37,6 +314,46 @@ void loquat_client_cleanup(LoquatClient *client);
  */
 void loquat_client_set_base_url(LoquatClient *client, const char *url);
 
+/**
+ * Send the client's requests over a UNIX domain socket instead of TCP. The
+ * base URL still supplies the path and Host header; its host and port are
+ * not connected to.
+ * @param client Pointer to LoquatClient structure
+ * @param path Socket path, or NULL to go back to TCP
+ * @return 1 on success, 0 on failure
+ */
+int loquat_client_set_unix_socket(LoquatClient *client, const char *path);
+
+/**
+ * Let the client's GETs (loquat_client_get, loquat_client_get_with_headers)
+ * share identical requests already in progress in other threads. While a
+ * GET is in flight, an identical one (same URL, socket and headers) from
+ * another single-flight client waits for it and returns the same response
+ * pointer, which must then be treated as read-only; every caller still
+ * releases it with loquat_client_free_response().
+ * @param client Pointer to LoquatClient structure
+ * @param enable 1 to share requests, 0 to always make its own
+ */
+void loquat_client_set_single_flight(LoquatClient *client, int enable);
+
+/**
+ * Choose whether the client takes its connections from the cache shared
+ * by all clients (the default) or keeps its own. Shared connections let a
+ * short-lived client skip the TCP and TLS handshakes, but every client
+ * then takes the same lock for each request; a client that lives on its
+ * own thread and talks to one device does better with its own. DNS
+ * results and TLS sessions are shared either way.
+ * @param client Pointer to LoquatClient structure
+ * @param enable 1 to share connections, 0 to keep its own
+ */
+void loquat_client_set_connection_sharing(LoquatClient *client, int enable);
+
+/**
+ * Get the number of single-flight GETs issued and coalesced so far
+ * @param stats Filled with the counts since program start
+ */
+void loquat_flight_stats(LoquatFlightStats *stats);
+
 /**
  * Get the current base URL
  * @param client Pointer to LoquatClient structure
@@ -80,9 +397,694 @@ int loquat_client_get_with_headers(LoquatClient *client, const char *endpoint,
                                    char **response, int *http_code);
 
 /**
- * Free response memory allocated by the client
+ * Make a GET request into a caller-owned buffer that is reused across requests.
+ * Once the buffer has grown to fit the largest response, repeated requests
+ * perform no heap allocations.
+ * @param client Pointer to LoquatClient structure
+ * @param command The command to request (will be appended to base_url)
+ * @param buffer Buffer prepared with loquat_response_data_init(); holds the
+ *               NUL-terminated body in data and its length in size on success
+ * @param http_code Pointer to store the HTTP response code
+ * @return 1 on success, 0 on failure (including a body too large for a fixed buffer)
+ */
+int loquat_client_get_into(LoquatClient *client, const char *command, ResponseData *buffer, int *http_code);
+
+/**
+ * Make a conditional GET request into a reusable buffer. If validators hold
+ * an ETag or Last-Modified value from an earlier response, they are sent as
+ * If-None-Match / If-Modified-Since; a 304 means the resource is unchanged
+ * and leaves buffer empty. Validators are updated from every 200 response.
+ * @param client Pointer to LoquatClient structure
+ * @param command The command to request (will be appended to base_url)
+ * @param validators Validators from the previous response (zero-initialize before the first call)
+ * @param buffer Buffer prepared with loquat_response_data_init()
+ * @param http_code Pointer to store the HTTP response code
+ * @return 1 on success, 0 on failure
+ */
+int loquat_client_get_conditional(LoquatClient *client, const char *command, LoquatValidators *validators,
+                                  ResponseData *buffer, int *http_code);
+
+/**
+ * Prepare a request to base_url + "/" + command that is executed many times.
+ * The URL, headers, method, timeout and body are copied and configured on a
+ * connection handle of the request's own; the client's base URL and cache
+ * are taken as they are now, and the client can be freed afterwards.
+ * @param client Client providing the base URL and response cache
+ * @param command The command to request
+ * @param post_data Body to POST, or NULL to send a GET
+ * @param headers Array of header strings ("Header-Name: value"), can be NULL
+ * @param header_count Number of headers in the array
+ * @return Pointer to LoquatRequest, or NULL on failure
+ */
+LoquatRequest* loquat_request_prepare(LoquatClient *client, const char *command, const char *post_data,
+                                      char **headers, int header_count);
+
+/**
+ * Send a prepared request, receiving the body into a reusable buffer. GETs
+ * are answered from the response cache while it holds a fresh entry.
+ * @param request Prepared request
+ * @param buffer Buffer prepared with loquat_response_data_init()
+ * @param http_code Pointer to store the HTTP response code
+ * @return 1 on success, 0 on failure
+ */
+int loquat_request_execute(LoquatRequest *request, ResponseData *buffer, int *http_code);
+
+/**
+ * Get the phase timings of the most recent execution (all zero if it was
+ * served from the cache)
+ * @param request Prepared request
+ * @param timing Receives the timings
+ * @return 1 on success, 0 on failure
+ */
+int loquat_request_get_timing(LoquatRequest *request, LoquatTiming *timing);
+
+/**
+ * Free a prepared request
+ * @param request Pointer to LoquatRequest
+ */
+void loquat_request_free(LoquatRequest *request);
+
+/**
+ * Open a response cache. Entries live in one file per base URL + command
+ * under dir, so separate processes using the same directory share them.
+ * @param dir Cache directory (created on first store), or NULL for
+ *            $XDG_CACHE_HOME/loquatcli or ~/.cache/loquatcli
+ * @param max_age Seconds a cached response stays fresh for any command, or
+ *                a negative value to use the per-command defaults (only
+ *                get_scan_result is cached, for 10 seconds). 0 never
+ *                serves from the cache but still refreshes its entries.
+ * @return Pointer to LoquatCache, or NULL on failure
+ */
+LoquatCache* loquat_cache_open(const char *dir, double max_age);
+
+/**
+ * Close a response cache (entries stay on disk)
+ * @param cache Cache to close (may be NULL); detach it from clients first
+ */
+void loquat_cache_close(LoquatCache *cache);
+
+/**
+ * Serve GET requests from a response cache while entries are fresh and
+ * store successful (200) responses in it. The cache is not owned by the
+ * client and may be shared by several clients.
+ * @param client Pointer to LoquatClient structure
+ * @param cache Cache to use, or NULL to always go to the device
+ */
+void loquat_client_set_cache(LoquatClient *client, LoquatCache *cache);
+
+/**
+ * Tell whether the client's last GET response came from the cache
+ * @param client Pointer to LoquatClient structure
+ * @return Age of the cached response in seconds, or -1 if it came from the device
+ */
+double loquat_client_cache_age(LoquatClient *client);
+
+/**
+ * Join a Wi-Fi network without blocking for the worst case. Posts the
+ * credentials to connect and, while that request is outstanding, probes
+ * get_net_info (get_status on devices without it) with exponential
+ * backoff, returning as soon as the device reports the join succeeded or
+ * failed
+ * @param client Pointer to LoquatClient structure
+ * @param post_data Credentials, e.g. from get_post_connect_wifi_data()
+ * @param deadline Overall limit in seconds (<= 0 for the 120 second default)
+ * @param result Filled with the outcome
+ * @return 1 if an outcome (including LOQUAT_CONNECT_TIMEOUT) was reached, 0 on failure
+ */
+int loquat_client_connect_wifi(LoquatClient *client, const char *post_data, double deadline,
+                               LoquatConnectResult *result);
+
+/**
+ * Map a file for uploading. Opening a file that is already open (by any
+ * thread) shares the existing mapping; the file must not be truncated
+ * while it is mapped
+ * @param path Path of the firmware image or config bundle
+ * @return Image handle, or NULL on failure
+ */
+LoquatImage* loquat_image_open(const char *path);
+
+/**
+ * Release an image from loquat_image_open(); the last release unmaps it
+ * @param image Image to release
+ */
+void loquat_image_close(LoquatImage *image);
+
+/**
+ * Get the size of an image
+ * @param image Image from loquat_image_open()
+ * @return Size in bytes
+ */
+size_t loquat_image_size(const LoquatImage *image);
+
+/**
+ * Upload an image by POSTing it to command, streamed from the mapping in
+ * fixed-size chunks. After a dropped link the device is asked (HEAD, reply
+ * header Upload-Offset) how much it has stored and the upload resumes from
+ * there, with a growing wait between attempts
+ * @param client Pointer to LoquatClient structure
+ * @param command The command to POST to (e.g. "upload")
+ * @param image Image from loquat_image_open()
+ * @param buffer Receives the device's reply to the final POST
+ * @param result Filled with the outcome
+ * @return 1 if the device replied to the final POST, 0 on failure
+ */
+int loquat_client_upload(LoquatClient *client, const char *command, LoquatImage *image,
+                         ResponseData *buffer, LoquatUploadResult *result);
+
+/**
+ * Download a resource into a file. A one-byte Range probe gives the size;
+ * the resource is then fetched as Range segments over several connections,
+ * each written at its offset in a preallocated "<output>.part". Progress
+ * is kept in "<output>.part.state", so running the same download again
+ * after an interruption fetches only what is missing. A device that
+ * ignores Range is read as a single stream
+ * @param client Pointer to LoquatClient structure
+ * @param resource Path of the resource on the device (e.g. "logs/dump.bin")
+ * @param output File to create; replaced only once the download completes
+ * @param connections Concurrent connections (0 for the default of 4, at most 16)
+ * @param result Filled with the outcome; check http_code for a refused resource
+ * @return 1 if the device replied and any file was written, 0 on failure
+ */
+int loquat_client_download(LoquatClient *client, const char *resource, const char *output,
+                           int connections, LoquatDownloadResult *result);
+
+/**
+ * Subscribe to status updates pushed by the device. The endpoint is held
+ * open and parsed as chunks arrive: as server-sent events when the reply
+ * is text/event-stream, otherwise as newline-delimited JSON, one event per
+ * line. Events are passed on as soon as they are complete, never buffering
+ * the whole stream. A dropped stream is reopened with Last-Event-ID after
+ * the delay the device asked for (1 s by default), backing off to 30 s
+ * while attempts bring no events
+ * @param client Pointer to LoquatClient structure
+ * @param endpoint Stream endpoint on the device (e.g. "events")
+ * @param callback Called with each event, from the calling thread
+ * @param userdata Passed to callback
+ * @param http_code Filled with the HTTP code of the last attempt
+ * @return 1 once the callback returns 0 or the device refuses (or ends
+ *         with 204), 0 on failure or after 10 attempts in a row without an event
+ */
+int loquat_client_subscribe(LoquatClient *client, const char *endpoint, loquat_event_cb callback,
+                            void *userdata, int *http_code);
+
+/**
+ * Get the phase timings of the client's most recent request
+ * @param client Pointer to LoquatClient structure
+ * @param timing Filled with the timings (zeroed if no request has been made
+ *               or the response came from the cache)
+ * @return 1 on success, 0 on failure
+ */
+int loquat_client_get_timing(LoquatClient *client, LoquatTiming *timing);
+
+/**
+ * Create an empty latency histogram. Values are kept in log-linear buckets
+ * of microseconds, so any recorded latency is reproduced within 2%.
+ * @return Pointer to LoquatHistogram, or NULL on failure
+ */
+LoquatHistogram* loquat_histogram_init(void);
+
+/**
+ * Free a latency histogram
+ * @param histogram Histogram to free (may be NULL)
+ */
+void loquat_histogram_cleanup(LoquatHistogram *histogram);
+
+/**
+ * Record one latency
+ * @param histogram Pointer to LoquatHistogram
+ * @param seconds Latency in seconds (negative values count as 0)
+ * @return 1 on success, 0 on failure
+ */
+int loquat_histogram_record(LoquatHistogram *histogram, double seconds);
+
+/**
+ * Get the number of recorded latencies
+ * @param histogram Pointer to LoquatHistogram
+ * @return Number of values recorded
+ */
+unsigned long loquat_histogram_count(const LoquatHistogram *histogram);
+
+/**
+ * Get a percentile of the recorded latencies
+ * @param histogram Pointer to LoquatHistogram
+ * @param percentile Percentile between 0 and 100 (e.g. 99 for p99)
+ * @return Latency in seconds at or below which percentile% of values fall (0 if empty)
+ */
+double loquat_histogram_percentile(const LoquatHistogram *histogram, double percentile);
+
+/**
+ * Get the largest recorded latency
+ * @param histogram Pointer to LoquatHistogram
+ * @return Maximum latency in seconds (0 if empty)
+ */
+double loquat_histogram_max(const LoquatHistogram *histogram);
+
+/**
+ * Prepare a response buffer for loquat_client_get_into()
+ * @param buffer Buffer to initialize
+ * @param storage Caller storage to write into (never reallocated), or NULL to
+ *                let the library allocate and grow the buffer
+ * @param capacity Size of storage in bytes (ignored when storage is NULL)
+ */
+void loquat_response_data_init(ResponseData *buffer, char *storage, size_t capacity);
+
+/**
+ * Release memory the library allocated for a response buffer
+ * @param buffer Buffer to release (caller storage is left untouched)
+ */
+void loquat_response_data_free(ResponseData *buffer);
+
+/**
+ * Get the number of heap allocations made for response buffers so far.
+ * Only response buffers are counted: libcurl still allocates for every
+ * transfer (a few dozen times per request), which this does not see.
+ * A steady stream of requests into a warmed-up buffer leaves it unchanged.
+ * @return Allocation count since program start
+ */
+unsigned long loquat_response_alloc_count(void);
+
+/**
+ * Free response memory allocated by the client. A response shared by
+ * single-flight GETs is freed when the last caller releases it
  * @param response Pointer to response string to free
  */
 void loquat_client_free_response(char *response);
 
+/**
+ * Make a get_scan_result request and parse the body while it is received,
+ * calling callback for each access point as soon as it is complete
+ * @param client Pointer to LoquatClient structure
+ * @param callback Called once per access point, in response order
+ * @param userdata Opaque pointer passed through to callback
+ * @param http_code Pointer to store the HTTP response code (non-200 bodies are not parsed)
+ * @return 1 on success, 0 on transport failure or malformed scan result
+ */
+int loquat_client_get_scan_stream(LoquatClient *client, loquat_scan_ap_cb callback, void *userdata,
+                                  int *http_code);
+
+/**
+ * Send a request and write the response body to a file descriptor as it is
+ * received, without buffering it in memory. Fresh cached GET responses are
+ * written from the cache; streamed bodies are not stored in it.
+ * @param client Pointer to LoquatClient structure
+ * @param command Command (endpoint) to request
+ * @param post_data POST body, or NULL for a GET request
+ * @param fd Descriptor the body is written to (bodies of any HTTP status are written)
+ * @param http_code Pointer to store the HTTP response code
+ * @return 1 on success, 0 on transport or write failure
+ */
+int loquat_client_stream(LoquatClient *client, const char *command, const char *post_data,
+                         int fd, int *http_code);
+
+/**
+ * Initialize an incremental scan result parser
+ * @param parser Parser to initialize
+ * @param callback Called once per access point
+ * @param userdata Opaque pointer passed through to callback
+ */
+void loquat_scan_parser_init(LoquatScanParser *parser, loquat_scan_ap_cb callback, void *userdata);
+
+/**
+ * Feed the next chunk of a get_scan_result body; chunks may split tokens anywhere
+ * @param parser Parser state
+ * @param data Chunk data
+ * @param len Chunk length in bytes
+ * @return 1 on success, 0 if the input is malformed
+ */
+int loquat_scan_parser_feed(LoquatScanParser *parser, const char *data, size_t len);
+
+/**
+ * Check that the body fed so far formed a complete scan result array
+ * @param parser Parser state
+ * @return 1 if complete and well-formed, 0 otherwise
+ */
+int loquat_scan_parser_finish(LoquatScanParser *parser);
+
+/**
+ * Extract every access point of a complete get_scan_result body in place,
+ * without allocating. Fields are looked up like cJSON_GetObjectItem (first
+ * match, case-insensitive) and elements that are not objects are skipped.
+ * @param body Response body
+ * @param len Body length in bytes
+ * @param callback Called once per access point object (can be NULL to only validate)
+ * @param userdata Opaque pointer passed through to callback
+ * @return Number of access point objects, or -1 if the body is not a
+ *         well-formed JSON array (callback may already have been called)
+ */
+long loquat_extract_scan(const char *body, size_t len, loquat_scan_view_cb callback, void *userdata);
+
+/**
+ * Extract status, ip_address and ssid from a complete get_net_info body in place
+ * @param body Response body
+ * @param len Body length in bytes
+ * @param info Receives views into body
+ * @return 1 on success, 0 if the body is not a well-formed JSON object
+ */
+int loquat_extract_net_info(const char *body, size_t len, LoquatNetInfoView *info);
+
+/**
+ * Copy an extracted string into a buffer, decoding escapes
+ * @param view String view from an extracted body
+ * @param dst Destination buffer, always NUL-terminated
+ * @param size Size of dst in bytes (longer strings are truncated)
+ * @return Number of bytes written, excluding the terminator
+ */
+size_t loquat_string_view_copy(const LoquatStringView *view, char *dst, size_t size);
+
+/**
+ * Create an empty scan index used to compute differences between scans
+ * @return Pointer to LoquatScanIndex, or NULL on failure
+ */
+LoquatScanIndex* loquat_scan_index_init(void);
+
+/**
+ * Free a scan index
+ * @param index Pointer to LoquatScanIndex
+ */
+void loquat_scan_index_cleanup(LoquatScanIndex *index);
+
+/**
+ * Start recording a new scan
+ * @param index Pointer to LoquatScanIndex
+ */
+void loquat_scan_index_begin(LoquatScanIndex *index);
+
+/**
+ * Record one access point of the scan in progress (SSIDs reported more
+ * than once keep the strongest bars)
+ * @param index Pointer to LoquatScanIndex
+ * @param ap Access point to record
+ * @return 1 on success, 0 on failure
+ */
+int loquat_scan_index_add(LoquatScanIndex *index, const LoquatAccessPoint *ap);
+
+/**
+ * Finish the scan in progress, reporting every access point added, removed
+ * or whose bars changed since the previous scan
+ * @param index Pointer to LoquatScanIndex
+ * @param callback Called once per difference (can be NULL)
+ * @param userdata Opaque pointer passed through to callback
+ * @return Number of differences
+ */
+int loquat_scan_index_commit(LoquatScanIndex *index, loquat_scan_diff_cb callback, void *userdata);
+
+/**
+ * Get the number of access points in the index
+ * @param index Pointer to LoquatScanIndex
+ * @return Number of distinct SSIDs from the last committed scan
+ */
+size_t loquat_scan_index_size(LoquatScanIndex *index);
+
+/**
+ * Create an empty survey that merges scans from many devices into one set
+ * of access points, keyed by SSID plus BSSID when the device reports one
+ * @return Pointer to LoquatSurvey, or NULL on failure
+ */
+LoquatSurvey* loquat_survey_init(void);
+
+/**
+ * Free a survey
+ * @param survey Pointer to LoquatSurvey
+ */
+void loquat_survey_cleanup(LoquatSurvey *survey);
+
+/**
+ * Record one access point seen by a device. All access points of one
+ * device's scan must be added together, before the next device's.
+ * @param survey Pointer to LoquatSurvey
+ * @param device Index of the reporting device (>= 0)
+ * @param ap Access point the device reported
+ * @return 1 on success, 0 on failure
+ */
+int loquat_survey_add(LoquatSurvey *survey, int device, const LoquatAccessPoint *ap);
+
+/**
+ * Get the number of distinct access points recorded
+ * @param survey Pointer to LoquatSurvey
+ * @return Number of access points
+ */
+size_t loquat_survey_size(const LoquatSurvey *survey);
+
+/**
+ * Report every access point of the survey, ordered by SSID then BSSID
+ * @param survey Pointer to LoquatSurvey
+ * @param callback Called once per access point
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 on success, 0 on failure
+ */
+int loquat_survey_report(LoquatSurvey *survey, loquat_survey_ap_cb callback, void *userdata);
+
+/**
+ * Create a context for non-blocking requests. Requests are driven either by
+ * an external event loop (via the socket/timer callbacks and
+ * loquat_async_socket_action) or by the built-in loquat_async_run loop.
+ * @return Pointer to LoquatAsync context, or NULL on failure
+ */
+LoquatAsync* loquat_async_init(void);
+
+/**
+ * Destroy an async context; requests still in flight are dropped without callbacks
+ * @param async Pointer to LoquatAsync context
+ */
+void loquat_async_cleanup(LoquatAsync *async);
+
+/**
+ * Set the callback told which sockets to watch for which events
+ * @param async Pointer to LoquatAsync context
+ * @param callback Socket interest callback (e.g. to update an epoll set)
+ * @param userdata Opaque pointer passed through to callback
+ */
+void loquat_async_set_socket_callback(LoquatAsync *async, loquat_async_socket_cb callback, void *userdata);
+
+/**
+ * Set the callback told when the next timeout action is due
+ * @param async Pointer to LoquatAsync context
+ * @param callback Timer callback (e.g. to arm a timerfd)
+ * @param userdata Opaque pointer passed through to callback
+ */
+void loquat_async_set_timer_callback(LoquatAsync *async, loquat_async_timer_cb callback, void *userdata);
+
+/**
+ * Send requests submitted from now on over a UNIX domain socket
+ * @param async Pointer to LoquatAsync context
+ * @param path Socket path, or NULL to go back to TCP
+ * @return 1 on success, 0 on failure
+ */
+int loquat_async_set_unix_socket(LoquatAsync *async, const char *path);
+
+/**
+ * Submit a GET request without blocking
+ * @param async Pointer to LoquatAsync context
+ * @param base_url Base URL of the device
+ * @param command The command to request (will be appended to base_url)
+ * @param callback Called once when the request completes
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 if the request was submitted, 0 on failure
+ */
+int loquat_async_get(LoquatAsync *async, const char *base_url, const char *command,
+                     loquat_async_cb callback, void *userdata);
+
+/**
+ * Submit a POST request without blocking
+ * @param async Pointer to LoquatAsync context
+ * @param base_url Base URL of the device
+ * @param command The command to request (will be appended to base_url)
+ * @param post_data The data to send (copied; can be NULL for empty POST)
+ * @param callback Called once when the request completes
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 if the request was submitted, 0 on failure
+ */
+int loquat_async_post(LoquatAsync *async, const char *base_url, const char *command,
+                      const char *post_data, loquat_async_cb callback, void *userdata);
+
+/**
+ * Drive transfers after a watched socket became ready or the timer expired.
+ * Completion callbacks run from inside this call.
+ * @param async Pointer to LoquatAsync context
+ * @param fd The ready socket, or -1 when the timer expired
+ * @param events LOQUAT_POLL_* flags that are ready on fd
+ * @return 1 on success, 0 on failure
+ */
+int loquat_async_socket_action(LoquatAsync *async, int fd, int events);
+
+/**
+ * Get the time until a timeout action is due
+ * @param async Pointer to LoquatAsync context
+ * @return Milliseconds until loquat_async_socket_action(async, -1, 0) should be called, or -1 if none
+ */
+long loquat_async_timeout(LoquatAsync *async);
+
+/**
+ * Get the number of submitted requests that have not completed yet
+ * @param async Pointer to LoquatAsync context
+ * @return Number of pending requests
+ */
+int loquat_async_pending(LoquatAsync *async);
+
+/**
+ * Run a built-in poll() loop until every submitted request has completed
+ * @param async Pointer to LoquatAsync context
+ * @return 1 on success, 0 on failure
+ */
+int loquat_async_run(LoquatAsync *async);
+
+/**
+ * Make one pass of the built-in loop: wait for socket activity until libcurl
+ * next needs a timeout action or max_wait_ms passes, whichever is sooner,
+ * and handle whatever became ready. Lets callers interleave their own work,
+ * e.g. submitting requests on a schedule.
+ * @param async Pointer to LoquatAsync context
+ * @param max_wait_ms Longest wait in milliseconds (-1: as long as libcurl allows)
+ * @return 1 on success, 0 on failure
+ */
+int loquat_async_run_once(LoquatAsync *async, long max_wait_ms);
+
+/**
+ * Start a pool of worker threads, each with its own connection handle.
+ * Every pool function may be called from any thread.
+ * @param workers Number of worker threads (<= 0 for one per online CPU)
+ * @return Pointer to LoquatPool, or NULL on failure
+ */
+LoquatPool* loquat_pool_init(int workers);
+
+/**
+ * Finish every submitted request, stop the workers and free the pool
+ * @param pool Pointer to LoquatPool
+ */
+void loquat_pool_cleanup(LoquatPool *pool);
+
+/**
+ * Queue a GET request; blocks only while the submission queue is full
+ * @param pool Pointer to LoquatPool
+ * @param base_url Base URL of the device (e.g. "http://192.168.1.100:8080")
+ * @param command The command to request (appended to base_url)
+ * @param callback Called on a worker thread when the request completes
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 if queued, 0 on failure
+ */
+int loquat_pool_get(LoquatPool *pool, const char *base_url, const char *command,
+                    loquat_async_cb callback, void *userdata);
+
+/**
+ * Queue a POST request; blocks only while the submission queue is full
+ * @param pool Pointer to LoquatPool
+ * @param base_url Base URL of the device
+ * @param command The command to request (appended to base_url)
+ * @param post_data Body to send (copied)
+ * @param callback Called on a worker thread when the request completes
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 if queued, 0 on failure
+ */
+int loquat_pool_post(LoquatPool *pool, const char *base_url, const char *command, const char *post_data,
+                     loquat_async_cb callback, void *userdata);
+
+/**
+ * Queue a request and get a future for its result
+ * @param pool Pointer to LoquatPool
+ * @param base_url Base URL of the device
+ * @param command The command to request (appended to base_url)
+ * @param post_data Body to POST (copied), or NULL to send a GET
+ * @return Future to pass to loquat_future_wait() and loquat_future_free(), or NULL on failure
+ */
+LoquatFuture* loquat_pool_submit(LoquatPool *pool, const char *base_url, const char *command,
+                                 const char *post_data);
+
+/**
+ * Block until every request submitted so far has completed
+ * @param pool Pointer to LoquatPool
+ */
+void loquat_pool_wait(LoquatPool *pool);
+
+/**
+ * Get the number of worker threads
+ * @param pool Pointer to LoquatPool
+ * @return Number of workers
+ */
+int loquat_pool_size(const LoquatPool *pool);
+
+/**
+ * Check without blocking whether a future's request has completed
+ * @param future Pointer to LoquatFuture
+ * @return 1 if completed, 0 otherwise
+ */
+int loquat_future_done(LoquatFuture *future);
+
+/**
+ * Wait for a future's request to complete
+ * @param future Pointer to LoquatFuture
+ * @param result Filled with the result; response stays valid until loquat_future_free() (can be NULL)
+ * @return 1 on success, 0 on failure
+ */
+int loquat_future_wait(LoquatFuture *future, LoquatAsyncResult *result);
+
+/**
+ * Free a future, waiting for its request first if it is still running
+ * @param future Pointer to LoquatFuture
+ */
+void loquat_future_free(LoquatFuture *future);
+
+/**
+ * Fill in the default pacing: adaptive concurrency up to max_concurrency,
+ * no per-device rate limit and up to 3 retries of refused requests
+ * @param options Options to fill in
+ * @param max_concurrency Most requests in flight at once (<= 0 for the default)
+ */
+void loquat_fleet_options_init(LoquatFleetOptions *options, int max_concurrency);
+
+/**
+ * Issue the same command, or upload an image, to many devices, paced by
+ * options. With adaptive set, the number of requests in flight starts
+ * small and grows while devices keep up; timeouts, 5xx and 429 replies,
+ * and latency rising well above its average halve it. Each device has a
+ * token bucket of device_rate requests per second, and a 429 or 503 is
+ * sent again after the reply's Retry-After (or a growing delay), during
+ * which that device gets no other requests
+ * @param targets Array of device base URLs; a device listed several times gets several requests
+ * @param target_count Number of entries in targets
+ * @param command The command to request on every device
+ * @param post_data Body to POST to every device, or NULL to send a GET
+ * @param image Image to upload (see loquat_fleet_upload), or NULL
+ * @param options Pacing, or NULL for the defaults
+ * @param callback Called once per target, in completion order
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 on success, 0 on failure
+ */
+int loquat_fleet_run_paced(const char **targets, int target_count, const char *command,
+                           const char *post_data, LoquatImage *image, const LoquatFleetOptions *options,
+                           loquat_fleet_result_cb callback, void *userdata);
+
+/**
+ * Issue the same command to many devices concurrently, with the default
+ * pacing (see loquat_fleet_run_paced)
+ * @param targets Array of device base URLs (e.g. "http://192.168.1.100:8080")
+ * @param target_count Number of entries in targets
+ * @param command The command to request on every device (appended to each base URL)
+ * @param post_data Body to POST to every device, or NULL to send a GET
+ * @param max_concurrency Maximum number of requests in flight at once (<= 0 for the default)
+ * @param callback Called once per device, in completion order
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 on success, 0 on failure
+ */
+int loquat_fleet_run(const char **targets, int target_count, const char *command,
+                     const char *post_data, int max_concurrency,
+                     loquat_fleet_result_cb callback, void *userdata);
+
+/**
+ * Upload one image to many devices concurrently. Every transfer reads from
+ * the same mapping, and each device resumes on its own after a dropped link
+ * (see loquat_client_upload)
+ * @param targets Array of device base URLs
+ * @param target_count Number of entries in targets
+ * @param command The command to POST the image to on every device
+ * @param image Image from loquat_image_open()
+ * @param max_concurrency Maximum number of uploads in flight at once (<= 0 for the default);
+ *        as in loquat_fleet_run, fewer are kept in flight while devices struggle
+ * @param callback Called once per device when its upload finishes or fails
+ * @param userdata Opaque pointer passed through to callback
+ * @return 1 on success, 0 on failure
+ */
+int loquat_fleet_upload(const char **targets, int target_count, const char *command,
+                        LoquatImage *image, int max_concurrency,
+                        loquat_fleet_result_cb callback, void *userdata);
+
 #endif // LOQUATCLI_H 
\ No newline at end of file